@@ -64,6 +64,14 @@
 #define _PAGE_FILE	(_AT(pteval_t, 1) << _PAGE_BIT_FILE)
 #define _PAGE_PROTNONE	(_AT(pteval_t, 1) << _PAGE_BIT_PROTNONE)
 
+/*
+ * A NUMA hinting pte is a PROT_NONE pte: it still maps the page but has
+ * _PAGE_PRESENT clear, so the next access takes a fault.
+ */
+#ifdef CONFIG_NUMA_BALANCING
+#define _PAGE_NUMA	_PAGE_PROTNONE
+#endif
+
 #define _PAGE_TABLE	(_PAGE_PRESENT | _PAGE_RW | _PAGE_USER |	\
 			 _PAGE_ACCESSED | _PAGE_DIRTY)
 #define _KERNPG_TABLE	(_PAGE_PRESENT | _PAGE_RW | _PAGE_ACCESSED |	\
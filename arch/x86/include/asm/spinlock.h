@@ -82,6 +82,11 @@ static __always_inline void __ticket_spin_unlock(arch_spinlock_t *lock)
 	__add(&lock->tickets.head, 1, UNLOCK_LOCK_PREFIX);
 }
 
+static __always_inline int arch_spin_value_unlocked(arch_spinlock_t lock)
+{
+	return lock.tickets.head == lock.tickets.tail;
+}
+
 static inline int __ticket_spin_is_locked(arch_spinlock_t *lock)
 {
 	struct __raw_tickets tmp = ACCESS_ONCE(lock->tickets);
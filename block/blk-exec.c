@@ -5,6 +5,7 @@
 #include <linux/module.h>
 #include <linux/bio.h>
 #include <linux/blkdev.h>
+#include <linux/blk-mq.h>
 
 #include "blk.h"
 
@@ -51,6 +52,21 @@ void blk_execute_rq_nowait(struct request_queue *q, struct gendisk *bd_disk,
 	int where = at_head ? ELEVATOR_INSERT_FRONT : ELEVATOR_INSERT_BACK;
 
 	WARN_ON(irqs_disabled());
+
+	if (q->mq_ops) {
+		if (unlikely(blk_queue_dead(q))) {
+			rq->errors = -ENXIO;
+			if (done)
+				done(rq, rq->errors);
+			return;
+		}
+
+		rq->rq_disk = bd_disk;
+		rq->end_io = done;
+		blk_mq_insert_request(rq, at_head, true, false);
+		return;
+	}
+
 	spin_lock_irq(q->queue_lock);
 
 	if (unlikely(blk_queue_dead(q))) {
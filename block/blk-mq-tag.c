@@ -0,0 +1,196 @@
+/*
+ * Fast and scalable tag allocation for the multiqueue block layer.
+ *
+ * Every hardware queue owns a preallocated set of tags, one per request
+ * it can have in flight.  Tags are handed out from a bitmap with atomic
+ * bit operations, so allocation and freeing never take a lock.  The
+ * first @reserved_tags tags are only given out to callers that ask for
+ * them explicitly, which guarantees forward progress for internal
+ * requests (e.g. flushes) even when the normal pool is exhausted.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/wait.h>
+#include <linux/percpu.h>
+#include <linux/blk-mq.h>
+
+#include "blk.h"
+#include "blk-mq.h"
+#include "blk-mq-tag.h"
+
+struct blk_mq_tags {
+	unsigned int nr_tags;
+	unsigned int nr_reserved_tags;
+
+	/* per-cpu allocation hint, to spread the bitmap scans */
+	unsigned int __percpu *hint;
+
+	atomic_t busy;
+	wait_queue_head_t wait[2];	/* normal, reserved */
+
+	unsigned long *bitmap;
+};
+
+static unsigned int __blk_mq_get_tag_range(struct blk_mq_tags *tags,
+					   unsigned int start, unsigned int end)
+{
+	unsigned int *hint = this_cpu_ptr(tags->hint);
+	unsigned int tag, first;
+
+	first = *hint;
+	if (first < start || first >= end)
+		first = start;
+
+	tag = first;
+	do {
+		tag = find_next_zero_bit(tags->bitmap, end, tag);
+		if (tag >= end) {
+			if (first == start)
+				return BLK_MQ_TAG_FAIL;
+			/* wrap around once and scan the part we skipped */
+			end = first;
+			first = start;
+			tag = start;
+			continue;
+		}
+		if (!test_and_set_bit_lock(tag, tags->bitmap)) {
+			*hint = tag + 1;
+			atomic_inc(&tags->busy);
+			return tag;
+		}
+		tag++;
+	} while (1);
+}
+
+static unsigned int __blk_mq_get_tag(struct blk_mq_tags *tags, bool reserved)
+{
+	unsigned int tag;
+
+	preempt_disable();
+	if (reserved)
+		tag = __blk_mq_get_tag_range(tags, 0, tags->nr_reserved_tags);
+	else
+		tag = __blk_mq_get_tag_range(tags, tags->nr_reserved_tags,
+					     tags->nr_tags);
+	preempt_enable();
+
+	return tag;
+}
+
+/**
+ * blk_mq_get_tag - allocate a tag
+ * @tags:	tag set to allocate from
+ * @gfp:	if __GFP_WAIT is set, sleep until a tag becomes available
+ * @reserved:	allocate from the reserved part of the tag space
+ *
+ * Returns the allocated tag, or %BLK_MQ_TAG_FAIL if none was available
+ * and @gfp did not allow waiting.
+ */
+unsigned int blk_mq_get_tag(struct blk_mq_tags *tags, gfp_t gfp, bool reserved)
+{
+	wait_queue_head_t *wq = &tags->wait[reserved];
+	DEFINE_WAIT(wait);
+	unsigned int tag;
+
+	if (unlikely(reserved && !tags->nr_reserved_tags)) {
+		WARN_ON_ONCE(1);
+		return BLK_MQ_TAG_FAIL;
+	}
+
+	tag = __blk_mq_get_tag(tags, reserved);
+	if (tag != BLK_MQ_TAG_FAIL || !(gfp & __GFP_WAIT))
+		return tag;
+
+	do {
+		prepare_to_wait_exclusive(wq, &wait, TASK_UNINTERRUPTIBLE);
+		tag = __blk_mq_get_tag(tags, reserved);
+		if (tag != BLK_MQ_TAG_FAIL)
+			break;
+		io_schedule();
+	} while (1);
+	finish_wait(wq, &wait);
+
+	return tag;
+}
+
+void blk_mq_put_tag(struct blk_mq_tags *tags, unsigned int tag)
+{
+	wait_queue_head_t *wq = &tags->wait[tag < tags->nr_reserved_tags];
+
+	BUG_ON(tag >= tags->nr_tags);
+
+	atomic_dec(&tags->busy);
+	clear_bit_unlock(tag, tags->bitmap);
+	smp_mb__after_clear_bit();
+	if (waitqueue_active(wq))
+		wake_up(wq);
+}
+
+bool blk_mq_has_free_tags(struct blk_mq_tags *tags)
+{
+	return atomic_read(&tags->busy) < tags->nr_tags;
+}
+
+bool blk_mq_tags_idle(struct blk_mq_tags *tags)
+{
+	return !atomic_read(&tags->busy);
+}
+
+unsigned int blk_mq_tags_busy(struct blk_mq_tags *tags)
+{
+	return atomic_read(&tags->busy);
+}
+
+struct blk_mq_tags *blk_mq_init_tags(unsigned int total_tags,
+				     unsigned int reserved_tags, int node)
+{
+	struct blk_mq_tags *tags;
+	unsigned int cpu;
+
+	if (total_tags > BLK_MQ_MAX_DEPTH) {
+		pr_err("blk-mq: tag depth too large\n");
+		return NULL;
+	}
+	if (reserved_tags >= total_tags)
+		return NULL;
+
+	tags = kzalloc_node(sizeof(*tags), GFP_KERNEL, node);
+	if (!tags)
+		return NULL;
+
+	tags->bitmap = kzalloc_node(BITS_TO_LONGS(total_tags) * sizeof(long),
+				    GFP_KERNEL, node);
+	if (!tags->bitmap)
+		goto err_bitmap;
+
+	tags->hint = alloc_percpu(unsigned int);
+	if (!tags->hint)
+		goto err_hint;
+
+	/* start every cpu at a different offset into the normal tag space */
+	for_each_possible_cpu(cpu)
+		*per_cpu_ptr(tags->hint, cpu) = reserved_tags +
+			(cpu * (total_tags - reserved_tags)) / nr_cpu_ids;
+
+	tags->nr_tags = total_tags;
+	tags->nr_reserved_tags = reserved_tags;
+	atomic_set(&tags->busy, 0);
+	init_waitqueue_head(&tags->wait[0]);
+	init_waitqueue_head(&tags->wait[1]);
+	return tags;
+
+err_hint:
+	kfree(tags->bitmap);
+err_bitmap:
+	kfree(tags);
+	return NULL;
+}
+
+void blk_mq_free_tags(struct blk_mq_tags *tags)
+{
+	free_percpu(tags->hint);
+	kfree(tags->bitmap);
+	kfree(tags);
+}
@@ -0,0 +1,22 @@
+#ifndef INT_BLK_MQ_TAG_H
+#define INT_BLK_MQ_TAG_H
+
+struct blk_mq_tags;
+
+extern struct blk_mq_tags *blk_mq_init_tags(unsigned int nr_tags,
+					    unsigned int reserved_tags,
+					    int node);
+extern void blk_mq_free_tags(struct blk_mq_tags *tags);
+
+extern unsigned int blk_mq_get_tag(struct blk_mq_tags *tags, gfp_t gfp,
+				   bool reserved);
+extern void blk_mq_put_tag(struct blk_mq_tags *tags, unsigned int tag);
+extern bool blk_mq_has_free_tags(struct blk_mq_tags *tags);
+extern bool blk_mq_tags_idle(struct blk_mq_tags *tags);
+extern unsigned int blk_mq_tags_busy(struct blk_mq_tags *tags);
+
+enum {
+	BLK_MQ_TAG_FAIL		= -1U,
+};
+
+#endif
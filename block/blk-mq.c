@@ -0,0 +1,1060 @@
+/*
+ * Block multiqueue core code
+ *
+ * Instead of funnelling every request through the single
+ * request_queue->queue_lock, a multiqueue capable queue gives each CPU its
+ * own software staging queue (struct blk_mq_ctx) and maps those onto one or
+ * more hardware dispatch contexts (struct blk_mq_hw_ctx).  Requests are
+ * preallocated per hardware context and identified by a tag, so neither
+ * allocation nor submission touches a lock shared by all CPUs.
+ *
+ * There is no IO scheduler: requests are only merged with what is still
+ * sitting in the submitting CPU's software queue, and are otherwise handed
+ * to the driver in submission order.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/mm.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+#include <linux/smp.h>
+#include <linux/cpu.h>
+#include <linux/cache.h>
+#include <linux/sched.h>
+#include <linux/delay.h>
+#include <linux/blk-mq.h>
+
+#include <trace/events/block.h>
+
+#include "blk.h"
+#include "blk-mq.h"
+#include "blk-mq-tag.h"
+
+static DEFINE_MUTEX(all_q_mutex);
+static LIST_HEAD(all_q_list);
+
+/* how many requests at the tail of a software queue we try to merge with */
+#define BLK_MQ_MERGE_DEPTH	8
+
+/*
+ * Check if any of the ctx's have pending work in this hardware queue
+ */
+static bool blk_mq_hctx_has_pending(struct blk_mq_hw_ctx *hctx)
+{
+	unsigned int i;
+
+	for (i = 0; i < BITS_TO_LONGS(hctx->nr_ctx); i++)
+		if (hctx->ctx_map[i])
+			return true;
+
+	return !list_empty_careful(&hctx->dispatch);
+}
+
+/*
+ * Mark this ctx as having pending work in this hardware queue
+ */
+static void blk_mq_hctx_mark_pending(struct blk_mq_hw_ctx *hctx,
+				     struct blk_mq_ctx *ctx)
+{
+	if (!test_bit(ctx->index_hw, hctx->ctx_map))
+		set_bit(ctx->index_hw, hctx->ctx_map);
+}
+
+/*
+ * Default mapping of CPUs onto hardware queues: spread the possible CPUs
+ * evenly over the available queues, keeping neighbouring CPU ids (which
+ * usually share a core or a package) on the same queue.
+ */
+static int blk_mq_update_queue_map(unsigned int *map,
+				   unsigned int nr_queues)
+{
+	unsigned int i, cpu, nr_cpus = num_possible_cpus();
+
+	if (!nr_cpus)
+		return -EINVAL;
+
+	i = 0;
+	for_each_possible_cpu(cpu)
+		map[cpu] = (i++ * nr_queues) / nr_cpus;
+
+	return 0;
+}
+
+/**
+ * blk_mq_map_queue - default cpu to hardware queue mapping
+ * @q:		multiqueue request queue
+ * @cpu:	cpu the request is issued from
+ *
+ * Drivers whose hardware contexts have no cpu affinity of their own can use
+ * this as their ->map_queue operation.
+ */
+struct blk_mq_hw_ctx *blk_mq_map_queue(struct request_queue *q, const int cpu)
+{
+	return q->queue_hw_ctx[q->mq_map[cpu]];
+}
+EXPORT_SYMBOL(blk_mq_map_queue);
+
+static void blk_mq_rq_ctx_init(struct blk_mq_ctx *ctx, struct request *rq,
+			       unsigned int rw_flags)
+{
+	rq->mq_ctx = ctx;
+	rq->cmd_flags = rw_flags;
+	ctx->rq_dispatched[rw_is_sync(rw_flags)]++;
+}
+
+static struct request *__blk_mq_alloc_request(struct blk_mq_hw_ctx *hctx,
+					      gfp_t gfp, bool reserved)
+{
+	struct request *rq;
+	unsigned int tag;
+
+	tag = blk_mq_get_tag(hctx->tags, gfp, reserved);
+	if (tag == BLK_MQ_TAG_FAIL)
+		return NULL;
+
+	rq = hctx->rqs[tag];
+	blk_rq_init(hctx->queue, rq);
+	rq->tag = tag;
+
+	return rq;
+}
+
+/*
+ * Allocate a request from the hardware queue serving the current CPU.  On
+ * success the software queue of that CPU is returned in @ctxp and the caller
+ * stays pinned to the CPU until it calls blk_mq_put_ctx().
+ */
+static struct request *blk_mq_get_request(struct request_queue *q,
+					  unsigned int rw_flags, gfp_t gfp,
+					  bool reserved,
+					  struct blk_mq_ctx **ctxp)
+{
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+
+	if (blk_queue_io_stat(q))
+		rw_flags |= REQ_IO_STAT;
+
+	while (1) {
+		ctx = blk_mq_get_ctx(q);
+		hctx = q->mq_ops->map_queue(q, ctx->cpu);
+
+		rq = __blk_mq_alloc_request(hctx, GFP_ATOMIC, reserved);
+		if (rq) {
+			blk_mq_rq_ctx_init(ctx, rq, rw_flags);
+			*ctxp = ctx;
+			return rq;
+		}
+
+		blk_mq_put_ctx(ctx);
+		if (!(gfp & __GFP_WAIT) || blk_queue_dead(q))
+			return NULL;
+
+		/*
+		 * Sleep until this hardware queue frees a tag, then retry
+		 * from scratch: we may have been migrated meanwhile and the
+		 * request has to come from the queue of the cpu it is
+		 * inserted on.
+		 */
+		blk_mq_put_tag(hctx->tags,
+			       blk_mq_get_tag(hctx->tags, gfp, reserved));
+	}
+}
+
+/**
+ * blk_mq_alloc_request - allocate a request for a multiqueue queue
+ * @q:		multiqueue request queue
+ * @rw:		READ or WRITE
+ * @gfp:	allocation flags, __GFP_WAIT to wait for a free tag
+ * @reserved:	allocate from the driver's reserved tags
+ *
+ * Used for requests that do not originate from a bio, e.g. through
+ * blk_get_request().
+ */
+struct request *blk_mq_alloc_request(struct request_queue *q, int rw,
+				     gfp_t gfp, bool reserved)
+{
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+
+	rq = blk_mq_get_request(q, rw, gfp, reserved, &ctx);
+	if (rq)
+		blk_mq_put_ctx(ctx);
+
+	return rq;
+}
+EXPORT_SYMBOL(blk_mq_alloc_request);
+
+/**
+ * blk_mq_free_request - return a request and its tag to the hardware queue
+ * @rq:		request to free
+ */
+void blk_mq_free_request(struct request *rq)
+{
+	struct blk_mq_ctx *ctx = rq->mq_ctx;
+	struct request_queue *q = rq->q;
+	struct blk_mq_hw_ctx *hctx = q->mq_ops->map_queue(q, ctx->cpu);
+	unsigned int tag = rq->tag;
+
+	/* this is a bio leak */
+	WARN_ON(rq->bio != NULL);
+
+	ctx->rq_completed[rq_is_sync(rq)]++;
+	rq->cmd_flags = 0;
+	blk_mq_put_tag(hctx->tags, tag);
+}
+EXPORT_SYMBOL(blk_mq_free_request);
+
+/**
+ * blk_mq_end_io - complete a request issued to a multiqueue driver
+ * @rq:		request to complete
+ * @error:	%0 for success, < %0 for error
+ *
+ * Ends all bios attached to @rq, accounts the IO and either hands the
+ * request to its ->end_io callback or frees it.  May be called from
+ * interrupt context.
+ */
+void blk_mq_end_io(struct request *rq, int error)
+{
+	if (blk_update_request(rq, error, blk_rq_bytes(rq)))
+		BUG();
+
+	blk_account_io_done(rq);
+
+	if (rq->end_io)
+		rq->end_io(rq, error);
+	else
+		blk_mq_free_request(rq);
+}
+EXPORT_SYMBOL(blk_mq_end_io);
+
+static void blk_mq_start_request(struct request *rq)
+{
+	struct request_queue *q = rq->q;
+
+	trace_block_rq_issue(q, rq);
+	rq->cmd_flags |= REQ_STARTED;
+}
+
+static void blk_mq_requeue_request(struct request *rq)
+{
+	trace_block_rq_requeue(rq->q, rq);
+	rq->cmd_flags &= ~REQ_STARTED;
+}
+
+/*
+ * Run this hardware queue, pulling any software queues mapped to it in.
+ * Requests left over from a previous run that found the driver busy are
+ * dispatched first.
+ */
+void __blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	struct request_queue *q = hctx->queue;
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+	LIST_HEAD(rq_list);
+	int bit, queued;
+
+	if (unlikely(test_bit(BLK_MQ_S_STOPPED, &hctx->state)))
+		return;
+
+	hctx->run++;
+
+	/*
+	 * Touch any software queue that has pending entries.
+	 */
+	for_each_set_bit(bit, hctx->ctx_map, hctx->nr_ctx) {
+		clear_bit(bit, hctx->ctx_map);
+		ctx = hctx->ctxs[bit];
+		BUG_ON(bit != ctx->index_hw);
+
+		spin_lock(&ctx->lock);
+		list_splice_tail_init(&ctx->rq_list, &rq_list);
+		spin_unlock(&ctx->lock);
+	}
+
+	/*
+	 * If we have previous entries on our dispatch list, grab them
+	 * and stuff them at the front for more fair dispatch.
+	 */
+	if (!list_empty_careful(&hctx->dispatch)) {
+		spin_lock(&hctx->lock);
+		if (!list_empty(&hctx->dispatch))
+			list_splice_init(&hctx->dispatch, &rq_list);
+		spin_unlock(&hctx->lock);
+	}
+
+	/*
+	 * Now process all the entries, sending them to the driver.
+	 */
+	queued = 0;
+	while (!list_empty(&rq_list)) {
+		int ret;
+
+		rq = list_first_entry(&rq_list, struct request, queuelist);
+		list_del_init(&rq->queuelist);
+		blk_mq_start_request(rq);
+
+		ret = q->mq_ops->queue_rq(hctx, rq, list_empty(&rq_list));
+		switch (ret) {
+		case BLK_MQ_RQ_QUEUE_OK:
+			queued++;
+			continue;
+		case BLK_MQ_RQ_QUEUE_BUSY:
+			/*
+			 * The driver is expected to have stopped the queue
+			 * and to restart it once it can take more requests.
+			 */
+			list_add(&rq->queuelist, &rq_list);
+			blk_mq_requeue_request(rq);
+			break;
+		default:
+			pr_err("blk-mq: bad return on queue: %d\n", ret);
+			/* fall through */
+		case BLK_MQ_RQ_QUEUE_ERROR:
+			blk_mq_end_io(rq, -EIO);
+			continue;
+		}
+
+		break;
+	}
+
+	if (!queued)
+		hctx->dispatched[0]++;
+	else if (queued < (1 << (BLK_MQ_MAX_DISPATCH_ORDER - 1)))
+		hctx->dispatched[ilog2(queued) + 1]++;
+	else
+		hctx->dispatched[BLK_MQ_MAX_DISPATCH_ORDER - 1]++;
+
+	/*
+	 * Any items that need requeuing? Stuff them into hctx->dispatch,
+	 * that is where we will continue on next queue run.
+	 */
+	if (!list_empty(&rq_list)) {
+		spin_lock(&hctx->lock);
+		list_splice(&rq_list, &hctx->dispatch);
+		spin_unlock(&hctx->lock);
+	}
+}
+
+/**
+ * blk_mq_run_hw_queue - dispatch pending requests of a hardware queue
+ * @hctx:	hardware queue to run
+ * @async:	defer the dispatch to kblockd
+ *
+ * Must be called with @async set from contexts that cannot call into the
+ * driver's ->queue_rq, e.g. from the driver's completion interrupt.
+ */
+void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx, bool async)
+{
+	if (unlikely(test_bit(BLK_MQ_S_STOPPED, &hctx->state)))
+		return;
+
+	if (!async)
+		__blk_mq_run_hw_queue(hctx);
+	else
+		kblockd_schedule_delayed_work(hctx->queue,
+					      &hctx->delayed_work, 0);
+}
+EXPORT_SYMBOL(blk_mq_run_hw_queue);
+
+void blk_mq_run_queues(struct request_queue *q, bool async)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (!blk_mq_hctx_has_pending(hctx) ||
+		    test_bit(BLK_MQ_S_STOPPED, &hctx->state))
+			continue;
+
+		blk_mq_run_hw_queue(hctx, async);
+	}
+}
+EXPORT_SYMBOL(blk_mq_run_queues);
+
+void blk_mq_stop_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	cancel_delayed_work(&hctx->delayed_work);
+	set_bit(BLK_MQ_S_STOPPED, &hctx->state);
+}
+EXPORT_SYMBOL(blk_mq_stop_hw_queue);
+
+void blk_mq_start_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	clear_bit(BLK_MQ_S_STOPPED, &hctx->state);
+	__blk_mq_run_hw_queue(hctx);
+}
+EXPORT_SYMBOL(blk_mq_start_hw_queue);
+
+void blk_mq_stop_hw_queues(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i)
+		blk_mq_stop_hw_queue(hctx);
+}
+EXPORT_SYMBOL(blk_mq_stop_hw_queues);
+
+/**
+ * blk_mq_start_stopped_hw_queues - restart all stopped hardware queues
+ * @q:		multiqueue request queue
+ *
+ * Typically called from a driver's completion handler once it has room
+ * for more requests again, so the queues are run asynchronously.
+ */
+void blk_mq_start_stopped_hw_queues(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (!test_bit(BLK_MQ_S_STOPPED, &hctx->state))
+			continue;
+
+		clear_bit(BLK_MQ_S_STOPPED, &hctx->state);
+		blk_mq_run_hw_queue(hctx, true);
+	}
+}
+EXPORT_SYMBOL(blk_mq_start_stopped_hw_queues);
+
+static void blk_mq_work_fn(struct work_struct *work)
+{
+	struct blk_mq_hw_ctx *hctx;
+
+	hctx = container_of(work, struct blk_mq_hw_ctx, delayed_work.work);
+	__blk_mq_run_hw_queue(hctx);
+}
+
+static void __blk_mq_insert_request(struct blk_mq_hw_ctx *hctx,
+				    struct blk_mq_ctx *ctx,
+				    struct request *rq, bool at_head)
+{
+	trace_block_rq_insert(hctx->queue, rq);
+
+	spin_lock(&ctx->lock);
+	if (at_head)
+		list_add(&rq->queuelist, &ctx->rq_list);
+	else
+		list_add_tail(&rq->queuelist, &ctx->rq_list);
+	spin_unlock(&ctx->lock);
+
+	blk_mq_hctx_mark_pending(hctx, ctx);
+	hctx->queued++;
+}
+
+/**
+ * blk_mq_insert_request - queue a fully set up request
+ * @rq:		request to insert
+ * @at_head:	insert at the head of the software queue
+ * @run_queue:	run the hardware queue after inserting
+ * @async:	run the hardware queue from kblockd
+ */
+void blk_mq_insert_request(struct request *rq, bool at_head, bool run_queue,
+			   bool async)
+{
+	struct request_queue *q = rq->q;
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_mq_ctx *ctx = rq->mq_ctx, *current_ctx;
+
+	current_ctx = blk_mq_get_ctx(q);
+	hctx = q->mq_ops->map_queue(q, ctx->cpu);
+
+	if (unlikely(!cpu_online(ctx->cpu))) {
+		/*
+		 * The cpu the request was allocated on has gone away and
+		 * its software queue was already drained.  The tag belongs
+		 * to @hctx, so hand the request to it directly.
+		 */
+		spin_lock(&hctx->lock);
+		list_add_tail(&rq->queuelist, &hctx->dispatch);
+		spin_unlock(&hctx->lock);
+	} else
+		__blk_mq_insert_request(hctx, ctx, rq, at_head);
+	blk_mq_put_ctx(current_ctx);
+
+	if (run_queue)
+		blk_mq_run_hw_queue(hctx, async);
+}
+EXPORT_SYMBOL(blk_mq_insert_request);
+
+/*
+ * Try to merge @bio into one of the most recently queued requests that are
+ * still waiting in @ctx for dispatch.
+ */
+static bool blk_mq_attempt_merge(struct request_queue *q,
+				 struct blk_mq_ctx *ctx, struct bio *bio)
+{
+	struct request *rq;
+	int checked = BLK_MQ_MERGE_DEPTH;
+
+	list_for_each_entry_reverse(rq, &ctx->rq_list, queuelist) {
+		int el_ret;
+
+		if (!checked--)
+			break;
+
+		if (!blk_rq_merge_ok(rq, bio))
+			continue;
+
+		el_ret = blk_try_merge(rq, bio);
+		if (el_ret == ELEVATOR_BACK_MERGE) {
+			if (bio_attempt_back_merge(q, rq, bio)) {
+				ctx->rq_merged++;
+				return true;
+			}
+			break;
+		} else if (el_ret == ELEVATOR_FRONT_MERGE) {
+			if (bio_attempt_front_merge(q, rq, bio)) {
+				ctx->rq_merged++;
+				return true;
+			}
+			break;
+		}
+	}
+
+	return false;
+}
+
+static void blk_mq_sync_end_io(struct request *rq, int error)
+{
+	struct completion *waiting = rq->end_io_data;
+
+	rq->errors = error;
+	complete(waiting);
+}
+
+/*
+ * Issue @rq and wait for it to finish.  The request is freed on return.
+ */
+static int blk_mq_execute_sync(struct request *rq)
+{
+	DECLARE_COMPLETION_ONSTACK(wait);
+	int err;
+
+	rq->end_io = blk_mq_sync_end_io;
+	rq->end_io_data = &wait;
+	blk_mq_insert_request(rq, false, true, false);
+	wait_for_completion(&wait);
+
+	err = rq->errors;
+	blk_mq_free_request(rq);
+	return err;
+}
+
+static int blk_mq_flush_sync(struct request_queue *q)
+{
+	struct request *rq;
+
+	rq = blk_mq_alloc_request(q, WRITE_FLUSH, GFP_NOIO, false);
+	if (!rq)
+		return -ENODEV;
+
+	rq->cmd_type = REQ_TYPE_FS;
+	rq->cmd_flags |= REQ_FLUSH_SEQ;
+	return blk_mq_execute_sync(rq);
+}
+
+/*
+ * Flush and FUA bios.  The driver only ever sees either empty REQ_FLUSH
+ * requests or data requests carrying REQ_FUA if it claimed support for it,
+ * just like with the sequencing done by blk-flush.c for legacy queues.  The
+ * sequence runs synchronously in the submitter's context; the only callers
+ * issuing these are integrity points in filesystems that wait for them
+ * anyway.
+ */
+static void blk_mq_flush_bio(struct request_queue *q, struct bio *bio)
+{
+	unsigned int fflags = q->flush_flags;
+	bool has_data = bio_has_data(bio);
+	bool post_flush;
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+	int err;
+
+	if ((bio->bi_rw & REQ_FLUSH) && (fflags & REQ_FLUSH)) {
+		err = blk_mq_flush_sync(q);
+		if (err || !has_data) {
+			bio_endio(bio, err);
+			return;
+		}
+	} else if (!has_data) {
+		bio_endio(bio, 0);
+		return;
+	}
+
+	bio->bi_rw &= ~REQ_FLUSH;
+	post_flush = (bio->bi_rw & REQ_FUA) && !(fflags & REQ_FUA);
+	if (!(fflags & REQ_FUA))
+		bio->bi_rw &= ~REQ_FUA;
+
+	rq = blk_mq_get_request(q, bio_data_dir(bio) | REQ_SYNC, GFP_NOIO,
+				false, &ctx);
+	if (unlikely(!rq)) {
+		bio_endio(bio, -ENODEV);
+		return;
+	}
+	blk_mq_put_ctx(ctx);
+
+	init_request_from_bio(rq, bio);
+	drive_stat_acct(rq, 1);
+
+	if (!post_flush) {
+		blk_mq_insert_request(rq, false, true, false);
+		return;
+	}
+
+	/*
+	 * Hold back completion of the bio until the data is on stable
+	 * storage, see req_bio_endio().
+	 */
+	rq->cmd_flags |= REQ_FLUSH_SEQ;
+	err = blk_mq_execute_sync(rq);
+	if (!err)
+		err = blk_mq_flush_sync(q);
+	bio_endio(bio, err);
+}
+
+static void blk_mq_make_request(struct request_queue *q, struct bio *bio)
+{
+	const int is_sync = rw_is_sync(bio->bi_rw);
+	unsigned int rw_flags = bio_data_dir(bio);
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+
+	blk_queue_bounce(q, &bio);
+
+	if (unlikely(blk_queue_dead(q))) {
+		bio_endio(bio, -ENODEV);
+		return;
+	}
+
+	if (unlikely(bio->bi_rw & (REQ_FLUSH | REQ_FUA))) {
+		blk_mq_flush_bio(q, bio);
+		return;
+	}
+
+	ctx = blk_mq_get_ctx(q);
+	hctx = q->mq_ops->map_queue(q, ctx->cpu);
+
+	if ((hctx->flags & BLK_MQ_F_SHOULD_MERGE) && !blk_queue_nomerges(q)) {
+		bool merged;
+
+		spin_lock(&ctx->lock);
+		merged = blk_mq_attempt_merge(q, ctx, bio);
+		spin_unlock(&ctx->lock);
+		if (merged) {
+			blk_mq_put_ctx(ctx);
+			return;
+		}
+	}
+	blk_mq_put_ctx(ctx);
+
+	if (is_sync)
+		rw_flags |= REQ_SYNC;
+
+	trace_block_getrq(q, bio, rw_flags & 1);
+	rq = blk_mq_get_request(q, rw_flags, GFP_NOIO, false, &ctx);
+	if (unlikely(!rq)) {
+		bio_endio(bio, -ENODEV);	/* @q is dead */
+		return;
+	}
+	hctx = q->mq_ops->map_queue(q, ctx->cpu);
+
+	init_request_from_bio(rq, bio);
+	if (test_bit(QUEUE_FLAG_SAME_COMP, &q->queue_flags))
+		rq->cpu = ctx->cpu;
+	drive_stat_acct(rq, 1);
+
+	__blk_mq_insert_request(hctx, ctx, rq, false);
+	blk_mq_put_ctx(ctx);
+
+	/*
+	 * Synchronous IO is dispatched right away.  Everything else is left
+	 * for kblockd, which gives following bios from this CPU a chance to
+	 * be merged in the software queue first.
+	 */
+	blk_mq_run_hw_queue(hctx, !is_sync);
+}
+
+/**
+ * blk_mq_drain_queue - wait for all requests of a dying queue to finish
+ * @q:		multiqueue request queue, already marked dead
+ */
+void blk_mq_drain_queue(struct request_queue *q)
+{
+	while (true) {
+		struct blk_mq_hw_ctx *hctx;
+		bool busy = false;
+		int i;
+
+		queue_for_each_hw_ctx(q, hctx, i) {
+			if (blk_mq_hctx_has_pending(hctx))
+				blk_mq_run_hw_queue(hctx, false);
+			busy |= !blk_mq_tags_idle(hctx->tags);
+		}
+
+		if (!busy)
+			break;
+		msleep(10);
+	}
+}
+
+static void blk_mq_free_rq_map(struct blk_mq_hw_ctx *hctx)
+{
+	unsigned int i;
+
+	if (hctx->rqs) {
+		for (i = 0; i < hctx->queue_depth; i++)
+			kfree(hctx->rqs[i]);
+		kfree(hctx->rqs);
+		hctx->rqs = NULL;
+	}
+	if (hctx->tags) {
+		blk_mq_free_tags(hctx->tags);
+		hctx->tags = NULL;
+	}
+}
+
+static int blk_mq_init_rq_map(struct blk_mq_hw_ctx *hctx,
+			      struct blk_mq_reg *reg, void *driver_data,
+			      int node)
+{
+	size_t rq_size = round_up(sizeof(struct request) + reg->cmd_size,
+				  cache_line_size());
+	unsigned int i;
+
+	hctx->queue_depth = reg->queue_depth;
+	hctx->rqs = kzalloc_node(hctx->queue_depth * sizeof(struct request *),
+				 GFP_KERNEL, node);
+	if (!hctx->rqs)
+		return -ENOMEM;
+
+	/*
+	 * Requests are allocated one by one: the driver data following
+	 * them is frequently handed to DMA and must not live in vmalloc
+	 * space.
+	 */
+	for (i = 0; i < hctx->queue_depth; i++) {
+		struct request *rq = kzalloc_node(rq_size, GFP_KERNEL, node);
+
+		if (!rq)
+			goto fail;
+		hctx->rqs[i] = rq;
+		blk_rq_init(hctx->queue, rq);
+		rq->tag = i;
+
+		if (reg->ops->init_request &&
+		    reg->ops->init_request(driver_data, hctx, rq, i))
+			goto fail;
+	}
+
+	hctx->tags = blk_mq_init_tags(hctx->queue_depth, reg->reserved_tags,
+				      node);
+	if (!hctx->tags)
+		goto fail;
+
+	return 0;
+fail:
+	pr_warn("%s: failed to allocate requests\n", __func__);
+	blk_mq_free_rq_map(hctx);
+	return -ENOMEM;
+}
+
+static void blk_mq_exit_hw_queues(struct request_queue *q,
+				  unsigned int nr_queue)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (i == nr_queue)
+			break;
+
+		cancel_delayed_work_sync(&hctx->delayed_work);
+		if (q->mq_ops->exit_hctx)
+			q->mq_ops->exit_hctx(hctx, i);
+	}
+}
+
+static void blk_mq_free_hw_queues(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		blk_mq_free_rq_map(hctx);
+		kfree(hctx->ctxs);
+		kfree(hctx->ctx_map);
+		free_cpumask_var(hctx->cpumask);
+		kfree(hctx);
+	}
+}
+
+static int blk_mq_init_hw_queues(struct request_queue *q,
+				 struct blk_mq_reg *reg, void *driver_data)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		int node = hctx->numa_node;
+
+		spin_lock_init(&hctx->lock);
+		INIT_LIST_HEAD(&hctx->dispatch);
+		INIT_DELAYED_WORK(&hctx->delayed_work, blk_mq_work_fn);
+		hctx->queue = q;
+		hctx->queue_num = i;
+		hctx->flags = reg->flags;
+
+		if (blk_mq_init_rq_map(hctx, reg, driver_data, node))
+			break;
+
+		/*
+		 * Allocate space for all possible cpus to avoid allocation
+		 * in runtime
+		 */
+		hctx->ctxs = kmalloc_node(nr_cpu_ids * sizeof(void *),
+					  GFP_KERNEL, node);
+		if (!hctx->ctxs)
+			break;
+
+		hctx->ctx_map = kzalloc_node(BITS_TO_LONGS(nr_cpu_ids) *
+					     sizeof(unsigned long),
+					     GFP_KERNEL, node);
+		if (!hctx->ctx_map)
+			break;
+
+		hctx->nr_ctx = 0;
+
+		if (reg->ops->init_hctx &&
+		    reg->ops->init_hctx(hctx, driver_data, i))
+			break;
+	}
+
+	if (i == q->nr_hw_queues)
+		return 0;
+
+	/*
+	 * Init failed
+	 */
+	blk_mq_exit_hw_queues(q, i);
+	return 1;
+}
+
+static void blk_mq_init_cpu_queues(struct request_queue *q)
+{
+	unsigned int i;
+
+	for_each_possible_cpu(i) {
+		struct blk_mq_ctx *ctx = per_cpu_ptr(q->queue_ctx, i);
+		struct blk_mq_hw_ctx *hctx;
+
+		memset(ctx, 0, sizeof(*ctx));
+		ctx->cpu = i;
+		spin_lock_init(&ctx->lock);
+		INIT_LIST_HEAD(&ctx->rq_list);
+		ctx->queue = q;
+
+		hctx = q->mq_ops->map_queue(q, i);
+		cpumask_set_cpu(i, hctx->cpumask);
+		ctx->index_hw = hctx->nr_ctx;
+		hctx->ctxs[hctx->nr_ctx++] = ctx;
+	}
+}
+
+/**
+ * blk_mq_init_queue - set up a multiqueue request queue
+ * @reg:	driver description of the hardware queues
+ * @driver_data: passed back to the driver's ->init_hctx and ->init_request
+ *
+ * Drivers using the returned queue get their requests through
+ * ->queue_rq and complete them with blk_mq_end_io().  The queue is torn
+ * down with blk_cleanup_queue() like any other.
+ */
+struct request_queue *blk_mq_init_queue(struct blk_mq_reg *reg,
+					void *driver_data)
+{
+	struct blk_mq_hw_ctx **hctxs;
+	struct blk_mq_ctx *ctx;
+	struct request_queue *q;
+	int i;
+
+	if (!reg->nr_hw_queues || !reg->ops->queue_rq ||
+	    !reg->ops->map_queue || !reg->queue_depth)
+		return ERR_PTR(-EINVAL);
+
+	if (reg->queue_depth > BLK_MQ_MAX_DEPTH) {
+		pr_info("blk-mq: reduced tag depth (%u -> %u)\n",
+			reg->queue_depth, BLK_MQ_MAX_DEPTH);
+		reg->queue_depth = BLK_MQ_MAX_DEPTH;
+	}
+	if (reg->queue_depth <= reg->reserved_tags)
+		return ERR_PTR(-EINVAL);
+
+	/* more hardware queues than cpus are of no use */
+	if (reg->nr_hw_queues > nr_cpu_ids)
+		reg->nr_hw_queues = nr_cpu_ids;
+
+	ctx = alloc_percpu(struct blk_mq_ctx);
+	if (!ctx)
+		return ERR_PTR(-ENOMEM);
+
+	hctxs = kzalloc_node(reg->nr_hw_queues * sizeof(*hctxs), GFP_KERNEL,
+			     reg->numa_node);
+	if (!hctxs)
+		goto err_percpu;
+
+	for (i = 0; i < reg->nr_hw_queues; i++) {
+		hctxs[i] = kzalloc_node(sizeof(struct blk_mq_hw_ctx),
+					GFP_KERNEL, reg->numa_node);
+		if (!hctxs[i])
+			goto err_hctxs;
+
+		if (!zalloc_cpumask_var(&hctxs[i]->cpumask, GFP_KERNEL))
+			goto err_hctxs;
+
+		hctxs[i]->numa_node = reg->numa_node < 0 ? numa_node_id() :
+				      reg->numa_node;
+	}
+
+	q = blk_alloc_queue_node(GFP_KERNEL, reg->numa_node);
+	if (!q)
+		goto err_hctxs;
+
+	q->mq_map = kzalloc_node(sizeof(unsigned int) * nr_cpu_ids,
+				 GFP_KERNEL, reg->numa_node);
+	if (!q->mq_map ||
+	    blk_mq_update_queue_map(q->mq_map, reg->nr_hw_queues))
+		goto err_map;
+
+	q->nr_queues = nr_cpu_ids;
+	q->nr_hw_queues = reg->nr_hw_queues;
+	q->queue_ctx = ctx;
+	q->queue_hw_ctx = hctxs;
+	q->mq_ops = reg->ops;
+	q->queue_flags |= QUEUE_FLAG_MQ_DEFAULT;
+
+	blk_queue_make_request(q, blk_mq_make_request);
+	q->sg_reserved_size = INT_MAX;
+
+	if (blk_mq_init_hw_queues(q, reg, driver_data))
+		goto err_hw;
+
+	blk_mq_init_cpu_queues(q);
+
+	/* all done, end the initial bypass */
+	blk_queue_bypass_end(q);
+
+	mutex_lock(&all_q_mutex);
+	list_add_tail(&q->mq_all_q_node, &all_q_list);
+	mutex_unlock(&all_q_mutex);
+
+	return q;
+
+err_hw:
+	/* blk_release_queue() must not see a half set up queue */
+	q->mq_ops = NULL;
+	q->queue_hw_ctx = NULL;
+	q->queue_ctx = NULL;
+err_map:
+	kfree(q->mq_map);
+	q->mq_map = NULL;
+	blk_cleanup_queue(q);
+err_hctxs:
+	for (i = 0; i < reg->nr_hw_queues; i++) {
+		if (!hctxs[i])
+			break;
+		blk_mq_free_rq_map(hctxs[i]);
+		kfree(hctxs[i]->ctxs);
+		kfree(hctxs[i]->ctx_map);
+		free_cpumask_var(hctxs[i]->cpumask);
+		kfree(hctxs[i]);
+	}
+	kfree(hctxs);
+err_percpu:
+	free_percpu(ctx);
+	return ERR_PTR(-ENOMEM);
+}
+EXPORT_SYMBOL(blk_mq_init_queue);
+
+/*
+ * Called from blk_release_queue() once the last reference to @q is gone.
+ */
+void blk_mq_free_queue(struct request_queue *q)
+{
+	mutex_lock(&all_q_mutex);
+	list_del_init(&q->mq_all_q_node);
+	mutex_unlock(&all_q_mutex);
+
+	blk_mq_exit_hw_queues(q, q->nr_hw_queues);
+	blk_mq_free_hw_queues(q);
+
+	free_percpu(q->queue_ctx);
+	kfree(q->queue_hw_ctx);
+	kfree(q->mq_map);
+
+	q->queue_ctx = NULL;
+	q->queue_hw_ctx = NULL;
+	q->mq_map = NULL;
+}
+
+/*
+ * Move the requests still sitting in the software queue of a dead cpu over
+ * to the cpu running the notifier, and kick the hardware queue.  The tags
+ * stay with the hardware queue the dead cpu was mapped to, so the requests
+ * are handed to that queue's dispatch list rather than to our own ctx.
+ */
+static void blk_mq_hctx_drain_cpu(struct request_queue *q, unsigned int cpu)
+{
+	struct blk_mq_ctx *ctx = __blk_mq_get_ctx(q, cpu);
+	struct blk_mq_hw_ctx *hctx = q->mq_ops->map_queue(q, cpu);
+	LIST_HEAD(tmp);
+
+	spin_lock(&ctx->lock);
+	list_splice_init(&ctx->rq_list, &tmp);
+	spin_unlock(&ctx->lock);
+
+	if (list_empty(&tmp))
+		return;
+
+	clear_bit(ctx->index_hw, hctx->ctx_map);
+
+	spin_lock(&hctx->lock);
+	list_splice_tail(&tmp, &hctx->dispatch);
+	spin_unlock(&hctx->lock);
+
+	blk_mq_run_hw_queue(hctx, true);
+}
+
+static int __cpuinit blk_mq_queue_reinit_notify(struct notifier_block *nb,
+						unsigned long action,
+						void *hcpu)
+{
+	struct request_queue *q;
+	unsigned int cpu = (unsigned long) hcpu;
+
+	if (action != CPU_DEAD && action != CPU_DEAD_FROZEN)
+		return NOTIFY_OK;
+
+	mutex_lock(&all_q_mutex);
+	list_for_each_entry(q, &all_q_list, mq_all_q_node)
+		blk_mq_hctx_drain_cpu(q, cpu);
+	mutex_unlock(&all_q_mutex);
+
+	return NOTIFY_OK;
+}
+
+static int __init blk_mq_init(void)
+{
+	hotcpu_notifier(blk_mq_queue_reinit_notify, 0);
+
+	return 0;
+}
+subsys_initcall(blk_mq_init);
@@ -0,0 +1,46 @@
+#ifndef INT_BLK_MQ_H
+#define INT_BLK_MQ_H
+
+struct blk_mq_ctx {
+	struct {
+		spinlock_t		lock;
+		struct list_head	rq_list;
+	}  ____cacheline_aligned_in_smp;
+
+	unsigned int		cpu;
+	unsigned int		index_hw;
+
+	/* incremented at dispatch time */
+	unsigned long		rq_dispatched[2];
+	unsigned long		rq_merged;
+
+	/* incremented at completion time */
+	unsigned long		____cacheline_aligned_in_smp rq_completed[2];
+
+	struct request_queue	*queue;
+} ____cacheline_aligned_in_smp;
+
+void __blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx);
+
+static inline struct blk_mq_ctx *__blk_mq_get_ctx(struct request_queue *q,
+						  unsigned int cpu)
+{
+	return per_cpu_ptr(q->queue_ctx, cpu);
+}
+
+/*
+ * Software queues are per-cpu.  Getting one disables preemption until the
+ * matching blk_mq_put_ctx(), so a request can never be added to the queue
+ * of a CPU that has already been through the hotplug drain.
+ */
+static inline struct blk_mq_ctx *blk_mq_get_ctx(struct request_queue *q)
+{
+	return __blk_mq_get_ctx(q, get_cpu());
+}
+
+static inline void blk_mq_put_ctx(struct blk_mq_ctx *ctx)
+{
+	put_cpu();
+}
+
+#endif
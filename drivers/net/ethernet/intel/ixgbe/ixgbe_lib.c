@@ -572,6 +572,10 @@ static int ixgbe_alloc_q_vector(struct ixgbe_adapter *adapter,
 	/* initialize NAPI */
 	netif_napi_add(adapter->netdev, &q_vector->napi,
 		       ixgbe_poll, 64);
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	q_vector->napi.busy_poll = ixgbe_busy_poll_recv;
+	napi_hash_add(&q_vector->napi);
+#endif
 
 	/* tie q_vector and adapter together */
 	adapter->q_vector[v_idx] = q_vector;
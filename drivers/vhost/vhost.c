@@ -25,6 +25,8 @@
 #include <linux/slab.h>
 #include <linux/kthread.h>
 #include <linux/cgroup.h>
+#include <linux/cpumask.h>
+#include <linux/module.h>
 
 #include <linux/net.h>
 #include <linux/if_packet.h>
@@ -39,6 +41,16 @@ enum {
 
 static unsigned vhost_zcopy_mask __read_mostly;
 
+static int vhost_worker_mode = VHOST_WORKER_DEV;
+module_param_named(worker_mode, vhost_worker_mode, int, 0644);
+MODULE_PARM_DESC(worker_mode, "Worker threads: 0 - one per device, "
+		 "1 - one per virtqueue, 2 - shared per host cpu");
+
+/* Shared per-cpu workers for VHOST_WORKER_CPU, created on first use. */
+static DEFINE_MUTEX(vhost_cpu_mutex);
+static DEFINE_PER_CPU(struct vhost_worker *, vhost_cpu_worker);
+static int vhost_cpu_last = -1;
+
 #define vhost_used_event(vq) ((u16 __user *)&vq->avail->ring[vq->num])
 #define vhost_avail_event(vq) ((u16 __user *)&vq->used->ring[vq->num])
 
@@ -64,25 +76,28 @@ static int vhost_poll_wakeup(wait_queue_t *wait, unsigned mode, int sync,
 	return 0;
 }
 
-static void vhost_work_init(struct vhost_work *work, vhost_work_fn_t fn)
+static void vhost_work_init(struct vhost_work *work, struct vhost_dev *dev,
+			    vhost_work_fn_t fn)
 {
 	INIT_LIST_HEAD(&work->node);
 	work->fn = fn;
 	init_waitqueue_head(&work->done);
 	work->flushing = 0;
 	work->queue_seq = work->done_seq = 0;
+	work->dev = dev;
 }
 
-/* Init poll structure */
+/* Init poll structure. Work is run by the worker of the virtqueue. */
 void vhost_poll_init(struct vhost_poll *poll, vhost_work_fn_t fn,
-		     unsigned long mask, struct vhost_dev *dev)
+		     unsigned long mask, struct vhost_virtqueue *vq)
 {
 	init_waitqueue_func_entry(&poll->wait, vhost_poll_wakeup);
 	init_poll_funcptr(&poll->table, vhost_poll_func);
 	poll->mask = mask;
-	poll->dev = dev;
+	poll->dev = vq->dev;
+	poll->vq = vq;
 
-	vhost_work_init(&poll->work, fn);
+	vhost_work_init(&poll->work, vq->dev, fn);
 }
 
 /* Start polling a file. We add ourselves to file's wait queue. The caller must
@@ -103,30 +118,35 @@ void vhost_poll_stop(struct vhost_poll *poll)
 	remove_wait_queue(poll->wqh, &poll->wait);
 }
 
-static bool vhost_work_seq_done(struct vhost_dev *dev, struct vhost_work *work,
-				unsigned seq)
+static bool vhost_work_seq_done(struct vhost_worker *worker,
+				struct vhost_work *work, unsigned seq)
 {
 	int left;
 
-	spin_lock_irq(&dev->work_lock);
+	spin_lock_irq(&worker->work_lock);
 	left = seq - work->done_seq;
-	spin_unlock_irq(&dev->work_lock);
+	spin_unlock_irq(&worker->work_lock);
 	return left <= 0;
 }
 
-static void vhost_work_flush(struct vhost_dev *dev, struct vhost_work *work)
+static void vhost_work_flush(struct vhost_worker *worker,
+			     struct vhost_work *work)
 {
 	unsigned seq;
 	int flushing;
 
-	spin_lock_irq(&dev->work_lock);
+	/* Nothing can have been queued before the owner was set. */
+	if (!worker)
+		return;
+
+	spin_lock_irq(&worker->work_lock);
 	seq = work->queue_seq;
 	work->flushing++;
-	spin_unlock_irq(&dev->work_lock);
-	wait_event(work->done, vhost_work_seq_done(dev, work, seq));
-	spin_lock_irq(&dev->work_lock);
+	spin_unlock_irq(&worker->work_lock);
+	wait_event(work->done, vhost_work_seq_done(worker, work, seq));
+	spin_lock_irq(&worker->work_lock);
 	flushing = --work->flushing;
-	spin_unlock_irq(&dev->work_lock);
+	spin_unlock_irq(&worker->work_lock);
 	BUG_ON(flushing < 0);
 }
 
@@ -134,26 +154,26 @@ static void vhost_work_flush(struct vhost_dev *dev, struct vhost_work *work)
  * locks that are also used by the callback. */
 void vhost_poll_flush(struct vhost_poll *poll)
 {
-	vhost_work_flush(poll->dev, &poll->work);
+	vhost_work_flush(poll->vq->worker, &poll->work);
 }
 
-static inline void vhost_work_queue(struct vhost_dev *dev,
+static inline void vhost_work_queue(struct vhost_worker *worker,
 				    struct vhost_work *work)
 {
 	unsigned long flags;
 
-	spin_lock_irqsave(&dev->work_lock, flags);
+	spin_lock_irqsave(&worker->work_lock, flags);
 	if (list_empty(&work->node)) {
-		list_add_tail(&work->node, &dev->work_list);
+		list_add_tail(&work->node, &worker->work_list);
 		work->queue_seq++;
-		wake_up_process(dev->worker);
+		wake_up_process(worker->task);
 	}
-	spin_unlock_irqrestore(&dev->work_lock, flags);
+	spin_unlock_irqrestore(&worker->work_lock, flags);
 }
 
 void vhost_poll_queue(struct vhost_poll *poll)
 {
-	vhost_work_queue(poll->dev, &poll->work);
+	vhost_work_queue(poll->vq->worker, &poll->work);
 }
 
 static void vhost_vq_reset(struct vhost_dev *dev,
@@ -188,19 +208,18 @@ static void vhost_vq_reset(struct vhost_dev *dev,
 
 static int vhost_worker(void *data)
 {
-	struct vhost_dev *dev = data;
+	struct vhost_worker *worker = data;
 	struct vhost_work *work = NULL;
 	unsigned uninitialized_var(seq);
 	mm_segment_t oldfs = get_fs();
 
 	set_fs(USER_DS);
-	use_mm(dev->mm);
 
 	for (;;) {
 		/* mb paired w/ kthread_stop */
 		set_current_state(TASK_INTERRUPTIBLE);
 
-		spin_lock_irq(&dev->work_lock);
+		spin_lock_irq(&worker->work_lock);
 		if (work) {
 			work->done_seq = seq;
 			if (work->flushing)
@@ -208,33 +227,128 @@ static int vhost_worker(void *data)
 		}
 
 		if (kthread_should_stop()) {
-			spin_unlock_irq(&dev->work_lock);
+			spin_unlock_irq(&worker->work_lock);
 			__set_current_state(TASK_RUNNING);
 			break;
 		}
-		if (!list_empty(&dev->work_list)) {
-			work = list_first_entry(&dev->work_list,
+		if (!list_empty(&worker->work_list)) {
+			work = list_first_entry(&worker->work_list,
 						struct vhost_work, node);
 			list_del_init(&work->node);
 			seq = work->queue_seq;
 		} else
 			work = NULL;
-		spin_unlock_irq(&dev->work_lock);
+		spin_unlock_irq(&worker->work_lock);
 
 		if (work) {
 			__set_current_state(TASK_RUNNING);
+			/* A shared worker runs work of many owners: switch to
+			 * the address space of the device the work is for. */
+			if (current->mm != work->dev->mm) {
+				if (current->mm)
+					unuse_mm(current->mm);
+				use_mm(work->dev->mm);
+			}
 			work->fn(work);
 			if (need_resched())
 				schedule();
-		} else
+		} else {
+			/* The owner may go away while a shared worker idles. */
+			if (worker->shared && current->mm)
+				unuse_mm(current->mm);
 			schedule();
+		}
 
 	}
-	unuse_mm(dev->mm);
+	if (current->mm)
+		unuse_mm(current->mm);
 	set_fs(oldfs);
 	return 0;
 }
 
+static struct vhost_worker *vhost_worker_create(int cpu, const char *fmt,
+						 int pid, int index)
+{
+	struct vhost_worker *worker;
+	struct task_struct *task;
+
+	worker = kzalloc(sizeof *worker, GFP_KERNEL);
+	if (!worker)
+		return ERR_PTR(-ENOMEM);
+	spin_lock_init(&worker->work_lock);
+	INIT_LIST_HEAD(&worker->work_list);
+	worker->cpu = -1;
+
+	task = kthread_create_on_node(vhost_worker, worker,
+				      cpu < 0 ? -1 : cpu_to_node(cpu),
+				      fmt, pid, index);
+	if (IS_ERR(task)) {
+		kfree(worker);
+		return ERR_CAST(task);
+	}
+	worker->task = task;
+	if (cpu >= 0 && !set_cpus_allowed_ptr(task, cpumask_of(cpu)))
+		worker->cpu = cpu;
+	wake_up_process(task);	/* avoid contributing to loadavg */
+	return worker;
+}
+
+static void vhost_worker_destroy(struct vhost_worker *worker)
+{
+	WARN_ON(!list_empty(&worker->work_list));
+	kthread_stop(worker->task);
+	kfree(worker);
+}
+
+/* Get a reference to the shared worker of a cpu, creating it if needed. */
+static struct vhost_worker *vhost_cpu_worker_get(int cpu)
+{
+	struct vhost_worker *worker;
+
+	mutex_lock(&vhost_cpu_mutex);
+	worker = per_cpu(vhost_cpu_worker, cpu);
+	if (!worker) {
+		worker = vhost_worker_create(cpu, "vhost-cpu-%d", cpu, 0);
+		if (IS_ERR(worker))
+			goto out;
+		worker->shared = true;
+		worker->cpu = cpu;
+		per_cpu(vhost_cpu_worker, cpu) = worker;
+	}
+	worker->refcnt++;
+out:
+	mutex_unlock(&vhost_cpu_mutex);
+	return worker;
+}
+
+static void vhost_cpu_worker_put(struct vhost_worker *worker)
+{
+	int cpu = worker->cpu;
+
+	mutex_lock(&vhost_cpu_mutex);
+	if (--worker->refcnt) {
+		mutex_unlock(&vhost_cpu_mutex);
+		return;
+	}
+	per_cpu(vhost_cpu_worker, cpu) = NULL;
+	mutex_unlock(&vhost_cpu_mutex);
+	vhost_worker_destroy(worker);
+}
+
+/* Spread the virtqueues of new devices over the online cpus. */
+static int vhost_cpu_next(void)
+{
+	int cpu;
+
+	mutex_lock(&vhost_cpu_mutex);
+	cpu = cpumask_next(vhost_cpu_last, cpu_online_mask);
+	if (cpu >= nr_cpu_ids)
+		cpu = cpumask_first(cpu_online_mask);
+	vhost_cpu_last = cpu;
+	mutex_unlock(&vhost_cpu_mutex);
+	return cpu;
+}
+
 static void vhost_vq_free_iovecs(struct vhost_virtqueue *vq)
 {
 	kfree(vq->indirect);
@@ -303,9 +417,9 @@ long vhost_dev_init(struct vhost_dev *dev,
 	dev->log_file = NULL;
 	dev->memory = NULL;
 	dev->mm = NULL;
-	spin_lock_init(&dev->work_lock);
-	INIT_LIST_HEAD(&dev->work_list);
-	dev->worker = NULL;
+	dev->worker_mode = VHOST_WORKER_DEV;
+	dev->workers = NULL;
+	dev->nworkers = 0;
 
 	for (i = 0; i < dev->nvqs; ++i) {
 		dev->vqs[i].log = NULL;
@@ -313,11 +427,13 @@ long vhost_dev_init(struct vhost_dev *dev,
 		dev->vqs[i].heads = NULL;
 		dev->vqs[i].ubuf_info = NULL;
 		dev->vqs[i].dev = dev;
+		dev->vqs[i].worker = NULL;
 		mutex_init(&dev->vqs[i].mutex);
 		vhost_vq_reset(dev, dev->vqs + i);
 		if (dev->vqs[i].handle_kick)
 			vhost_poll_init(&dev->vqs[i].poll,
-					dev->vqs[i].handle_kick, POLLIN, dev);
+					dev->vqs[i].handle_kick, POLLIN,
+					dev->vqs + i);
 	}
 
 	return 0;
@@ -344,21 +460,89 @@ static void vhost_attach_cgroups_work(struct vhost_work *work)
 	s->ret = cgroup_attach_task_all(s->owner, current);
 }
 
-static int vhost_attach_cgroups(struct vhost_dev *dev)
+static int vhost_attach_cgroups(struct vhost_dev *dev,
+				struct vhost_worker *worker)
 {
 	struct vhost_attach_cgroups_struct attach;
 
 	attach.owner = current;
-	vhost_work_init(&attach.work, vhost_attach_cgroups_work);
-	vhost_work_queue(dev, &attach.work);
-	vhost_work_flush(dev, &attach.work);
+	vhost_work_init(&attach.work, dev, vhost_attach_cgroups_work);
+	vhost_work_queue(worker, &attach.work);
+	vhost_work_flush(worker, &attach.work);
 	return attach.ret;
 }
 
+static void vhost_dev_stop_workers(struct vhost_dev *dev)
+{
+	int i;
+
+	for (i = 0; i < dev->nvqs; ++i) {
+		if (dev->vqs[i].worker && dev->vqs[i].worker->shared)
+			vhost_cpu_worker_put(dev->vqs[i].worker);
+		dev->vqs[i].worker = NULL;
+	}
+	for (i = 0; i < dev->nworkers; ++i)
+		vhost_worker_destroy(dev->workers[i]);
+	kfree(dev->workers);
+	dev->workers = NULL;
+	dev->nworkers = 0;
+}
+
+/* Set up the threads running the work of all virtqueues of the device.
+ * Threads private to the device are moved to the cgroups of the owner;
+ * shared per-cpu threads stay where they are. */
+static long vhost_dev_start_workers(struct vhost_dev *dev)
+{
+	struct vhost_worker *worker;
+	int i, n, err;
+
+	dev->worker_mode = ACCESS_ONCE(vhost_worker_mode);
+	switch (dev->worker_mode) {
+	case VHOST_WORKER_CPU:
+		for (i = 0; i < dev->nvqs; ++i) {
+			worker = vhost_cpu_worker_get(vhost_cpu_next());
+			if (IS_ERR(worker)) {
+				err = PTR_ERR(worker);
+				goto err;
+			}
+			dev->vqs[i].worker = worker;
+		}
+		return 0;
+	case VHOST_WORKER_VQ:
+		n = dev->nvqs;
+		break;
+	default:
+		dev->worker_mode = VHOST_WORKER_DEV;
+		n = 1;
+		break;
+	}
+
+	dev->workers = kcalloc(n, sizeof *dev->workers, GFP_KERNEL);
+	if (!dev->workers)
+		return -ENOMEM;
+	for (i = 0; i < n; ++i) {
+		worker = vhost_worker_create(-1, n == 1 ? "vhost-%d" :
+					     "vhost-%d-%d", current->pid, i);
+		if (IS_ERR(worker)) {
+			err = PTR_ERR(worker);
+			goto err;
+		}
+		dev->workers[dev->nworkers++] = worker;
+		err = vhost_attach_cgroups(dev, worker);
+		if (err)
+			goto err;
+	}
+	for (i = 0; i < dev->nvqs; ++i)
+		dev->vqs[i].worker = dev->workers[n == 1 ? 0 : i];
+	return 0;
+err:
+	vhost_dev_stop_workers(dev);
+	return err;
+}
+
 /* Caller should have device mutex */
 static long vhost_dev_set_owner(struct vhost_dev *dev)
 {
-	struct task_struct *worker;
 	int err;
 
 	/* Is there an owner already? */
@@ -369,18 +553,9 @@ static long vhost_dev_set_owner(struct vhost_dev *dev)
 
 	/* No owner, become one */
 	dev->mm = get_task_mm(current);
-	worker = kthread_create(vhost_worker, dev, "vhost-%d", current->pid);
-	if (IS_ERR(worker)) {
-		err = PTR_ERR(worker);
-		goto err_worker;
-	}
-
-	dev->worker = worker;
-	wake_up_process(worker);	/* avoid contributing to loadavg */
-
-	err = vhost_attach_cgroups(dev);
+	err = vhost_dev_start_workers(dev);
 	if (err)
-		goto err_cgroup;
+		goto err_worker;
 
 	err = vhost_dev_alloc_iovecs(dev);
 	if (err)
@@ -388,8 +563,7 @@ static long vhost_dev_set_owner(struct vhost_dev *dev)
 
 	return 0;
 err_cgroup:
-	kthread_stop(worker);
-	dev->worker = NULL;
+	vhost_dev_stop_workers(dev);
 err_worker:
 	if (dev->mm)
 		mmput(dev->mm);
@@ -480,11 +654,7 @@ void vhost_dev_cleanup(struct vhost_dev *dev, bool locked)
 					locked ==
 						lockdep_is_held(&dev->mutex)));
 	RCU_INIT_POINTER(dev->memory, NULL);
-	WARN_ON(!list_empty(&dev->work_list));
-	if (dev->worker) {
-		kthread_stop(dev->worker);
-		dev->worker = NULL;
-	}
+	vhost_dev_stop_workers(dev);
 	if (dev->mm)
 		mmput(dev->mm);
 	dev->mm = NULL;
@@ -635,6 +805,43 @@ static long vhost_set_memory(struct vhost_dev *d, struct vhost_memory __user *m)
 	return 0;
 }
 
+/* Caller must have vq mutex and device mutex. */
+static long vhost_vq_set_affinity(struct vhost_virtqueue *vq, unsigned int cpu)
+{
+	struct vhost_worker *worker = vq->worker;
+	long r;
+
+	if (cpu != VHOST_VRING_CPU_ANY &&
+	    (cpu >= nr_cpu_ids || !cpu_online(cpu)))
+		return -EINVAL;
+
+	if (!worker->shared) {
+		/* In per-device mode this moves every ring of the device. */
+		r = set_cpus_allowed_ptr(worker->task,
+					 cpu == VHOST_VRING_CPU_ANY ?
+					 cpu_possible_mask : cpumask_of(cpu));
+		if (!r)
+			worker->cpu = cpu == VHOST_VRING_CPU_ANY ? -1 : cpu;
+		return r;
+	}
+
+	/* Shared workers stay bound to their cpu: move the ring to the worker
+	 * of the new cpu instead. Only a ring that is stopped can be moved,
+	 * so that no work for it is queued on the old worker. */
+	if (cpu == VHOST_VRING_CPU_ANY)
+		return -EINVAL;
+	if ((int)cpu == worker->cpu)
+		return 0;
+	if (vq->kick || vq->private_data)
+		return -EBUSY;
+	worker = vhost_cpu_worker_get(cpu);
+	if (IS_ERR(worker))
+		return PTR_ERR(worker);
+	vhost_cpu_worker_put(vq->worker);
+	vq->worker = worker;
+	return 0;
+}
+
 static long vhost_set_vring(struct vhost_dev *d, int ioctl, void __user *argp)
 {
 	struct file *eventfp, *filep = NULL,
@@ -753,6 +960,20 @@ static long vhost_set_vring(struct vhost_dev *d, int ioctl, void __user *argp)
 		vq->log_addr = a.log_guest_addr;
 		vq->used = (void __user *)(unsigned long)a.used_user_addr;
 		break;
+	case VHOST_SET_VRING_AFFINITY:
+		if (copy_from_user(&s, argp, sizeof s)) {
+			r = -EFAULT;
+			break;
+		}
+		r = vhost_vq_set_affinity(vq, s.num);
+		break;
+	case VHOST_GET_VRING_AFFINITY:
+		s.index = idx;
+		s.num = vq->worker->cpu < 0 ? VHOST_VRING_CPU_ANY :
+					      vq->worker->cpu;
+		if (copy_to_user(argp, &s, sizeof s))
+			r = -EFAULT;
+		break;
 	case VHOST_SET_VRING_KICK:
 		if (copy_from_user(&f, argp, sizeof f)) {
 			r = -EFAULT;
@@ -19,6 +19,7 @@
 #define VHOST_DMA_CLEAR_LEN	0
 
 struct vhost_device;
+struct vhost_virtqueue;
 
 struct vhost_work;
 typedef void (*vhost_work_fn_t)(struct vhost_work *work);
@@ -30,6 +31,30 @@ struct vhost_work {
 	int			  flushing;
 	unsigned		  queue_seq;
 	unsigned		  done_seq;
+	struct vhost_dev	 *dev;
+};
+
+/* How work is spread over worker threads, see the worker_mode parameter. */
+enum vhost_worker_mode {
+	/* One thread per device servicing all of its virtqueues. */
+	VHOST_WORKER_DEV = 0,
+	/* One thread per virtqueue. */
+	VHOST_WORKER_VQ = 1,
+	/* One thread per host cpu, shared by virtqueues of all devices. */
+	VHOST_WORKER_CPU = 2,
+};
+
+/* A kernel thread executing vhost_work items queued on it. */
+struct vhost_worker {
+	spinlock_t		  work_lock;
+	struct list_head	  work_list;
+	struct task_struct	 *task;
+	/* Cpu the thread is bound to, or -1 if it may run anywhere. */
+	int			  cpu;
+	/* Per-cpu worker shared between devices. */
+	bool			  shared;
+	/* Users of a shared worker. Protected by vhost_cpu_mutex. */
+	int			  refcnt;
 };
 
 /* Poll a file (eventfd or socket) */
@@ -41,10 +66,11 @@ struct vhost_poll {
 	struct vhost_work	  work;
 	unsigned long		  mask;
 	struct vhost_dev	 *dev;
+	struct vhost_virtqueue	 *vq;
 };
 
 void vhost_poll_init(struct vhost_poll *poll, vhost_work_fn_t fn,
-		     unsigned long mask, struct vhost_dev *dev);
+		     unsigned long mask, struct vhost_virtqueue *vq);
 void vhost_poll_start(struct vhost_poll *poll, struct file *file);
 void vhost_poll_stop(struct vhost_poll *poll);
 void vhost_poll_flush(struct vhost_poll *poll);
@@ -55,8 +81,6 @@ struct vhost_log {
 	u64 len;
 };
 
-struct vhost_virtqueue;
-
 struct vhost_ubuf_ref {
 	struct kref kref;
 	wait_queue_head_t wait;
@@ -86,6 +110,9 @@ struct vhost_virtqueue {
 
 	struct vhost_poll poll;
 
+	/* Thread that runs the work of this queue. Set up by the owner. */
+	struct vhost_worker *worker;
+
 	/* The routine to call when the Guest pings us, or timeout. */
 	vhost_work_fn_t handle_kick;
 
@@ -155,9 +182,10 @@ struct vhost_dev {
 	int nvqs;
 	struct file *log_file;
 	struct eventfd_ctx *log_ctx;
-	spinlock_t work_lock;
-	struct list_head work_list;
-	struct task_struct *worker;
+	enum vhost_worker_mode worker_mode;
+	/* Threads owned by this device; shared per-cpu ones are not here. */
+	struct vhost_worker **workers;
+	int nworkers;
 };
 
 long vhost_dev_init(struct vhost_dev *, struct vhost_virtqueue *vqs, int nvqs);
@@ -276,8 +276,10 @@ static void vp_free_vectors(struct virtio_device *vdev)
 		vp_dev->intx_enabled = 0;
 	}
 
-	for (i = 0; i < vp_dev->msix_used_vectors; ++i)
+	for (i = 0; i < vp_dev->msix_used_vectors; ++i) {
+		irq_set_affinity_hint(vp_dev->msix_entries[i].vector, NULL);
 		free_irq(vp_dev->msix_entries[i].vector, vp_dev);
+	}
 
 	if (vp_dev->msix_enabled) {
 		/* Disable the vector used for configuration */
@@ -609,6 +611,30 @@ static const char *vp_bus_name(struct virtio_device *vdev)
 	return pci_name(vp_dev->pci_dev);
 }
 
+/* Set the affinity hint for a virtqueue's interrupt.  Only a per-vq MSI-X
+ * vector is hinted; shared vectors and INTx ignore the request. */
+static int vp_set_vq_affinity(struct virtqueue *vq, int cpu)
+{
+	struct virtio_pci_device *vp_dev = to_vp_device(vq->vdev);
+	struct virtio_pci_vq_info *info = vq->priv;
+	unsigned int irq;
+
+	if (!vq->callback)
+		return -EINVAL;
+
+	if (!vp_dev->msix_enabled || !vp_dev->per_vq_vectors ||
+	    info->msix_vector == VIRTIO_MSI_NO_VECTOR)
+		return 0;
+
+	irq = vp_dev->msix_entries[info->msix_vector].vector;
+	if (cpu == -1)
+		irq_set_affinity_hint(irq, NULL);
+	else
+		irq_set_affinity_hint(irq, cpumask_of(cpu));
+
+	return 0;
+}
+
 static struct virtio_config_ops virtio_pci_config_ops = {
 	.get		= vp_get,
 	.set		= vp_set,
@@ -620,6 +646,7 @@ static struct virtio_config_ops virtio_pci_config_ops = {
 	.get_features	= vp_get_features,
 	.finalize_features = vp_finalize_features,
 	.bus_name	= vp_bus_name,
+	.set_vq_affinity = vp_set_vq_affinity,
 };
 
 static void virtio_pci_release_dev(struct device *_d)
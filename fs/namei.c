@@ -403,7 +403,8 @@ EXPORT_SYMBOL(path_put);
  *
  * unlazy_walk attempts to legitimize the current nd->path, nd->root and dentry
  * for ref-walk mode.  @dentry must be a path found by a do_lookup call on
- * @nd or NULL.  Must be called from rcu-walk context.
+ * @nd or NULL.  Must be called from rcu-walk context.  On failure nd may be
+ * left in either mode; terminate_walk() copes with both.
  */
 static int unlazy_walk(struct nameidata *nd, struct dentry *dentry)
 {
@@ -419,47 +420,70 @@ static int unlazy_walk(struct nameidata *nd, struct dentry *dentry)
 				nd->root.dentry != fs->root.dentry)
 			goto err_root;
 	}
-	spin_lock(&parent->d_lock);
+
+	/*
+	 * From here on we are in ref-walk mode, even if we fail: whatever
+	 * references end up in nd->path are dropped by the caller's
+	 * terminate_walk().  If the parent can't be legitimized, just set
+	 * nd->path.dentry to NULL and rely on dput(NULL) being a no-op.
+	 */
+	nd->flags &= ~LOOKUP_RCU;
+	mntget(nd->path.mnt);
+	if (!lockref_get_not_dead(&parent->d_lockref)) {
+		nd->path.dentry = NULL;
+		goto out;
+	}
+
+	/*
+	 * For a negative lookup, the lookup sequence point is the parent's
+	 * sequence point, and it only needs to revalidate the parent dentry.
+	 *
+	 * For a positive lookup, we need to move both the parent and the
+	 * dentry from the RCU domain to be properly refcounted.  The
+	 * sequence number in the dentry validates *both* dentry counters,
+	 * since we checked the sequence number of the parent after we got
+	 * the child sequence number.  So we know the parent must still be
+	 * valid if the child sequence number is still valid.
+	 */
 	if (!dentry) {
-		if (!__d_rcu_to_refcount(parent, nd->seq))
-			goto err_parent;
+		if (read_seqcount_retry(&parent->d_seq, nd->seq))
+			goto out;
 		BUG_ON(nd->inode != parent->d_inode);
 	} else {
-		if (dentry->d_parent != parent)
-			goto err_parent;
-		spin_lock_nested(&dentry->d_lock, DENTRY_D_LOCK_NESTED);
-		if (!__d_rcu_to_refcount(dentry, nd->seq))
-			goto err_child;
-		/*
-		 * If the sequence check on the child dentry passed, then
-		 * the child has not been removed from its parent. This
-		 * means the parent dentry must be valid and able to take
-		 * a reference at this point.
-		 */
-		BUG_ON(!IS_ROOT(dentry) && dentry->d_parent != parent);
-		BUG_ON(!parent->d_count);
-		parent->d_count++;
-		spin_unlock(&dentry->d_lock);
+		if (!lockref_get_not_dead(&dentry->d_lockref))
+			goto out;
+		if (read_seqcount_retry(&dentry->d_seq, nd->seq))
+			goto drop_dentry;
 	}
-	spin_unlock(&parent->d_lock);
+
 	if (want_root) {
 		path_get(&nd->root);
 		spin_unlock(&fs->lock);
 	}
-	mntget(nd->path.mnt);
 
 	rcu_read_unlock();
 	br_read_unlock(&vfsmount_lock);
-	nd->flags &= ~LOOKUP_RCU;
 	return 0;
 
-err_child:
-	spin_unlock(&dentry->d_lock);
-err_parent:
-	spin_unlock(&parent->d_lock);
-err_root:
+drop_dentry:
 	if (want_root)
 		spin_unlock(&fs->lock);
+	rcu_read_unlock();
+	br_read_unlock(&vfsmount_lock);
+	dput(dentry);
+	goto drop_root_mnt;
+out:
+	if (want_root)
+		spin_unlock(&fs->lock);
+	rcu_read_unlock();
+	br_read_unlock(&vfsmount_lock);
+drop_root_mnt:
+	if (!(nd->flags & LOOKUP_ROOT))
+		nd->root.mnt = NULL;
+	return -ECHILD;
+
+err_root:
+	spin_unlock(&fs->lock);
 	return -ECHILD;
 }
 
@@ -503,15 +527,19 @@ static int complete_walk(struct nameidata *nd)
 		nd->flags &= ~LOOKUP_RCU;
 		if (!(nd->flags & LOOKUP_ROOT))
 			nd->root.mnt = NULL;
-		spin_lock(&dentry->d_lock);
-		if (unlikely(!__d_rcu_to_refcount(dentry, nd->seq))) {
-			spin_unlock(&dentry->d_lock);
+
+		if (unlikely(!lockref_get_not_dead(&dentry->d_lockref))) {
 			rcu_read_unlock();
 			br_read_unlock(&vfsmount_lock);
 			return -ECHILD;
 		}
+		if (read_seqcount_retry(&dentry->d_seq, nd->seq)) {
+			rcu_read_unlock();
+			br_read_unlock(&vfsmount_lock);
+			dput(dentry);
+			return -ECHILD;
+		}
 		BUG_ON(nd->inode != dentry->d_inode);
-		spin_unlock(&dentry->d_lock);
 		mntget(nd->path.mnt);
 		rcu_read_unlock();
 		br_read_unlock(&vfsmount_lock);
@@ -2772,7 +2800,7 @@ void dentry_unhash(struct dentry *dentry)
 {
 	shrink_dcache_parent(dentry);
 	spin_lock(&dentry->d_lock);
-	if (dentry->d_count == 1)
+	if (d_count(dentry) == 1)
 		__d_drop(dentry);
 	spin_unlock(&dentry->d_lock);
 }
@@ -0,0 +1,85 @@
+#ifndef __LZ4_H__
+#define __LZ4_H__
+/*
+ * LZ4 Kernel Interface
+ *
+ * LZ4 is a byte-oriented LZ77 format tuned for decompression speed:
+ * a stream of (literal run, 16-bit offset, match length) sequences
+ * with no entropy coding.  This implements the LZ4 block format as
+ * described at http://code.google.com/p/lz4/, so data can be
+ * exchanged with the userspace lz4 tools.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define LZ4_MEM_COMPRESS	(4096 * sizeof(unsigned char *))
+#define LZ4HC_MEM_COMPRESS	(65538 * sizeof(unsigned char *))
+
+/*
+ * lz4_compressbound()
+ * Provides the maximum size that LZ4 may output in a "worst case" scenario
+ * (input data not compressible)
+ */
+static inline size_t lz4_compressbound(size_t isize)
+{
+	return isize + (isize / 255) + 16;
+}
+
+/*
+ * lz4_compress()
+ *	src     : source address of the original data
+ *	src_len : size of the original data
+ *	dst	: output buffer address of the compressed data
+ *	dst_len : in: size of the output buffer
+ *		  out: size of the compressed data
+ *	wrkmem  : address of the working memory.
+ *		This requires 'workmem' of size LZ4_MEM_COMPRESS.
+ *	return  : Success if return 0
+ *		  Error if return (< 0)
+ *	note :  Destination buffer must be at least lz4_compressbound(src_len)
+ *		bytes to be sure that compression succeeds.
+ */
+int lz4_compress(const unsigned char *src, size_t src_len,
+		unsigned char *dst, size_t *dst_len, void *wrkmem);
+
+/*
+ * lz4hc_compress()
+ *	Same as lz4_compress(), but searches much harder for long matches:
+ *	compression is several times slower, the result is smaller, and
+ *	decompression speed is unchanged.
+ *	This requires 'wrkmem' of size LZ4HC_MEM_COMPRESS.
+ */
+int lz4hc_compress(const unsigned char *src, size_t src_len,
+		unsigned char *dst, size_t *dst_len, void *wrkmem);
+
+/*
+ * lz4_decompress()
+ *	src     : source address of the compressed data
+ *	src_len : out: number of bytes of compressed data consumed
+ *	dest	: output buffer address of the decompressed data
+ *	actual_dest_len: the exact size of the decompressed data
+ *	return  : Success if return 0
+ *		  Error if return (< 0)
+ *	note :  Only use this when the uncompressed size is known, and
+ *		only on trusted input: the input is not bounds checked.
+ */
+int lz4_decompress(const unsigned char *src, size_t *src_len,
+		unsigned char *dest, size_t actual_dest_len);
+
+/*
+ * lz4_decompress_unknownoutputsize()
+ *	src     : source address of the compressed data
+ *	src_len : exact size of the compressed data
+ *	dest	: output buffer address of the decompressed data
+ *	dest_len: in: size of the output buffer
+ *		  out: size of the decompressed data
+ *	return  : Success if return 0
+ *		  Error if return (< 0)
+ *	note :  Never reads or writes outside the given buffers, whatever
+ *		the input, so it is safe to use on untrusted data.
+ */
+int lz4_decompress_unknownoutputsize(const unsigned char *src, size_t src_len,
+		unsigned char *dest, size_t *dest_len);
+#endif
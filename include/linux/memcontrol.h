@@ -21,11 +21,14 @@
 #define _LINUX_MEMCONTROL_H
 #include <linux/cgroup.h>
 #include <linux/vm_event_item.h>
+#include <linux/hardirq.h>
+#include <linux/static_key.h>
 
 struct mem_cgroup;
 struct page_cgroup;
 struct page;
 struct mm_struct;
+struct kmem_cache;
 
 /* Stats that can be updated by kernel. */
 enum mem_cgroup_page_stat_item {
@@ -118,7 +121,7 @@ int mem_cgroup_inactive_anon_is_low(struct lruvec *lruvec);
 int mem_cgroup_inactive_file_is_low(struct lruvec *lruvec);
 int mem_cgroup_select_victim_node(struct mem_cgroup *memcg);
 unsigned long mem_cgroup_get_lru_size(struct lruvec *lruvec, enum lru_list);
-void mem_cgroup_update_lru_size(struct lruvec *, enum lru_list, int);
+void mem_cgroup_update_lru_size(struct lruvec *, int, enum lru_list, int);
 extern void mem_cgroup_print_oom_info(struct mem_cgroup *memcg,
 					struct task_struct *p);
 extern void mem_cgroup_replace_page_cache(struct page *oldpage,
@@ -328,8 +331,8 @@ mem_cgroup_get_lru_size(struct lruvec *lruvec, enum lru_list lru)
 }
 
 static inline void
-mem_cgroup_update_lru_size(struct lruvec *lruvec, enum lru_list lru,
-			      int increment)
+mem_cgroup_update_lru_size(struct lruvec *lruvec, int split,
+			   enum lru_list lru, int increment)
 {
 }
 
@@ -409,6 +412,146 @@ struct sock;
 #ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
 void sock_update_memcg(struct sock *sk);
 void sock_release_memcg(struct sock *sk);
+
+extern struct static_key memcg_kmem_enabled_key;
+
+/* number of entries in the root caches' memcg_caches arrays */
+extern int memcg_limited_groups_array_size;
+
+static inline bool memcg_kmem_enabled(void)
+{
+	return static_key_false(&memcg_kmem_enabled_key);
+}
+
+bool __memcg_kmem_newpage_charge(gfp_t gfp, struct mem_cgroup **memcg,
+				 int order);
+void __memcg_kmem_commit_charge(struct page *page, struct mem_cgroup *memcg,
+				int order);
+void __memcg_kmem_uncharge_pages(struct page *page, int order);
+struct kmem_cache *__memcg_kmem_get_cache(struct kmem_cache *cachep,
+					  gfp_t gfp, int *srcu_idx);
+void __memcg_kmem_put_cache(int srcu_idx);
+int __memcg_charge_slab(struct page *page, struct kmem_cache *s, gfp_t gfp,
+			int order);
+void __memcg_uncharge_slab(struct page *page, struct kmem_cache *s, int order);
+
+int memcg_register_cache(struct mem_cgroup *memcg, struct kmem_cache *s,
+			 struct kmem_cache *root_cache);
+void memcg_release_cache(struct kmem_cache *s);
+int memcg_update_cache_size(struct kmem_cache *s, int num_groups);
+void memcg_destroy_child_caches(struct kmem_cache *s);
+char *memcg_cache_name(struct mem_cgroup *memcg, struct kmem_cache *root);
+
+/*
+ * Kernel memory is only charged from process context, on behalf of the
+ * current task. Interrupts, kernel threads, __GFP_NOFAIL allocations and
+ * dying tasks are never charged.
+ */
+static inline bool memcg_kmem_should_charge(gfp_t gfp)
+{
+	if (!memcg_kmem_enabled())
+		return false;
+	if (gfp & __GFP_NOFAIL)
+		return false;
+	if (in_interrupt() || !current->mm || (current->flags & PF_KTHREAD))
+		return false;
+	if (unlikely(fatal_signal_pending(current)))
+		return false;
+	return true;
+}
+
+/**
+ * memcg_kmem_newpage_charge: verify if a new kmem allocation is allowed.
+ * @gfp: the gfp allocation flags.
+ * @memcg: a pointer to the memcg this was charged against.
+ * @order: allocation order.
+ *
+ * Returns true if the allocation may proceed. If it was charged, @memcg
+ * is set and the charge has to be finished with memcg_kmem_commit_charge()
+ * once the page is allocated (or the allocation failed).
+ */
+static inline bool
+memcg_kmem_newpage_charge(gfp_t gfp, struct mem_cgroup **memcg, int order)
+{
+	*memcg = NULL;
+	if (!(gfp & __GFP_KMEMCG) || !memcg_kmem_should_charge(gfp))
+		return true;
+	return __memcg_kmem_newpage_charge(gfp, memcg, order);
+}
+
+/**
+ * memcg_kmem_commit_charge: embeds correct memcg in a page
+ * @page: pointer to struct page recently allocated, or NULL on failure
+ * @memcg: the memcg structure we charged against
+ * @order: allocation order.
+ */
+static inline void
+memcg_kmem_commit_charge(struct page *page, struct mem_cgroup *memcg, int order)
+{
+	if (memcg_kmem_enabled() && memcg)
+		__memcg_kmem_commit_charge(page, memcg, order);
+}
+
+/**
+ * memcg_kmem_uncharge_pages: uncharge pages from memcg
+ * @page: pointer to struct page being freed
+ * @order: allocation order.
+ *
+ * There is no need to specify memcg here, since it is embedded in
+ * page_cgroup.
+ */
+static inline void memcg_kmem_uncharge_pages(struct page *page, int order)
+{
+	if (memcg_kmem_enabled())
+		__memcg_kmem_uncharge_pages(page, order);
+}
+
+/**
+ * memcg_kmem_get_cache: selects the correct per-memcg cache for allocation
+ * @cachep: the original global kmem cache
+ * @gfp: allocation flags.
+ * @srcu_idx: set for memcg_kmem_put_cache()
+ *
+ * Returns @cachep itself when the allocation is not accounted, or when
+ * the memcg's copy of it does not exist yet; it is then created in the
+ * background and used by later allocations.
+ *
+ * A per-memcg cache stays alive until memcg_kmem_put_cache(@srcu_idx),
+ * which must be called once the allocation is done.
+ */
+static inline struct kmem_cache *
+memcg_kmem_get_cache(struct kmem_cache *cachep, gfp_t gfp, int *srcu_idx)
+{
+	*srcu_idx = -1;
+	if (!memcg_kmem_should_charge(gfp))
+		return cachep;
+	return __memcg_kmem_get_cache(cachep, gfp, srcu_idx);
+}
+
+static inline void memcg_kmem_put_cache(int srcu_idx)
+{
+	if (unlikely(srcu_idx >= 0))
+		__memcg_kmem_put_cache(srcu_idx);
+}
+
+/*
+ * Charge and uncharge the pages of a slab that belongs to a per-memcg
+ * cache. Slabs of the global caches are not accounted.
+ */
+static inline int memcg_charge_slab(struct page *page, struct kmem_cache *s,
+				    gfp_t gfp, int order)
+{
+	if (!memcg_kmem_enabled())
+		return 0;
+	return __memcg_charge_slab(page, s, gfp, order);
+}
+
+static inline void memcg_uncharge_slab(struct page *page, struct kmem_cache *s,
+				       int order)
+{
+	if (memcg_kmem_enabled())
+		__memcg_uncharge_slab(page, s, order);
+}
 #else
 static inline void sock_update_memcg(struct sock *sk)
 {
@@ -416,6 +559,64 @@ static inline void sock_update_memcg(struct sock *sk)
 static inline void sock_release_memcg(struct sock *sk)
 {
 }
+
+static inline bool memcg_kmem_enabled(void)
+{
+	return false;
+}
+
+static inline bool
+memcg_kmem_newpage_charge(gfp_t gfp, struct mem_cgroup **memcg, int order)
+{
+	*memcg = NULL;
+	return true;
+}
+
+static inline void
+memcg_kmem_commit_charge(struct page *page, struct mem_cgroup *memcg, int order)
+{
+}
+
+static inline void memcg_kmem_uncharge_pages(struct page *page, int order)
+{
+}
+
+static inline struct kmem_cache *
+memcg_kmem_get_cache(struct kmem_cache *cachep, gfp_t gfp, int *srcu_idx)
+{
+	*srcu_idx = -1;
+	return cachep;
+}
+
+static inline void memcg_kmem_put_cache(int srcu_idx)
+{
+}
+
+static inline int memcg_charge_slab(struct page *page, struct kmem_cache *s,
+				    gfp_t gfp, int order)
+{
+	return 0;
+}
+
+static inline void memcg_uncharge_slab(struct page *page, struct kmem_cache *s,
+				       int order)
+{
+}
+
+static inline int memcg_register_cache(struct mem_cgroup *memcg,
+				       struct kmem_cache *s,
+				       struct kmem_cache *root_cache)
+{
+	return 0;
+}
+
+static inline void memcg_release_cache(struct kmem_cache *s)
+{
+}
+
+static inline void memcg_destroy_child_caches(struct kmem_cache *s)
+{
+}
 #endif /* CONFIG_CGROUP_MEM_RES_CTLR_KMEM */
 #endif /* _LINUX_MEMCONTROL_H */
 
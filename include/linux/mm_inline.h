@@ -21,22 +21,51 @@ static inline int page_is_file_cache(struct page *page)
 	return !PageSwapBacked(page);
 }
 
+/**
+ * page_lru_split - which LRU sublist of its zone does the page belong to?
+ * @page: the page to test
+ *
+ * The sublist is fixed by the page's pageblock, so it does not change
+ * when the page moves between lists or between memory cgroups.
+ */
+static inline int page_lru_split(struct page *page)
+{
+	return pfn_lru_split(page_to_pfn(page));
+}
+
+/**
+ * page_lru_lock - the lock protecting the LRU sublist of @page
+ * @page: the page to test
+ */
+static inline spinlock_t *page_lru_lock(struct page *page)
+{
+	return zone_lru_lock(page_zone(page), page_lru_split(page));
+}
+
 static __always_inline void add_page_to_lru_list(struct page *page,
 				struct lruvec *lruvec, enum lru_list lru)
 {
 	int nr_pages = hpage_nr_pages(page);
-	mem_cgroup_update_lru_size(lruvec, lru, nr_pages);
-	list_add(&page->lru, &lruvec->lists[lru]);
-	__mod_zone_page_state(lruvec_zone(lruvec), NR_LRU_BASE + lru, nr_pages);
+	int split = page_lru_split(page);
+	struct zone *zone = lruvec_zone(lruvec);
+
+	mem_cgroup_update_lru_size(lruvec, split, lru, nr_pages);
+	list_add(&page->lru, lruvec_list(lruvec, split, lru));
+	zone->lru_split[split].nr_pages[lru] += nr_pages;
+	__mod_zone_page_state(zone, NR_LRU_BASE + lru, nr_pages);
 }
 
 static __always_inline void del_page_from_lru_list(struct page *page,
 				struct lruvec *lruvec, enum lru_list lru)
 {
 	int nr_pages = hpage_nr_pages(page);
-	mem_cgroup_update_lru_size(lruvec, lru, -nr_pages);
+	int split = page_lru_split(page);
+	struct zone *zone = lruvec_zone(lruvec);
+
+	mem_cgroup_update_lru_size(lruvec, split, lru, -nr_pages);
 	list_del(&page->lru);
-	__mod_zone_page_state(lruvec_zone(lruvec), NR_LRU_BASE + lru, -nr_pages);
+	zone->lru_split[split].nr_pages[lru] -= nr_pages;
+	__mod_zone_page_state(zone, NR_LRU_BASE + lru, -nr_pages);
 }
 
 /**
@@ -88,7 +88,7 @@ struct free_area {
 struct pglist_data;
 
 /*
- * zone->lock and zone->lru_lock are two of the hottest locks in the kernel.
+ * zone->lock and the zone->lru_split locks are the hottest locks in the kernel.
  * So add a wild amount of padding here to ensure that they fall into separate
  * cachelines.  There are very few zone structures in the machine, so space
  * consumption is not a concern here.
@@ -198,9 +198,31 @@ struct zone_reclaim_stat {
 	unsigned long		recent_scanned[2];
 };
 
-struct lruvec {
+/*
+ * Each zone's LRU is split into NR_LRU_SPLIT sublists, each protected by
+ * its own lock.  A page always lives on the sublist selected by the
+ * pageblock it belongs to (see pfn_lru_split()), so the lock covering a
+ * page can be found without looking at its memcg, and all the pages of a
+ * compound page share a sublist.
+ */
+#ifdef CONFIG_SMP
+#define LRU_SPLIT_SHIFT		2
+#else
+#define LRU_SPLIT_SHIFT		0
+#endif
+#define NR_LRU_SPLIT		(1 << LRU_SPLIT_SHIFT)
+
+#define for_each_lru_split(split) \
+	for (split = 0; split < NR_LRU_SPLIT; split++)
+
+struct lru_split {
 	struct list_head lists[NR_LRU_LISTS];
 	struct zone_reclaim_stat reclaim_stat;
+};
+
+struct lruvec {
+	struct lru_split split[NR_LRU_SPLIT];
+	unsigned int split_rotor;	/* next sublist for reclaim to scan */
 #ifdef CONFIG_CGROUP_MEM_RES_CTLR
 	struct zone *zone;
 #endif
@@ -233,6 +255,12 @@ enum zone_watermarks {
 #define low_wmark_pages(z) (z->watermark[WMARK_LOW])
 #define high_wmark_pages(z) (z->watermark[WMARK_HIGH])
 
+/* Lock and statistics for one LRU sublist of a zone */
+struct zone_lru_split {
+	spinlock_t		lock;
+	unsigned long		nr_pages[NR_LRU_LISTS];
+} ____cacheline_aligned_in_smp;
+
 struct per_cpu_pages {
 	int count;		/* number of pages in the list */
 	int high;		/* high watermark, emptying needed */
@@ -404,7 +432,7 @@ struct zone {
 	ZONE_PADDING(_pad1_)
 
 	/* Fields commonly accessed by the page reclaim scanner */
-	spinlock_t		lru_lock;
+	struct zone_lru_split	lru_split[NR_LRU_SPLIT];
 	struct lruvec		lruvec;
 
 	unsigned long		pages_scanned;	   /* since last reclaim */
@@ -734,6 +762,22 @@ extern int init_currently_empty_zone(struct zone *zone, unsigned long start_pfn,
 
 extern void lruvec_init(struct lruvec *lruvec, struct zone *zone);
 
+static inline int pfn_lru_split(unsigned long pfn)
+{
+	return (pfn >> pageblock_order) & (NR_LRU_SPLIT - 1);
+}
+
+static inline spinlock_t *zone_lru_lock(struct zone *zone, int split)
+{
+	return &zone->lru_split[split].lock;
+}
+
+static inline struct list_head *lruvec_list(struct lruvec *lruvec, int split,
+					    enum lru_list lru)
+{
+	return &lruvec->split[split].lists[lru];
+}
+
 static inline struct zone *lruvec_zone(struct lruvec *lruvec)
 {
 #ifdef CONFIG_CGROUP_MEM_RES_CTLR
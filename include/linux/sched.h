@@ -1518,6 +1518,21 @@ struct task_struct {
 	short il_next;
 	short pref_node_fork;
 #endif
+#ifdef CONFIG_NUMA_BALANCING
+	int numa_scan_seq;
+	int numa_preferred_nid;
+	unsigned int numa_scan_period;
+	u64 node_stamp;			/* migration stamp  */
+	struct task_work numa_work;
+
+	/*
+	 * Hinting faults per node: the first nr_node_ids entries are the
+	 * decayed history used for placement, the second nr_node_ids are
+	 * the faults taken during the current scan pass.
+	 */
+	unsigned long *numa_faults;
+	unsigned long numa_pages_migrated;
+#endif /* CONFIG_NUMA_BALANCING */
 	struct rcu_head rcu;
 
 	/*
@@ -2064,6 +2079,24 @@ static inline void sched_autogroup_exit(struct signal_struct *sig) { }
 extern unsigned int sysctl_sched_cfs_bandwidth_slice;
 #endif
 
+#ifdef CONFIG_NUMA_BALANCING
+extern unsigned int sysctl_numa_balancing;
+extern unsigned int sysctl_numa_balancing_scan_delay;
+extern unsigned int sysctl_numa_balancing_scan_period_min;
+extern unsigned int sysctl_numa_balancing_scan_period_max;
+extern unsigned int sysctl_numa_balancing_scan_size;
+
+extern void task_numa_fault(int node, int pages, bool migrated);
+extern void task_numa_free(struct task_struct *p);
+#else
+static inline void task_numa_fault(int node, int pages, bool migrated)
+{
+}
+static inline void task_numa_free(struct task_struct *p)
+{
+}
+#endif
+
 #ifdef CONFIG_RT_MUTEXES
 extern int rt_mutex_getprio(struct task_struct *p);
 extern void rt_mutex_setprio(struct task_struct *p, int prio);
@@ -11,6 +11,7 @@
 
 #include <linux/gfp.h>
 #include <linux/types.h>
+#include <linux/workqueue.h>
 
 /*
  * Flags to pass to kmem_cache_create().
@@ -75,6 +76,11 @@
 #else
 # define SLAB_FAILSLAB		0x00000000UL
 #endif
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+# define SLAB_ACCOUNT		0x04000000UL	/* Account to the memcg */
+#else
+# define SLAB_ACCOUNT		0x00000000UL
+#endif
 
 /* The following flags affect the page allocator grouping pages by mobility */
 #define SLAB_RECLAIM_ACCOUNT	0x00020000UL		/* Objects are reclaimable */
@@ -106,6 +112,50 @@ int kmem_cache_shrink(struct kmem_cache *);
 void kmem_cache_free(struct kmem_cache *, void *);
 unsigned int kmem_cache_size(struct kmem_cache *);
 
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+struct mem_cgroup;
+
+/*
+ * Caches created with SLAB_ACCOUNT get a copy per memory cgroup with a
+ * kmem limit, and allocations from tasks in that cgroup are served from
+ * (and charged through) the copy.
+ *
+ * @is_root_cache: the cache was created by kmem_cache_create()
+ * @memcg_caches: (root) the per-memcg copies, indexed by kmemcg_id
+ * @memcg: (copy) the cgroup the slab pages are charged to
+ * @list: (copy) entry in the cgroup's list of caches
+ * @cachep: (copy) the cache these parameters belong to
+ * @root_cache: (copy) the cache this one was created from
+ * @dead: (copy) the cgroup is gone; destroy the cache once it is empty
+ * @nr_pages: (copy) number of slab pages in the cache
+ * @destroy: (copy) work item destroying the cache
+ */
+struct memcg_cache_params {
+	bool is_root_cache;
+	union {
+		struct {
+			struct rcu_head rcu_head;
+			struct kmem_cache *memcg_caches[0];
+		};
+		struct {
+			struct mem_cgroup *memcg;
+			struct list_head list;
+			struct kmem_cache *cachep;
+			struct kmem_cache *root_cache;
+			bool dead;
+			atomic_t nr_pages;
+			struct work_struct destroy;
+		};
+	};
+};
+
+struct kmem_cache *kmem_cache_create_memcg(struct mem_cgroup *,
+			const char *, size_t, size_t, unsigned long,
+			void (*)(void *), struct kmem_cache *);
+struct kmem_cache *kmem_cache_dup(struct mem_cgroup *, struct kmem_cache *);
+int memcg_update_all_caches(int num_memcgs);
+#endif
+
 /*
  * Please use this macro to create slab caches. Simply specify the
  * name of the structure and maybe some flags that are listed above.
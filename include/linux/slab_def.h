@@ -53,6 +53,10 @@ struct kmem_cache {
 /* 4) cache creation/removal */
 	const char *name;
 	struct list_head next;
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+	size_t align;	/* alignment requested at creation */
+	struct memcg_cache_params *memcg_params;
+#endif
 
 /* 5) statistics */
 #ifdef CONFIG_DEBUG_SLAB
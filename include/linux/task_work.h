@@ -4,15 +4,6 @@
 #include <linux/list.h>
 #include <linux/sched.h>
 
-struct task_work;
-typedef void (*task_work_func_t)(struct task_work *);
-
-struct task_work {
-	struct hlist_node hlist;
-	task_work_func_t func;
-	void *data;
-};
-
 static inline void
 init_task_work(struct task_work *twork, task_work_func_t func, void *data)
 {
@@ -21,6 +12,8 @@ init_task_work(struct task_work *twork, task_work_func_t func, void *data)
 }
 
 int task_work_add(struct task_struct *task, struct task_work *twork, bool);
+int task_work_trylock_add(struct task_struct *task, struct task_work *twork,
+			  bool);
 struct task_work *task_work_cancel(struct task_struct *, task_work_func_t);
 void task_work_run(void);
 
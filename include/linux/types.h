@@ -255,6 +255,21 @@ struct rcu_head {
 	void (*func)(struct rcu_head *head);
 };
 
+struct task_work;
+typedef void (*task_work_func_t)(struct task_work *);
+
+/**
+ * struct task_work - work a task runs on its way back to user mode
+ * @hlist: entry on task_struct->task_works
+ * @func: the function to call
+ * @data: argument for @func
+ */
+struct task_work {
+	struct hlist_node hlist;
+	task_work_func_t func;
+	void *data;
+};
+
 #endif	/* __KERNEL__ */
 #endif /*  __ASSEMBLY__ */
 #endif /* _LINUX_TYPES_H */
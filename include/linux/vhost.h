@@ -103,6 +103,16 @@ struct vhost_memory {
 /* Get accessor: reads index, writes value in num */
 #define VHOST_GET_VRING_BASE _IOWR(VHOST_VIRTIO, 0x12, struct vhost_vring_state)
 
+/* Bind the thread servicing a ring to the host cpu in num, or let it run on
+ * any cpu with VHOST_VRING_CPU_ANY.  Rings that share a thread (all rings of
+ * a device in the default worker mode) are moved together.  With shared
+ * per-cpu threads the ring is instead handed to the thread of that cpu,
+ * which is only allowed while the ring is stopped. */
+#define VHOST_SET_VRING_AFFINITY _IOW(VHOST_VIRTIO, 0x13, struct vhost_vring_state)
+/* Get accessor: reads index, writes cpu in num */
+#define VHOST_GET_VRING_AFFINITY _IOWR(VHOST_VIRTIO, 0x13, struct vhost_vring_state)
+#define VHOST_VRING_CPU_ANY (~0U)
+
 /* The following ioctls use eventfd file descriptors to signal and poll
  * for events. */
 
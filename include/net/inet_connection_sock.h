@@ -245,6 +245,9 @@ extern struct request_sock *inet_csk_search_req(const struct sock *sk,
 						const __be16 rport,
 						const __be32 raddr,
 						const __be32 laddr);
+extern bool inet_csk_reqsk_queue_find(const struct sock *sk,
+				      const __be16 rport, const __be32 raddr,
+				      const __be32 laddr);
 extern int inet_csk_bind_conflict(const struct sock *sk,
 				  const struct inet_bind_bucket *tb, bool relax);
 extern int inet_csk_get_port(struct sock *sk, unsigned short snum);
@@ -12,6 +12,7 @@
 #include <linux/jiffies.h>
 #include <linux/spinlock.h>
 #include <linux/rtnetlink.h>
+#include <linux/tcp.h>
 #include <net/ipv6.h>
 #include <linux/atomic.h>
 
@@ -60,6 +61,12 @@ struct inet_peer {
 		struct inet_peer	*gc_next;
 	};
 
+	/* TCP Fast Open client state, protected by tcp_fastopen's seqlock */
+	u16			tcp_fastopen_mss;
+	u16			tcp_fastopen_syn_loss;	/* recurring SYN losses */
+	unsigned long		tcp_fastopen_last_syn_loss;
+	struct tcp_fastopen_cookie tcp_fastopen_cookie;
+
 	/* following fields might be frequently dirtied */
 	__u32			dtime;	/* the time of last use of not referenced entries */
 	atomic_t		refcnt;
@@ -65,6 +65,7 @@ struct request_sock {
 	struct sock			*sk;
 	u32				secid;
 	u32				peer_secid;
+	u32				syn_hash; /* syn_table bucket, see listen_sock */
 };
 
 static inline struct request_sock *reqsk_alloc(const struct request_sock_ops *ops)
@@ -90,28 +91,67 @@ static inline void reqsk_free(struct request_sock *req)
 
 extern int sysctl_max_syn_backlog;
 
+#define LISTEN_SOCK_SYN_LOCKS	16
+
+struct listen_sock_lock {
+	spinlock_t		lock;
+} ____cacheline_aligned_in_smp;
+
 /** struct listen_sock - listen state
  *
  * @max_qlen_log - log_2 of maximal queued SYNs/REQUESTs
+ * @syn_lock - locks for ranges of syn_table buckets
+ *
+ * SYNs may be queued without the listener's socket lock (see
+ * tcp_v4_syn_rcv()), so qlen and qlen_young are atomic and every
+ * syn_table insertion or unlink holds the lock covering its bucket.
+ * Insertions only ever happen at the head of a chain, so the listener
+ * lock holders may still walk the chains without the syn_lock.
  */
 struct listen_sock {
 	u8			max_qlen_log;
 	u8			synflood_warned;
 	/* 2 bytes hole, try to use */
-	int			qlen;
-	int			qlen_young;
+	atomic_t		qlen;
+	atomic_t		qlen_young;
 	int			clock_hand;
 	u32			hash_rnd;
 	u32			nr_table_entries;
+	struct listen_sock_lock	syn_lock[LISTEN_SOCK_SYN_LOCKS];
 	struct request_sock	*syn_table[0];
 };
 
+static inline spinlock_t *reqsk_syn_lock(struct listen_sock *lopt, u32 hash)
+{
+	return &lopt->syn_lock[hash & (LISTEN_SOCK_SYN_LOCKS - 1)].lock;
+}
+
+/** struct fastopen_queue - TCP Fast Open state of a listener
+ *
+ * @rskq_rst_head - FIFO head of reqs whose Fast Open child was reset
+ * @rskq_rst_tail - FIFO tail of the above
+ * @lock - protects the reqs shared between the listener and its children
+ * @qlen - pending Fast Open children (still in TCP_SYN_RECV)
+ * @max_qlen - max pending children allowed, 0 if Fast Open is disabled
+ *
+ * Unlike listen_sock this outlives inet_csk_listen_stop(), as accepted
+ * children may still be in the handshake when the listener goes away.
+ */
+struct fastopen_queue {
+	struct request_sock	*rskq_rst_head;
+	struct request_sock	*rskq_rst_tail;
+	spinlock_t		lock;
+	int			qlen;
+	int			max_qlen;
+};
+
 /** struct request_sock_queue - queue of request_socks
  *
  * @rskq_accept_head - FIFO head of established children
  * @rskq_accept_tail - FIFO tail of established children
  * @rskq_defer_accept - User waits for some data after accept()
  * @syn_wait_lock - serializer
+ * @syn_users - lockless SYN handlers in flight, plus one while listening
  *
  * %syn_wait_lock is necessary only to avoid proc interface having to grab the main
  * lock sock while browsing the listening hash (otherwise it's deadlock prone).
@@ -121,6 +161,10 @@ struct listen_sock {
  * changing rskq_accept_head. All readers that are holding the master sock lock
  * don't need to grab this lock in read mode too as rskq_accept_head. writes
  * are always protected from the main sock lock.
+ *
+ * syn_table insertions don't take it: they publish a fully initialized
+ * request at the head of a chain, which is safe for readers. Unlinks
+ * still take it in write mode so readers never see a freed request.
  */
 struct request_sock_queue {
 	struct request_sock	*rskq_accept_head;
@@ -129,6 +173,8 @@ struct request_sock_queue {
 	u8			rskq_defer_accept;
 	/* 3 bytes hole, try to pack */
 	struct listen_sock	*listen_opt;
+	struct fastopen_queue	*fastopenq; /* non-NULL once TCP_FASTOPEN set */
+	atomic_t		syn_users;
 };
 
 extern int reqsk_queue_alloc(struct request_sock_queue *queue,
@@ -136,6 +182,8 @@ extern int reqsk_queue_alloc(struct request_sock_queue *queue,
 
 extern void __reqsk_queue_destroy(struct request_sock_queue *queue);
 extern void reqsk_queue_destroy(struct request_sock_queue *queue);
+extern void reqsk_fastopen_remove(struct sock *sk,
+				  struct request_sock *req, bool reset);
 
 static inline struct request_sock *
 	reqsk_queue_yank_acceptq(struct request_sock_queue *queue)
@@ -155,9 +203,18 @@ static inline void reqsk_queue_unlink(struct request_sock_queue *queue,
 				      struct request_sock *req,
 				      struct request_sock **prev_req)
 {
+	spinlock_t *lock = reqsk_syn_lock(queue->listen_opt, req->syn_hash);
+
+	spin_lock(lock);
+	/* Lockless SYNs may have been hashed in front of req since prev_req
+	 * was looked up; they only go to the head, so walk forward to req.
+	 */
+	while (*prev_req != req)
+		prev_req = &(*prev_req)->dl_next;
 	write_lock(&queue->syn_wait_lock);
 	*prev_req = req->dl_next;
 	write_unlock(&queue->syn_wait_lock);
+	spin_unlock(lock);
 }
 
 static inline void reqsk_queue_add(struct request_sock_queue *queue,
@@ -209,34 +266,34 @@ static inline int reqsk_queue_removed(struct request_sock_queue *queue,
 	struct listen_sock *lopt = queue->listen_opt;
 
 	if (req->retrans == 0)
-		--lopt->qlen_young;
+		atomic_dec(&lopt->qlen_young);
 
-	return --lopt->qlen;
+	return atomic_dec_return(&lopt->qlen);
 }
 
 static inline int reqsk_queue_added(struct request_sock_queue *queue)
 {
 	struct listen_sock *lopt = queue->listen_opt;
-	const int prev_qlen = lopt->qlen;
 
-	lopt->qlen_young++;
-	lopt->qlen++;
-	return prev_qlen;
+	atomic_inc(&lopt->qlen_young);
+	return atomic_inc_return(&lopt->qlen) - 1;
 }
 
 static inline int reqsk_queue_len(const struct request_sock_queue *queue)
 {
-	return queue->listen_opt != NULL ? queue->listen_opt->qlen : 0;
+	return queue->listen_opt != NULL ?
+	       atomic_read(&queue->listen_opt->qlen) : 0;
 }
 
 static inline int reqsk_queue_len_young(const struct request_sock_queue *queue)
 {
-	return queue->listen_opt->qlen_young;
+	return atomic_read(&queue->listen_opt->qlen_young);
 }
 
 static inline int reqsk_queue_is_full(const struct request_sock_queue *queue)
 {
-	return queue->listen_opt->qlen >> queue->listen_opt->max_qlen_log;
+	return atomic_read(&queue->listen_opt->qlen) >>
+	       queue->listen_opt->max_qlen_log;
 }
 
 static inline void reqsk_queue_hash_req(struct request_sock_queue *queue,
@@ -244,15 +301,19 @@ static inline void reqsk_queue_hash_req(struct request_sock_queue *queue,
 					unsigned long timeout)
 {
 	struct listen_sock *lopt = queue->listen_opt;
+	spinlock_t *lock = reqsk_syn_lock(lopt, hash);
 
 	req->expires = jiffies + timeout;
 	req->retrans = 0;
 	req->sk = NULL;
-	req->dl_next = lopt->syn_table[hash];
+	req->syn_hash = hash;
 
-	write_lock(&queue->syn_wait_lock);
+	spin_lock(lock);
+	req->dl_next = lopt->syn_table[hash];
+	/* make req visible to chain walkers only once it is complete */
+	smp_wmb();
 	lopt->syn_table[hash] = req;
-	write_unlock(&queue->syn_wait_lock);
+	spin_unlock(lock);
 }
 
 #endif /* _REQUEST_SOCK_H */
@@ -491,6 +491,22 @@ void proc_sched_show_task(struct task_struct *p, struct seq_file *m)
 	P(se.load.weight);
 	P(policy);
 	P(prio);
+#ifdef CONFIG_NUMA_BALANCING
+	P(numa_scan_seq);
+	P(numa_scan_period);
+	P(numa_preferred_nid);
+	P(numa_pages_migrated);
+	if (p->numa_faults) {
+		char name[32];
+		int nid;
+
+		for_each_online_node(nid) {
+			snprintf(name, sizeof(name), "numa_faults.node%d", nid);
+			SEQ_printf(m, "%-35s:%21Ld\n",
+				   name, (long long)p->numa_faults[nid]);
+		}
+	}
+#endif
 #undef PN
 #undef __PN
 #undef P
@@ -26,6 +26,9 @@
 #include <linux/slab.h>
 #include <linux/profile.h>
 #include <linux/interrupt.h>
+#include <linux/mempolicy.h>
+#include <linux/migrate.h>
+#include <linux/task_work.h>
 
 #include <trace/events/sched.h>
 
@@ -2331,6 +2334,301 @@ static unsigned long cpu_avg_load_per_task(int cpu)
 	return 0;
 }
 
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * Automatic NUMA balancing.
+ *
+ * Every numa_scan_period milliseconds of runtime a task marks the next
+ * numa_balancing_scan_size megabytes of its address space pte_numa.  The
+ * next access to such a page takes a NUMA hinting fault, which records
+ * the node the page lives on (see task_numa_fault()) and may migrate the
+ * page to the faulting node (see do_numa_page()).  Once a full pass over
+ * the address space has completed, the task is moved towards the node
+ * holding most of the memory it faulted on.
+ */
+unsigned int sysctl_numa_balancing = IS_ENABLED(CONFIG_NUMA_BALANCING_DEFAULT_ENABLED);
+
+/*
+ * Scan period bounds, in ms of task runtime.  The period backs off
+ * towards the maximum while pages are found to be well placed.
+ */
+unsigned int sysctl_numa_balancing_scan_period_min = 100;
+unsigned int sysctl_numa_balancing_scan_period_max = 100*50;
+
+/* Portion of address space to scan in MB */
+unsigned int sysctl_numa_balancing_scan_size = 256;
+
+/* Scan @scan_size MB every @scan_period after an initial @scan_delay in ms */
+unsigned int sysctl_numa_balancing_scan_delay = 1000;
+
+/*
+ * Move @p to the least loaded allowed cpu on @nid, but only if that does
+ * not leave the destination busier than the cpu @p runs on now; otherwise
+ * the load balancer would just pull it back again.
+ */
+static void task_numa_migrate(struct task_struct *p, int nid)
+{
+	unsigned long src_load, load, min_load = ULONG_MAX;
+	int cpu, best_cpu = -1;
+
+	src_load = weighted_cpuload(task_cpu(p));
+
+	for_each_cpu_and(cpu, cpumask_of_node(nid), tsk_cpus_allowed(p)) {
+		load = weighted_cpuload(cpu);
+		if (load + p->se.load.weight > src_load)
+			continue;
+		if (load < min_load) {
+			min_load = load;
+			best_cpu = cpu;
+		}
+	}
+
+	if (best_cpu != -1)
+		migrate_task_to(p, best_cpu);
+}
+
+static void task_numa_placement(struct task_struct *p)
+{
+	unsigned long faults, max_faults = 0;
+	int seq, nid, max_nid = -1;
+
+	seq = ACCESS_ONCE(p->mm->numa_scan_seq);
+	if (p->numa_scan_seq == seq)
+		return;
+	p->numa_scan_seq = seq;
+
+	/* Decay the history and fold in the faults of the last pass */
+	for_each_online_node(nid) {
+		faults = p->numa_faults[nid] / 2 +
+			 p->numa_faults[nr_node_ids + nid];
+		p->numa_faults[nid] = faults;
+		p->numa_faults[nr_node_ids + nid] = 0;
+
+		if (faults > max_faults) {
+			max_faults = faults;
+			max_nid = nid;
+		}
+	}
+
+	if (max_nid == -1)
+		return;
+
+	p->numa_preferred_nid = max_nid;
+	if (cpu_to_node(task_cpu(p)) != max_nid)
+		task_numa_migrate(p, max_nid);
+}
+
+/*
+ * Got a PROT_NONE fault for a page on @node.
+ */
+void task_numa_fault(int node, int pages, bool migrated)
+{
+	struct task_struct *p = current;
+
+	if (!sysctl_numa_balancing)
+		return;
+
+	/* for example, ksmd faulting in a user's mm */
+	if (!p->mm)
+		return;
+
+	/* Allocate the fault statistics on first use */
+	if (unlikely(!p->numa_faults)) {
+		int size = sizeof(*p->numa_faults) * 2 * nr_node_ids;
+
+		p->numa_faults = kzalloc(size, GFP_KERNEL|__GFP_NOWARN);
+		if (!p->numa_faults)
+			return;
+	}
+
+	/*
+	 * Scan faster while pages are still being moved, and back off once
+	 * the memory is where the task runs.
+	 */
+	if (migrated) {
+		p->numa_pages_migrated += pages;
+		p->numa_scan_period = max(sysctl_numa_balancing_scan_period_min,
+					  p->numa_scan_period / 2);
+	} else {
+		p->numa_scan_period = min(sysctl_numa_balancing_scan_period_max,
+					  p->numa_scan_period + 10);
+	}
+
+	task_numa_placement(p);
+
+	p->numa_faults[nr_node_ids + node] += pages;
+}
+
+void task_numa_free(struct task_struct *p)
+{
+	kfree(p->numa_faults);
+}
+
+static void reset_ptenuma_scan(struct task_struct *p)
+{
+	ACCESS_ONCE(p->mm->numa_scan_seq)++;
+	p->mm->numa_scan_offset = 0;
+}
+
+/*
+ * The expensive part of numa migration is done from task_work context.
+ * Triggered from task_tick_numa().
+ */
+static void task_numa_work(struct task_work *work)
+{
+	unsigned long migrate, next_scan, now = jiffies;
+	struct task_struct *p = current;
+	struct mm_struct *mm = p->mm;
+	struct vm_area_struct *vma;
+	unsigned long start, end;
+	long pages;
+
+	WARN_ON_ONCE(p != container_of(work, struct task_struct, numa_work));
+
+	/* Mark the work as no longer pending, see task_tick_numa() */
+	INIT_HLIST_NODE(&work->hlist);
+
+	/*
+	 * Who cares about NUMA placement when they're dying.
+	 *
+	 * NOTE: make sure not to dereference p->mm before this check,
+	 * exit_task_work() happens _after_ exit_mm() so we could be called
+	 * without p->mm even though we still had it when we enqueued this
+	 * work.
+	 */
+	if (p->flags & PF_EXITING)
+		return;
+
+	/*
+	 * Enforce maximal scan/migration frequency.  Every thread of the
+	 * process may try to scan; only the one that wins the cmpxchg does.
+	 */
+	migrate = mm->numa_next_scan;
+	if (time_before(now, migrate))
+		return;
+
+	next_scan = now + msecs_to_jiffies(p->numa_scan_period);
+	if (cmpxchg(&mm->numa_next_scan, migrate, next_scan) != migrate)
+		return;
+
+	pages = sysctl_numa_balancing_scan_size;
+	pages <<= 20 - PAGE_SHIFT; /* MB in pages */
+	if (!pages)
+		return;
+
+	down_read(&mm->mmap_sem);
+	start = mm->numa_scan_offset;
+	vma = find_vma(mm, start);
+	if (!vma) {
+		reset_ptenuma_scan(p);
+		start = 0;
+		vma = mm->mmap;
+	}
+	for (; vma; vma = vma->vm_next) {
+		if (!vma_migratable(vma) ||
+		    !(vma->vm_flags & (VM_READ|VM_WRITE|VM_EXEC)))
+			continue;
+
+		/* Skip small VMAs. They are not likely to be of relevance */
+		if (vma->vm_end - vma->vm_start < PMD_SIZE)
+			continue;
+
+		do {
+			start = max(start, vma->vm_start);
+			end = ALIGN(start + (pages << PAGE_SHIFT), PMD_SIZE);
+			end = min(end, vma->vm_end);
+			change_prot_numa(vma, start, end);
+			pages -= (end - start) >> PAGE_SHIFT;
+
+			start = end;
+			if (pages <= 0)
+				goto out;
+		} while (end != vma->vm_end);
+	}
+
+out:
+	/*
+	 * It is possible to reach the end of the VMA list but the last few
+	 * VMAs are not guaranteed to be vma_migratable.  If they are not, we
+	 * would find the !migratable VMA on the next scan but not reset the
+	 * scanner to the start so check it now.
+	 */
+	if (vma)
+		mm->numa_scan_offset = start;
+	else
+		reset_ptenuma_scan(p);
+	up_read(&mm->mmap_sem);
+}
+
+/*
+ * Drive the periodic memory faults..
+ */
+static void task_tick_numa(struct rq *rq, struct task_struct *curr)
+{
+	struct task_work *work = &curr->numa_work;
+	u64 period, now;
+
+	/*
+	 * We don't care about NUMA placement if we don't have memory, and
+	 * there is nothing to do while the last scan is still pending.
+	 */
+	if (nr_node_ids == 1 || !curr->mm || (curr->flags & PF_EXITING) ||
+	    !hlist_unhashed(&work->hlist))
+		return;
+
+	/*
+	 * Using runtime rather than walltime has the dual advantage that
+	 * we (mostly) drive the selection from busy threads and that the
+	 * task needs to have done some actual work before we bother with
+	 * NUMA placement.
+	 */
+	now = curr->se.sum_exec_runtime;
+	period = (u64)curr->numa_scan_period * NSEC_PER_MSEC;
+
+	if (now - curr->node_stamp > period) {
+		if (!curr->node_stamp)
+			curr->numa_scan_period = sysctl_numa_balancing_scan_period_min;
+		curr->node_stamp = now;
+
+		if (!time_before(jiffies, curr->mm->numa_next_scan)) {
+			init_task_work(work, task_numa_work, NULL);
+			task_work_trylock_add(curr, work, true);
+		}
+	}
+}
+
+/*
+ * Should the load balancer move @p from @src_cpu to @dst_cpu?  Returns 1
+ * if the move takes @p to its preferred node, -1 if it takes @p away from
+ * it, and 0 if NUMA placement has no opinion.
+ */
+static int task_numa_move_preference(struct task_struct *p, int src_cpu,
+				     int dst_cpu)
+{
+	int src_nid, dst_nid;
+
+	if (!sysctl_numa_balancing || p->numa_preferred_nid == -1)
+		return 0;
+
+	src_nid = cpu_to_node(src_cpu);
+	dst_nid = cpu_to_node(dst_cpu);
+	if (src_nid == dst_nid)
+		return 0;
+
+	if (dst_nid == p->numa_preferred_nid)
+		return 1;
+	if (src_nid == p->numa_preferred_nid)
+		return -1;
+	return 0;
+}
+#else
+static inline int task_numa_move_preference(struct task_struct *p,
+					    int src_cpu, int dst_cpu)
+{
+	return 0;
+}
+#endif /* CONFIG_NUMA_BALANCING */
+
 
 static void task_waking_fair(struct task_struct *p)
 {
@@ -3159,9 +3457,22 @@ int can_migrate_task(struct task_struct *p, struct lb_env *env)
 	 * Aggressive migration if:
 	 * 1) task is cache cold, or
 	 * 2) too many balance attempts have failed.
+	 *
+	 * With NUMA balancing, a move to the task's preferred node counts
+	 * as cache cold and a move away from it as cache hot.
 	 */
 
 	tsk_cache_hot = task_hot(p, env->src_rq->clock_task, env->sd);
+	switch (task_numa_move_preference(p, env->src_cpu, env->dst_cpu)) {
+	case 1:
+		if (sched_feat(NUMA_FAVOUR_HIGHER))
+			tsk_cache_hot = 0;
+		break;
+	case -1:
+		if (sched_feat(NUMA_RESIST_LOWER))
+			tsk_cache_hot = 1;
+		break;
+	}
 	if (!tsk_cache_hot ||
 		env->sd->nr_balance_failed > env->sd->cache_nice_tries) {
 #ifdef CONFIG_SCHEDSTATS
@@ -4907,6 +5218,11 @@ static void task_tick_fair(struct rq *rq, struct task_struct *curr, int queued)
 		cfs_rq = cfs_rq_of(se);
 		entity_tick(cfs_rq, se, queued);
 	}
+
+#ifdef CONFIG_NUMA_BALANCING
+	if (sysctl_numa_balancing)
+		task_tick_numa(rq, curr);
+#endif
 }
 
 /*
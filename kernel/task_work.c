@@ -2,26 +2,58 @@
 #include <linux/task_work.h>
 #include <linux/tracehook.h>
 
+static int __task_work_add(struct task_struct *task, struct task_work *twork)
+{
+	/*
+	 * We must not insert the new work if the task has already passed
+	 * exit_task_work(). We rely on do_exit()->raw_spin_unlock_wait()
+	 * and check PF_EXITING under pi_lock.
+	 */
+	if (unlikely(task->flags & PF_EXITING))
+		return -ESRCH;
+
+	hlist_add_head(&twork->hlist, &task->task_works);
+	return 0;
+}
+
 int
 task_work_add(struct task_struct *task, struct task_work *twork, bool notify)
 {
 	unsigned long flags;
-	int err = -ESRCH;
+	int err;
 
 #ifndef TIF_NOTIFY_RESUME
 	if (notify)
 		return -ENOTSUPP;
 #endif
-	/*
-	 * We must not insert the new work if the task has already passed
-	 * exit_task_work(). We rely on do_exit()->raw_spin_unlock_wait()
-	 * and check PF_EXITING under pi_lock.
-	 */
 	raw_spin_lock_irqsave(&task->pi_lock, flags);
-	if (likely(!(task->flags & PF_EXITING))) {
-		hlist_add_head(&twork->hlist, &task->task_works);
-		err = 0;
-	}
+	err = __task_work_add(task, twork);
+	raw_spin_unlock_irqrestore(&task->pi_lock, flags);
+
+	/* test_and_set_bit() implies mb(), see tracehook_notify_resume(). */
+	if (likely(!err) && notify)
+		set_notify_resume(task);
+	return err;
+}
+
+/*
+ * Like task_work_add(), for callers holding a runqueue lock such as the
+ * scheduler tick.  ->pi_lock nests outside rq->lock, so we must not spin
+ * on it here; -EBUSY is returned if it is contended.
+ */
+int task_work_trylock_add(struct task_struct *task, struct task_work *twork,
+			  bool notify)
+{
+	unsigned long flags;
+	int err;
+
+#ifndef TIF_NOTIFY_RESUME
+	if (notify)
+		return -ENOTSUPP;
+#endif
+	if (!raw_spin_trylock_irqsave(&task->pi_lock, flags))
+		return -EBUSY;
+	err = __task_work_add(task, twork);
 	raw_spin_unlock_irqrestore(&task->pi_lock, flags);
 
 	/* test_and_set_bit() implies mb(), see tracehook_notify_resume(). */
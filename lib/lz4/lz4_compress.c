@@ -0,0 +1,119 @@
+/*
+ * LZ4 - Fast LZ compression algorithm, kernel implementation
+ *
+ * Greedy single-probe compressor: each position is hashed into a
+ * table of the last position seen with the same 4-byte prefix, and
+ * the search step grows while no match is found so that incompressible
+ * data is skipped over quickly.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/bitops.h>
+#include <linux/lz4.h>
+#include <asm/unaligned.h>
+#include "lz4defs.h"
+
+static inline u32 lz4_hash(const u8 *p)
+{
+	return (lz4_read32(p) * 2654435761U) >> (32 - LZ4_HASH_LOG);
+}
+
+int lz4_compress(const unsigned char *src, size_t src_len,
+		unsigned char *dst, size_t *dst_len, void *wrkmem)
+{
+	u32 *hash_table = wrkmem;
+	const u8 *ip = src, *anchor = src, *ref;
+	const u8 *const iend = src + src_len;
+	const u8 *const mflimit = iend - LZ4_MFLIMIT;
+	const u8 *const matchlimit = iend - LZ4_LASTLITERALS;
+	u8 *op = dst;
+	const u8 *const oend = dst + *dst_len;
+	u32 fwd_h, h;
+
+	BUILD_BUG_ON(LZ4_HASH_SIZE * sizeof(u32) > LZ4_MEM_COMPRESS);
+
+	if (unlikely(src_len > LZ4_MAX_INPUT_SIZE))
+		return -1;
+
+	memset(hash_table, 0, LZ4_HASH_SIZE * sizeof(u32));
+
+	if (src_len < LZ4_MIN_LENGTH)
+		goto last_literals;
+
+	hash_table[lz4_hash(ip)] = 0;
+	ip++;
+	fwd_h = lz4_hash(ip);
+
+	for (;;) {
+		const u8 *fwd_ip = ip;
+		unsigned int attempts = 1U << LZ4_SKIP_STRENGTH;
+
+		/* Find a match */
+		do {
+			unsigned int step = attempts++ >> LZ4_SKIP_STRENGTH;
+
+			h = fwd_h;
+			ip = fwd_ip;
+			fwd_ip = ip + step;
+			if (unlikely(fwd_ip > mflimit))
+				goto last_literals;
+
+			fwd_h = lz4_hash(fwd_ip);
+			ref = src + hash_table[h];
+			hash_table[h] = ip - src;
+		} while (ip - ref > LZ4_MAX_DISTANCE ||
+			 lz4_read32(ref) != lz4_read32(ip));
+
+		/* Catch up */
+		while (ip > anchor && ref > src && unlikely(ip[-1] == ref[-1])) {
+			ip--;
+			ref--;
+		}
+
+		/* Encode the match, and any that immediately follows it */
+		for (;;) {
+			size_t mlen = lz4_count(ip + LZ4_MINMATCH,
+						ref + LZ4_MINMATCH, matchlimit);
+
+			op = lz4_encode_sequence(op, oend, anchor, ip - anchor,
+						 ip - ref, mlen);
+			if (unlikely(!op))
+				return -1;
+
+			ip += mlen + LZ4_MINMATCH;
+			anchor = ip;
+			if (ip > mflimit)
+				goto last_literals;
+
+			hash_table[lz4_hash(ip - 2)] = ip - 2 - src;
+
+			/* Test next position */
+			h = lz4_hash(ip);
+			ref = src + hash_table[h];
+			hash_table[h] = ip - src;
+			if (ip - ref > LZ4_MAX_DISTANCE ||
+			    lz4_read32(ref) != lz4_read32(ip))
+				break;
+		}
+
+		fwd_h = lz4_hash(++ip);
+	}
+
+last_literals:
+	op = lz4_encode_last_literals(op, oend, anchor, iend - anchor);
+	if (unlikely(!op))
+		return -1;
+
+	*dst_len = op - dst;
+	return 0;
+}
+EXPORT_SYMBOL(lz4_compress);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 compressor");
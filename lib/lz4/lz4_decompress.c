@@ -0,0 +1,145 @@
+/*
+ * LZ4 Decompressor for Linux kernel
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef STATIC
+#include <linux/module.h>
+#include <linux/kernel.h>
+#endif
+#include <linux/types.h>
+#include <linux/lz4.h>
+#include <asm/unaligned.h>
+
+#define LZ4_MINMATCH		4
+#define ML_BITS			4
+#define ML_MASK			((1U << ML_BITS) - 1)
+#define RUN_BITS		(8 - ML_BITS)
+#define RUN_MASK		((1U << RUN_BITS) - 1)
+
+/*
+ * Read a length extension: bytes are added while they are 255.
+ * Returns false if the input ends first.
+ */
+static inline bool lz4_read_length(const u8 **ipp, const u8 *iend,
+		size_t *len)
+{
+	const u8 *ip = *ipp;
+	u8 s;
+
+	do {
+		if (iend && unlikely(ip >= iend))
+			return false;
+		s = *ip++;
+		*len += s;
+	} while (s == 255);
+
+	*ipp = ip;
+	return true;
+}
+
+/*
+ * Common decoding loop.  With @iend set, decoding stops at the end of
+ * the input and all input reads are bounds checked; otherwise it stops
+ * when exactly @dst_cap bytes have been produced.  Output writes and
+ * back references are always checked.
+ */
+static int lz4_uncompress(const u8 *src, const u8 *iend, u8 *dst,
+		size_t dst_cap, size_t *in_used, size_t *out_len)
+{
+	const u8 *ip = src;
+	u8 *op = dst;
+	u8 *const oend = dst + dst_cap;
+
+	for (;;) {
+		unsigned int token;
+		size_t length, offset;
+		const u8 *ref;
+
+		if (iend && unlikely(ip >= iend))
+			goto malformed;
+		token = *ip++;
+
+		/* literals */
+		length = token >> ML_BITS;
+		if (length == RUN_MASK && !lz4_read_length(&ip, iend, &length))
+			goto malformed;
+		if (unlikely(length > (size_t)(oend - op)))
+			goto malformed;
+		if (iend && unlikely(length > (size_t)(iend - ip)))
+			goto malformed;
+		memcpy(op, ip, length);
+		op += length;
+		ip += length;
+
+		/* the last sequence has no match part */
+		if (iend ? ip == iend : op == oend)
+			break;
+
+		/* match */
+		if (iend && unlikely(iend - ip < 2))
+			goto malformed;
+		offset = get_unaligned_le16(ip);
+		ip += 2;
+		if (unlikely(offset == 0 || offset > (size_t)(op - dst)))
+			goto malformed;
+		ref = op - offset;
+
+		length = token & ML_MASK;
+		if (length == ML_MASK && !lz4_read_length(&ip, iend, &length))
+			goto malformed;
+		length += LZ4_MINMATCH;
+		if (unlikely(length > (size_t)(oend - op)))
+			goto malformed;
+
+		if (offset >= length) {
+			memcpy(op, ref, length);
+			op += length;
+		} else {
+			/* overlapping copy repeats the last offset bytes */
+			while (length--)
+				*op++ = *ref++;
+		}
+	}
+
+	*in_used = ip - src;
+	*out_len = op - dst;
+	return 0;
+
+malformed:
+	return -1;
+}
+
+int lz4_decompress(const unsigned char *src, size_t *src_len,
+		unsigned char *dest, size_t actual_dest_len)
+{
+	size_t out_len;
+
+	if (lz4_uncompress(src, NULL, dest, actual_dest_len, src_len,
+			   &out_len) < 0 || out_len != actual_dest_len)
+		return -1;
+	return 0;
+}
+#ifndef STATIC
+EXPORT_SYMBOL(lz4_decompress);
+#endif
+
+int lz4_decompress_unknownoutputsize(const unsigned char *src, size_t src_len,
+		unsigned char *dest, size_t *dest_len)
+{
+	size_t in_used;
+
+	if (!src_len)
+		return -1;
+	return lz4_uncompress(src, src + src_len, dest, *dest_len, &in_used,
+			      dest_len);
+}
+#ifndef STATIC
+EXPORT_SYMBOL(lz4_decompress_unknownoutputsize);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 Decompressor");
+#endif
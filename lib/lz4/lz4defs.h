@@ -0,0 +1,133 @@
+/*
+ * lz4defs.h -- block format constants and encoding helpers shared by the
+ * LZ4 compressors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * Block format constants.  Every sequence is a token byte holding the
+ * literal run length in its high nibble and (match length - MINMATCH)
+ * in its low nibble, optional length extension bytes, the literals, a
+ * little-endian 16-bit match offset and optional match length bytes.
+ * The final sequence carries literals only.
+ */
+#define LZ4_MINMATCH		4
+#define LZ4_LASTLITERALS	5	/* last bytes are always literals */
+#define LZ4_MFLIMIT		(8 + LZ4_MINMATCH) /* last match start */
+#define LZ4_MIN_LENGTH		(LZ4_MFLIMIT + 1)
+
+#define LZ4_MAX_DISTANCE	65535
+#define LZ4_MAX_INPUT_SIZE	0x7E000000	/* offsets fit in a u32 */
+
+#define ML_BITS			4
+#define ML_MASK			((1U << ML_BITS) - 1)
+#define RUN_BITS		(8 - ML_BITS)
+#define RUN_MASK		((1U << RUN_BITS) - 1)
+
+/* Fast compressor: one-entry hash of 4-byte sequences */
+#define LZ4_HASH_LOG		12
+#define LZ4_HASH_SIZE		(1 << LZ4_HASH_LOG)
+/* search step grows by one for every 2^SKIP_STRENGTH failed probes */
+#define LZ4_SKIP_STRENGTH	6
+
+#define LZ4_STEPSIZE		sizeof(unsigned long)
+
+static inline u32 lz4_read32(const u8 *p)
+{
+	return get_unaligned((const u32 *)p);
+}
+
+/*
+ * Number of bytes that match at @ip and @ref, not looking at or
+ * beyond @limit.  Compares a word at a time.
+ */
+static inline size_t lz4_count(const u8 *ip, const u8 *ref, const u8 *limit)
+{
+	const u8 *start = ip;
+
+	while (likely(limit - ip >= (ptrdiff_t)LZ4_STEPSIZE)) {
+		unsigned long diff = get_unaligned((const unsigned long *)ref) ^
+				     get_unaligned((const unsigned long *)ip);
+		if (!diff) {
+			ip += LZ4_STEPSIZE;
+			ref += LZ4_STEPSIZE;
+			continue;
+		}
+#ifdef __LITTLE_ENDIAN
+		ip += __ffs(diff) >> 3;
+#else
+		ip += (BITS_PER_LONG - 1 - __fls(diff)) >> 3;
+#endif
+		return ip - start;
+	}
+
+	while (ip < limit && *ip == *ref) {
+		ip++;
+		ref++;
+	}
+	return ip - start;
+}
+
+static inline u8 *lz4_write_length(u8 *op, size_t len)
+{
+	for (; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = len;
+	return op;
+}
+
+/*
+ * Emit one sequence: @lit literals from @anchor followed by a match of
+ * @mlen + LZ4_MINMATCH bytes at distance @offset.  Returns the new
+ * output position, or NULL if the sequence might not fit before @oend.
+ */
+static inline u8 *lz4_encode_sequence(u8 *op, const u8 *oend,
+		const u8 *anchor, size_t lit, size_t offset, size_t mlen)
+{
+	u8 *token;
+
+	if (unlikely((size_t)(oend - op) <
+		     1 + lit + lit / 255 + 1 + 2 + mlen / 255 + 1))
+		return NULL;
+
+	token = op++;
+	if (lit >= RUN_MASK) {
+		*token = RUN_MASK << ML_BITS;
+		op = lz4_write_length(op, lit - RUN_MASK);
+	} else {
+		*token = lit << ML_BITS;
+	}
+	memcpy(op, anchor, lit);
+	op += lit;
+
+	put_unaligned_le16(offset, op);
+	op += 2;
+
+	if (mlen >= ML_MASK) {
+		*token |= ML_MASK;
+		op = lz4_write_length(op, mlen - ML_MASK);
+	} else {
+		*token |= mlen;
+	}
+	return op;
+}
+
+/* Emit the final, literal-only sequence.  Returns NULL on overflow. */
+static inline u8 *lz4_encode_last_literals(u8 *op, const u8 *oend,
+		const u8 *anchor, size_t lit)
+{
+	if (unlikely((size_t)(oend - op) < 1 + lit + lit / 255 + 1))
+		return NULL;
+
+	if (lit >= RUN_MASK) {
+		*op++ = RUN_MASK << ML_BITS;
+		op = lz4_write_length(op, lit - RUN_MASK);
+	} else {
+		*op++ = lit << ML_BITS;
+	}
+	memcpy(op, anchor, lit);
+	return op + lit;
+}
@@ -0,0 +1,161 @@
+/*
+ * LZ4 HC - High Compression Mode of LZ4, kernel implementation
+ *
+ * Produces the same block format as lz4_compress(), so it is read by
+ * the same decompressor, but finds longer matches by walking a hash
+ * chain of every earlier position in the 64KB window and by deferring
+ * a match by one byte when the next position matches better.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/bitops.h>
+#include <linux/lz4.h>
+#include <asm/unaligned.h>
+#include "lz4defs.h"
+
+#define LZ4HC_HASH_LOG		15
+#define LZ4HC_HASH_SIZE		(1 << LZ4HC_HASH_LOG)
+#define LZ4HC_MAXD		65536
+#define LZ4HC_MAXD_MASK		(LZ4HC_MAXD - 1)
+#define LZ4HC_MAX_ATTEMPTS	256
+
+struct lz4hc_data {
+	u32 hash_table[LZ4HC_HASH_SIZE];	/* last position per hash */
+	u16 chain_table[LZ4HC_MAXD];	/* distance to previous position */
+	u32 next_to_update;		/* first position not yet inserted */
+};
+
+static inline u32 lz4hc_hash(const u8 *p)
+{
+	return (lz4_read32(p) * 2654435761U) >> (32 - LZ4HC_HASH_LOG);
+}
+
+/* Insert all positions up to, but not including, @ip into the chains */
+static inline void lz4hc_insert(struct lz4hc_data *hc, const u8 *src,
+		const u8 *ip)
+{
+	u32 target = ip - src;
+
+	while (hc->next_to_update < target) {
+		u32 pos = hc->next_to_update++;
+		u32 h = lz4hc_hash(src + pos);
+		u32 delta = pos - hc->hash_table[h];
+
+		if (delta == 0 || delta > LZ4_MAX_DISTANCE)
+			delta = LZ4_MAX_DISTANCE;
+		hc->chain_table[pos & LZ4HC_MAXD_MASK] = delta;
+		hc->hash_table[h] = pos;
+	}
+}
+
+/*
+ * Return the length of the longest match for @ip in the window, and
+ * its position in @matchpos; 0 if there is no match of LZ4_MINMATCH.
+ */
+static size_t lz4hc_find_longest(struct lz4hc_data *hc, const u8 *src,
+		const u8 *ip, const u8 *matchlimit, const u8 **matchpos)
+{
+	u32 cur = ip - src;
+	u32 pos;
+	size_t best = 0;
+	int attempts = LZ4HC_MAX_ATTEMPTS;
+
+	lz4hc_insert(hc, src, ip);
+	pos = hc->hash_table[lz4hc_hash(ip)];
+
+	while (attempts-- && pos < cur && cur - pos <= LZ4_MAX_DISTANCE) {
+		const u8 *ref = src + pos;
+		u32 delta;
+
+		/* cheap test on the byte that would make this match longer */
+		if (ref[best] == ip[best] && lz4_read32(ref) == lz4_read32(ip)) {
+			size_t len = LZ4_MINMATCH +
+				lz4_count(ip + LZ4_MINMATCH,
+					  ref + LZ4_MINMATCH, matchlimit);
+			if (len > best) {
+				best = len;
+				*matchpos = ref;
+			}
+		}
+
+		delta = hc->chain_table[pos & LZ4HC_MAXD_MASK];
+		if (delta > pos)
+			break;
+		pos -= delta;
+	}
+
+	return best;
+}
+
+int lz4hc_compress(const unsigned char *src, size_t src_len,
+		unsigned char *dst, size_t *dst_len, void *wrkmem)
+{
+	struct lz4hc_data *hc = wrkmem;
+	const u8 *ip = src, *anchor = src;
+	const u8 *ref = NULL, *ref2 = NULL;
+	const u8 *const iend = src + src_len;
+	const u8 *const mflimit = iend - LZ4_MFLIMIT;
+	const u8 *const matchlimit = iend - LZ4_LASTLITERALS;
+	u8 *op = dst;
+	const u8 *const oend = dst + *dst_len;
+	size_t ml = 0, ml2;
+
+	BUILD_BUG_ON(sizeof(struct lz4hc_data) > LZ4HC_MEM_COMPRESS);
+
+	if (unlikely(src_len > LZ4_MAX_INPUT_SIZE))
+		return -1;
+
+	memset(hc->hash_table, 0, sizeof(hc->hash_table));
+	hc->next_to_update = 0;
+
+	if (src_len < LZ4_MIN_LENGTH)
+		goto last_literals;
+
+	while (ip <= mflimit) {
+		if (!ml)
+			ml = lz4hc_find_longest(hc, src, ip, matchlimit, &ref);
+		if (!ml) {
+			ip++;
+			continue;
+		}
+
+		/* Lazy matching: prefer a longer match one byte later */
+		if (ip + 1 <= mflimit) {
+			ml2 = lz4hc_find_longest(hc, src, ip + 1, matchlimit,
+						 &ref2);
+			if (ml2 > ml) {
+				ip++;
+				ml = ml2;
+				ref = ref2;
+				continue;
+			}
+		}
+
+		op = lz4_encode_sequence(op, oend, anchor, ip - anchor,
+					 ip - ref, ml - LZ4_MINMATCH);
+		if (unlikely(!op))
+			return -1;
+
+		ip += ml;
+		anchor = ip;
+		ml = 0;
+	}
+
+last_literals:
+	op = lz4_encode_last_literals(op, oend, anchor, iend - anchor);
+	if (unlikely(!op))
+		return -1;
+
+	*dst_len = op - dst;
+	return 0;
+}
+EXPORT_SYMBOL(lz4hc_compress);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4HC compressor");
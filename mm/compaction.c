@@ -228,6 +228,7 @@ isolate_migratepages_range(struct zone *zone, struct compact_control *cc,
 	struct list_head *migratelist = &cc->migratepages;
 	isolate_mode_t mode = 0;
 	struct lruvec *lruvec;
+	spinlock_t *lru_lock;
 
 	/*
 	 * Ensure that there are not too many pages isolated from the LRU
@@ -247,25 +248,33 @@ isolate_migratepages_range(struct zone *zone, struct compact_control *cc,
 
 	/* Time to isolate some pages for migration */
 	cond_resched();
-	spin_lock_irq(&zone->lru_lock);
+	lru_lock = zone_lru_lock(zone, pfn_lru_split(low_pfn));
+	spin_lock_irq(lru_lock);
 	for (; low_pfn < end_pfn; low_pfn++) {
 		struct page *page;
 		bool locked = true;
 
 		/* give a chance to irqs before checking need_resched() */
 		if (!((low_pfn+1) % SWAP_CLUSTER_MAX)) {
-			spin_unlock_irq(&zone->lru_lock);
+			spin_unlock_irq(lru_lock);
 			locked = false;
 		}
-		if (need_resched() || spin_is_contended(&zone->lru_lock)) {
+		/* each pageblock's pages live on a single lru sublist */
+		if (lru_lock != zone_lru_lock(zone, pfn_lru_split(low_pfn))) {
 			if (locked)
-				spin_unlock_irq(&zone->lru_lock);
+				spin_unlock_irq(lru_lock);
+			locked = false;
+			lru_lock = zone_lru_lock(zone, pfn_lru_split(low_pfn));
+		}
+		if (need_resched() || spin_is_contended(lru_lock)) {
+			if (locked)
+				spin_unlock_irq(lru_lock);
 			cond_resched();
-			spin_lock_irq(&zone->lru_lock);
+			spin_lock_irq(lru_lock);
 			if (fatal_signal_pending(current))
 				break;
 		} else if (!locked)
-			spin_lock_irq(&zone->lru_lock);
+			spin_lock_irq(lru_lock);
 
 		/*
 		 * migrate_pfn does not necessarily start aligned to a
@@ -316,7 +325,7 @@ isolate_migratepages_range(struct zone *zone, struct compact_control *cc,
 			continue;
 
 		/*
-		 * PageLRU is set, and lru_lock excludes isolation,
+		 * PageLRU is set, and the lru lock excludes isolation,
 		 * splitting and collapsing (collapsing has already
 		 * happened if PageLRU is set).
 		 */
@@ -351,7 +360,7 @@ isolate_migratepages_range(struct zone *zone, struct compact_control *cc,
 
 	acct_isolated(zone, cc);
 
-	spin_unlock_irq(&zone->lru_lock);
+	spin_unlock_irq(lru_lock);
 
 	trace_mm_compaction_isolate_migratepages(nr_scanned, nr_isolated);
 
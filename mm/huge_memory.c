@@ -17,6 +17,8 @@
 #include <linux/khugepaged.h>
 #include <linux/freezer.h>
 #include <linux/mman.h>
+#include <linux/shmem_fs.h>
+#include <linux/file.h>
 #include <asm/tlb.h>
 #include <asm/pgalloc.h>
 #include "internal.h"
@@ -317,6 +319,9 @@ static struct attribute *hugepage_attr[] = {
 	&defrag_attr.attr,
 #ifdef CONFIG_DEBUG_VM
 	&debug_cow_attr.attr,
+#endif
+#ifdef CONFIG_TRANSPARENT_HUGE_PAGECACHE
+	&shmem_enabled_attr.attr,
 #endif
 	NULL,
 };
@@ -750,6 +755,50 @@ out:
 	return handle_pte_fault(mm, vma, address, pte, pmd, flags);
 }
 
+/*
+ * Map a page cache extent with a huge pmd. @page is the first of
+ * HPAGE_PMD_NR physically contiguous small pages, naturally aligned
+ * both in the file and in memory, that the caller holds locked and
+ * referenced. On success the references belong to the mapping.
+ * VM_FAULT_FALLBACK is returned if the pmd was populated meanwhile.
+ */
+int do_huge_pmd_file_page(struct vm_area_struct *vma, unsigned long address,
+			  pmd_t *pmd, struct page *page, unsigned int flags)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	pgtable_t pgtable;
+	pmd_t entry;
+	int i;
+
+	VM_BUG_ON(PageCompound(page) || PageAnon(page));
+	VM_BUG_ON(page_to_pfn(page) & (HPAGE_PMD_NR - 1));
+	pgtable = pte_alloc_one(mm, haddr);
+	if (unlikely(!pgtable))
+		return VM_FAULT_OOM;
+
+	spin_lock(&mm->page_table_lock);
+	if (unlikely(!pmd_none(*pmd))) {
+		spin_unlock(&mm->page_table_lock);
+		pte_free(mm, pgtable);
+		return VM_FAULT_FALLBACK;
+	}
+	entry = mk_pmd(page, vma->vm_page_prot);
+	if (flags & FAULT_FLAG_WRITE)
+		entry = maybe_pmd_mkwrite(pmd_mkdirty(entry), vma);
+	entry = pmd_mkhuge(pmd_mkyoung(entry));
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		page_add_file_rmap(page + i);
+	set_pmd_at(mm, haddr, pmd, entry);
+	prepare_pmd_huge_pte(pgtable, mm);
+	add_mm_counter(mm, MM_FILEPAGES, HPAGE_PMD_NR);
+	mm->nr_ptes++;
+	spin_unlock(&mm->page_table_lock);
+	count_vm_event(THP_FILE_MAPPED);
+
+	return 0;
+}
+
 int copy_huge_pmd(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 		  pmd_t *dst_pmd, pmd_t *src_pmd, unsigned long addr,
 		  struct vm_area_struct *vma)
@@ -783,6 +832,12 @@ int copy_huge_pmd(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 		goto out;
 	}
 	src_page = pmd_page(pmd);
+	if (!PageAnon(src_page)) {
+		/* shared page cache extents are refaulted by the child */
+		pte_free(dst_mm, pgtable);
+		ret = 0;
+		goto out_unlock;
+	}
 	VM_BUG_ON(!PageHead(src_page));
 	get_page(src_page);
 	page_dup_rmap(src_page);
@@ -1010,7 +1065,7 @@ struct page *follow_trans_huge_pmd(struct mm_struct *mm,
 		goto out;
 
 	page = pmd_page(*pmd);
-	VM_BUG_ON(!PageHead(page));
+	VM_BUG_ON(PageAnon(page) && !PageHead(page));
 	if (flags & FOLL_TOUCH) {
 		pmd_t _pmd;
 		/*
@@ -1025,7 +1080,7 @@ struct page *follow_trans_huge_pmd(struct mm_struct *mm,
 		set_pmd_at(mm, addr & HPAGE_PMD_MASK, pmd, _pmd);
 	}
 	page += (addr & ~HPAGE_PMD_MASK) >> PAGE_SHIFT;
-	VM_BUG_ON(!PageCompound(page));
+	VM_BUG_ON(PageAnon(page) && !PageCompound(page));
 	if (flags & FOLL_GET)
 		get_page_foll(page);
 
@@ -1033,6 +1088,40 @@ out:
 	return page;
 }
 
+/*
+ * The small pages of a page cache extent are refcounted and mapcounted
+ * one by one, so they are released like HPAGE_PMD_NR ptes would be.
+ */
+static void zap_huge_file_pmd(struct mmu_gather *tlb,
+			      struct vm_area_struct *vma,
+			      pmd_t *pmd, unsigned long addr,
+			      pgtable_t pgtable)
+{
+	struct mm_struct *mm = tlb->mm;
+	struct page *page;
+	pmd_t orig_pmd;
+	int i;
+
+	orig_pmd = pmdp_get_and_clear(mm, addr, pmd);
+	tlb_remove_pmd_tlb_entry(tlb, pmd, addr);
+	page = pmd_page(orig_pmd);
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		if (pmd_dirty(orig_pmd))
+			set_page_dirty(page + i);
+		if (pmd_young(orig_pmd) &&
+		    likely(!VM_SequentialReadHint(vma)))
+			mark_page_accessed(page + i);
+		page_remove_rmap(page + i);
+		VM_BUG_ON(page_mapcount(page + i) < 0);
+	}
+	add_mm_counter(mm, MM_FILEPAGES, -HPAGE_PMD_NR);
+	mm->nr_ptes--;
+	spin_unlock(&mm->page_table_lock);
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		tlb_remove_page(tlb, page + i);
+	pte_free(mm, pgtable);
+}
+
 int zap_huge_pmd(struct mmu_gather *tlb, struct vm_area_struct *vma,
 		 pmd_t *pmd, unsigned long addr)
 {
@@ -1043,6 +1132,10 @@ int zap_huge_pmd(struct mmu_gather *tlb, struct vm_area_struct *vma,
 		pgtable_t pgtable;
 		pgtable = get_pmd_huge_pte(tlb->mm);
 		page = pmd_page(*pmd);
+		if (!PageAnon(page)) {
+			zap_huge_file_pmd(tlb, vma, pmd, addr, pgtable);
+			return 1;
+		}
 		pmd_clear(pmd);
 		tlb_remove_pmd_tlb_entry(tlb, pmd, addr);
 		page_remove_rmap(page);
@@ -1086,6 +1179,7 @@ int move_huge_pmd(struct vm_area_struct *vma, struct vm_area_struct *new_vma,
 	pmd_t pmd;
 
 	struct mm_struct *mm = vma->vm_mm;
+	struct address_space *mapping = NULL;
 
 	if ((old_addr & ~HPAGE_PMD_MASK) ||
 	    (new_addr & ~HPAGE_PMD_MASK) ||
@@ -1102,6 +1196,11 @@ int move_huge_pmd(struct vm_area_struct *vma, struct vm_area_struct *new_vma,
 		goto out;
 	}
 
+	/* a page cache pmd must not slip past truncation, see move_ptes() */
+	if (vma->vm_file) {
+		mapping = vma->vm_file->f_mapping;
+		mutex_lock(&mapping->i_mmap_mutex);
+	}
 	ret = __pmd_trans_huge_lock(old_pmd, vma);
 	if (ret == 1) {
 		pmd = pmdp_get_and_clear(mm, old_addr, old_pmd);
@@ -1109,6 +1208,8 @@ int move_huge_pmd(struct vm_area_struct *vma, struct vm_area_struct *new_vma,
 		set_pmd_at(mm, new_addr, new_pmd, pmd);
 		spin_unlock(&mm->page_table_lock);
 	}
+	if (mapping)
+		mutex_unlock(&mapping->i_mmap_mutex);
 out:
 	return ret;
 }
@@ -1235,7 +1336,7 @@ static void __split_huge_page_refcount(struct page *page)
 	int tail_count = 0;
 
 	/* prevent PageLRU to go away from under us, and freeze lru stats */
-	spin_lock_irq(&zone->lru_lock);
+	spin_lock_irq(page_lru_lock(page));
 	lruvec = mem_cgroup_page_lruvec(page, zone);
 
 	compound_lock(page);
@@ -1322,7 +1423,7 @@ static void __split_huge_page_refcount(struct page *page)
 
 	ClearPageCompound(page);
 	compound_unlock(page);
-	spin_unlock_irq(&zone->lru_lock);
+	spin_unlock_irq(page_lru_lock(page));
 
 	for (i = 1; i < HPAGE_PMD_NR; i++) {
 		struct page *page_tail = page + i;
@@ -1494,6 +1595,14 @@ out:
 #define VM_NO_THP (VM_SPECIAL|VM_INSERTPAGE|VM_MIXEDMAP|VM_SAO| \
 		   VM_HUGETLB|VM_SHARED|VM_MAYSHARE)
 
+/* shared page cache is mapped by huge pmds through ->pmd_fault */
+static inline unsigned long vma_no_thp_flags(struct vm_area_struct *vma)
+{
+	if (vma->vm_ops && vma->vm_ops->pmd_fault)
+		return VM_NO_THP & ~(VM_SHARED|VM_MAYSHARE);
+	return VM_NO_THP;
+}
+
 int hugepage_madvise(struct vm_area_struct *vma,
 		     unsigned long *vm_flags, int advice)
 {
@@ -1502,7 +1611,7 @@ int hugepage_madvise(struct vm_area_struct *vma,
 		/*
 		 * Be somewhat over-protective like KSM for now!
 		 */
-		if (*vm_flags & (VM_HUGEPAGE | VM_NO_THP))
+		if (*vm_flags & (VM_HUGEPAGE | vma_no_thp_flags(vma)))
 			return -EINVAL;
 		*vm_flags &= ~VM_NOHUGEPAGE;
 		*vm_flags |= VM_HUGEPAGE;
@@ -1518,7 +1627,7 @@ int hugepage_madvise(struct vm_area_struct *vma,
 		/*
 		 * Be somewhat over-protective like KSM for now!
 		 */
-		if (*vm_flags & (VM_NOHUGEPAGE | VM_NO_THP))
+		if (*vm_flags & (VM_NOHUGEPAGE | vma_no_thp_flags(vma)))
 			return -EINVAL;
 		*vm_flags &= ~VM_HUGEPAGE;
 		*vm_flags |= VM_NOHUGEPAGE;
@@ -1646,25 +1755,35 @@ int __khugepaged_enter(struct mm_struct *mm)
 int khugepaged_enter_vma_merge(struct vm_area_struct *vma)
 {
 	unsigned long hstart, hend;
-	if (!vma->anon_vma)
+	if (vma->vm_ops) {
+		/*
+		 * khugepaged only works on the page cache that the
+		 * filesystem lets it collapse, with its own policy.
+		 */
+		if (!shmem_huge_enabled(vma))
+			return 0;
+	} else if (!vma->anon_vma)
 		/*
 		 * Not yet faulted in so we will register later in the
 		 * page fault if needed.
 		 */
 		return 0;
-	if (vma->vm_ops)
-		/* khugepaged not yet working on file or special mappings */
-		return 0;
 	/*
 	 * If is_pfn_mapping() is true is_learn_pfn_mapping() must be
 	 * true too, verify it here.
 	 */
-	VM_BUG_ON(is_linear_pfn_mapping(vma) || vma->vm_flags & VM_NO_THP);
+	VM_BUG_ON(is_linear_pfn_mapping(vma) ||
+		  vma->vm_flags & vma_no_thp_flags(vma));
 	hstart = (vma->vm_start + ~HPAGE_PMD_MASK) & HPAGE_PMD_MASK;
 	hend = vma->vm_end & HPAGE_PMD_MASK;
-	if (hstart < hend)
-		return khugepaged_enter(vma);
-	return 0;
+	if (hstart >= hend)
+		return 0;
+	if (vma->vm_ops) {
+		if (!test_bit(MMF_VM_HUGEPAGE, &vma->vm_mm->flags))
+			return __khugepaged_enter(vma->vm_mm);
+		return 0;
+	}
+	return khugepaged_enter(vma);
 }
 
 void __khugepaged_exit(struct mm_struct *mm)
@@ -1932,6 +2051,8 @@ static void collapse_huge_page(struct mm_struct *mm,
 	if (!pmd_present(*pmd) || pmd_trans_huge(*pmd))
 		goto out;
 
+	/* Speculative page faults must not use the old page table */
+	vma_write_begin(vma);
 	anon_vma_lock(vma->anon_vma);
 
 	pte = pte_offset_map(pmd, address);
@@ -1958,6 +2079,7 @@ static void collapse_huge_page(struct mm_struct *mm,
 		set_pmd_at(mm, address, pmd, _pmd);
 		spin_unlock(&mm->page_table_lock);
 		anon_vma_unlock(vma->anon_vma);
+		vma_write_end(vma);
 		goto out;
 	}
 
@@ -1992,6 +2114,7 @@ static void collapse_huge_page(struct mm_struct *mm,
 	update_mmu_cache(vma, address, _pmd);
 	prepare_pmd_huge_pte(pgtable, mm);
 	spin_unlock(&mm->page_table_lock);
+	vma_write_end(vma);
 
 #ifndef CONFIG_NUMA
 	*hpage = NULL;
@@ -2081,6 +2204,105 @@ out:
 	return ret;
 }
 
+static pmd_t *khugepaged_file_pmd(struct mm_struct *mm, unsigned long address)
+{
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+
+	pgd = pgd_offset(mm, address);
+	if (!pgd_present(*pgd))
+		return NULL;
+
+	pud = pud_offset(pgd, address);
+	if (!pud_present(*pud))
+		return NULL;
+
+	pmd = pmd_offset(pud, address);
+	if (!pmd_present(*pmd) || pmd_trans_huge(*pmd))
+		return NULL;
+	return pmd;
+}
+
+/*
+ * The page cache extent behind @address is contiguous now: free the
+ * page table mapping it, so that the next fault maps a huge pmd.
+ */
+static void retract_file_pmd(struct mm_struct *mm, struct file *file,
+			     unsigned long address)
+{
+	struct address_space *mapping = file->f_mapping;
+	struct vm_area_struct *vma;
+	pgtable_t pgtable = NULL;
+	pmd_t *pmd, _pmd;
+	pte_t *pte;
+	int i;
+
+	down_write(&mm->mmap_sem);
+	if (unlikely(khugepaged_test_exit(mm)))
+		goto out;
+	vma = find_vma(mm, address);
+	if (!vma || vma->vm_file != file || address < vma->vm_start ||
+	    address + HPAGE_PMD_SIZE > vma->vm_end ||
+	    linear_page_index(vma, address) & (HPAGE_PMD_NR - 1) ||
+	    !shmem_huge_enabled(vma))
+		goto out;
+	pmd = khugepaged_file_pmd(mm, address);
+	if (!pmd)
+		goto out;
+
+	vma_write_begin(vma);
+	zap_page_range(vma, address, HPAGE_PMD_SIZE, NULL);
+
+	/* rmap walkers may look at the page table until we take this */
+	mutex_lock(&mapping->i_mmap_mutex);
+	spin_lock(&mm->page_table_lock);
+	pte = pte_offset_map(pmd, address);
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		if (!pte_none(pte[i]))
+			break;
+	pte_unmap(pte);
+	if (i == HPAGE_PMD_NR) {
+		_pmd = pmdp_clear_flush(vma, address, pmd);
+		pgtable = pmd_pgtable(_pmd);
+		mm->nr_ptes--;
+	}
+	spin_unlock(&mm->page_table_lock);
+	mutex_unlock(&mapping->i_mmap_mutex);
+	vma_write_end(vma);
+	if (pgtable) {
+		pte_free(mm, pgtable);
+		khugepaged_pages_collapsed++;
+	}
+out:
+	up_write(&mm->mmap_sem);
+}
+
+/*
+ * Page cache counterpart of khugepaged_scan_pmd(): the extent is
+ * collapsed in the page cache, without the mmap_sem, by the
+ * filesystem. Returns 1 if the mmap_sem was released.
+ */
+static int khugepaged_scan_file(struct mm_struct *mm,
+				struct vm_area_struct *vma,
+				unsigned long address)
+{
+	struct file *file = vma->vm_file;
+	pgoff_t index = linear_page_index(vma, address);
+
+	if (index & (HPAGE_PMD_NR - 1))
+		return 0;
+	if (!khugepaged_file_pmd(mm, address))
+		return 0;
+
+	get_file(file);
+	up_read(&mm->mmap_sem);
+	if (!shmem_collapse_extent(file->f_mapping, index))
+		retract_file_pmd(mm, file, address);
+	fput(file);
+	return 1;
+}
+
 static void collect_mm_slot(struct mm_slot *mm_slot)
 {
 	struct mm_struct *mm = mm_slot->mm;
@@ -2137,6 +2359,7 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 	progress++;
 	for (; vma; vma = vma->vm_next) {
 		unsigned long hstart, hend;
+		bool file;
 
 		cond_resched();
 		if (unlikely(khugepaged_test_exit(mm))) {
@@ -2144,14 +2367,16 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 			break;
 		}
 
-		if ((!(vma->vm_flags & VM_HUGEPAGE) &&
-		     !khugepaged_always()) ||
-		    (vma->vm_flags & VM_NOHUGEPAGE)) {
+		/* page cache follows the policy of its filesystem */
+		file = vma->vm_ops && shmem_huge_enabled(vma);
+		if (!file && ((!(vma->vm_flags & VM_HUGEPAGE) &&
+			       !khugepaged_always()) ||
+			      (vma->vm_flags & VM_NOHUGEPAGE))) {
 		skip:
 			progress++;
 			continue;
 		}
-		if (!vma->anon_vma || vma->vm_ops)
+		if (!file && (!vma->anon_vma || vma->vm_ops))
 			goto skip;
 		if (is_vma_temporary_stack(vma))
 			goto skip;
@@ -2160,7 +2385,7 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 		 * must be true too, verify it here.
 		 */
 		VM_BUG_ON(is_linear_pfn_mapping(vma) ||
-			  vma->vm_flags & VM_NO_THP);
+			  vma->vm_flags & vma_no_thp_flags(vma));
 
 		hstart = (vma->vm_start + ~HPAGE_PMD_MASK) & HPAGE_PMD_MASK;
 		hend = vma->vm_end & HPAGE_PMD_MASK;
@@ -2181,9 +2406,13 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 			VM_BUG_ON(khugepaged_scan.address < hstart ||
 				  khugepaged_scan.address + HPAGE_PMD_SIZE >
 				  hend);
-			ret = khugepaged_scan_pmd(mm, vma,
-						  khugepaged_scan.address,
-						  hpage);
+			if (file)
+				ret = khugepaged_scan_file(mm, vma,
+						khugepaged_scan.address);
+			else
+				ret = khugepaged_scan_pmd(mm, vma,
+						khugepaged_scan.address,
+						hpage);
 			/* move to next address */
 			khugepaged_scan.address += HPAGE_PMD_SIZE;
 			progress += HPAGE_PMD_NR;
@@ -2376,8 +2605,67 @@ static int khugepaged(void *none)
 	return 0;
 }
 
-void __split_huge_page_pmd(struct mm_struct *mm, pmd_t *pmd)
+/*
+ * A page cache extent is made of small pages already, so only the
+ * mapping has to be split: the deposited page table is filled with
+ * ptes equivalent to the huge pmd and put in place. Nothing but the
+ * page_table_lock is needed, which lets reclaim and truncation split
+ * under the i_mmap_mutex. Called with the page_table_lock held.
+ */
+static void __split_huge_file_pmd(struct vm_area_struct *vma,
+				  unsigned long haddr, pmd_t *pmd)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	struct page *page;
+	pgtable_t pgtable;
+	pmd_t _pmd, orig_pmd;
+	int i;
+
+	orig_pmd = *pmd;
+	page = pmd_page(orig_pmd);
+	pgtable = get_pmd_huge_pte(mm);
+	pmd_populate(mm, &_pmd, pgtable);
+
+	/*
+	 * Never let small and huge TLB entries coexist, see
+	 * __split_huge_page_map(). The pmd stays trans huge, so
+	 * lockless walkers wait on the page_table_lock instead of
+	 * seeing a hole.
+	 */
+	set_pmd_at(mm, haddr, pmd, pmd_mknotpresent(orig_pmd));
+	flush_tlb_range(vma, haddr, haddr + HPAGE_PMD_SIZE);
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		unsigned long address = haddr + i * PAGE_SIZE;
+		pte_t *pte, entry;
+
+		entry = mk_pte(page + i, vma->vm_page_prot);
+		if (pmd_write(orig_pmd))
+			entry = pte_mkwrite(entry);
+		else
+			entry = pte_wrprotect(entry);
+		/*
+		 * The cpu may have dirtied a writable pmd after we read
+		 * it and before it went not present: assume it did.
+		 */
+		if (pmd_dirty(orig_pmd) || pmd_write(orig_pmd))
+			entry = pte_mkdirty(entry);
+		if (!pmd_young(orig_pmd))
+			entry = pte_mkold(entry);
+		pte = pte_offset_map(&_pmd, address);
+		BUG_ON(!pte_none(*pte));
+		set_pte_at(mm, address, pte, entry);
+		pte_unmap(pte);
+	}
+
+	smp_wmb(); /* make pte visible before pmd */
+	pmd_populate(mm, pmd, pgtable);
+}
+
+void __split_huge_page_pmd(struct vm_area_struct *vma, unsigned long address,
+			   pmd_t *pmd)
 {
+	struct mm_struct *mm = vma->vm_mm;
 	struct page *page;
 
 	spin_lock(&mm->page_table_lock);
@@ -2386,6 +2674,11 @@ void __split_huge_page_pmd(struct mm_struct *mm, pmd_t *pmd)
 		return;
 	}
 	page = pmd_page(*pmd);
+	if (!PageAnon(page)) {
+		__split_huge_file_pmd(vma, address & HPAGE_PMD_MASK, pmd);
+		spin_unlock(&mm->page_table_lock);
+		return;
+	}
 	VM_BUG_ON(!page_count(page));
 	get_page(page);
 	spin_unlock(&mm->page_table_lock);
@@ -2396,7 +2689,76 @@ void __split_huge_page_pmd(struct mm_struct *mm, pmd_t *pmd)
 	BUG_ON(pmd_trans_huge(*pmd));
 }
 
-static void split_huge_page_address(struct mm_struct *mm,
+void split_huge_page_pmd_mm(struct mm_struct *mm, unsigned long address,
+			    pmd_t *pmd)
+{
+	struct vm_area_struct *vma;
+
+	if (likely(!pmd_trans_huge(*pmd)))
+		return;
+	vma = find_vma(mm, address);
+	BUG_ON(vma == NULL);
+	split_huge_page_pmd(vma, address, pmd);
+}
+
+static pmd_t *huge_pmd_address(struct mm_struct *mm, unsigned long address)
+{
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+
+	pgd = pgd_offset(mm, address);
+	if (!pgd_present(*pgd))
+		return NULL;
+
+	pud = pud_offset(pgd, address);
+	if (!pud_present(*pud))
+		return NULL;
+
+	pmd = pmd_offset(pud, address);
+	if (!pmd_trans_huge(*pmd))
+		return NULL;
+	return pmd;
+}
+
+/*
+ * Returns the huge pmd mapping the page cache page at @address, with
+ * the page_table_lock held, or NULL.
+ */
+pmd_t *page_check_address_file_pmd(struct page *page, struct mm_struct *mm,
+				   unsigned long address)
+{
+	unsigned long offset = (address & ~HPAGE_PMD_MASK) >> PAGE_SHIFT;
+	pmd_t *pmd;
+
+	pmd = huge_pmd_address(mm, address);
+	if (!pmd)
+		return NULL;
+	spin_lock(&mm->page_table_lock);
+	if (pmd_trans_huge(*pmd) &&
+	    page_to_pfn(pmd_page(*pmd)) + offset == page_to_pfn(page))
+		return pmd;
+	spin_unlock(&mm->page_table_lock);
+	return NULL;
+}
+
+/*
+ * Split the page cache pmd covering @address so the rmap walkers see
+ * the ptes they expect. Called under the i_mmap_mutex, possibly
+ * without the mmap_sem, which is fine as only the page_table_lock is
+ * needed; the pmd is rechecked under it.
+ */
+void split_file_huge_pmd_address(struct vm_area_struct *vma,
+				 unsigned long address)
+{
+	pmd_t *pmd;
+
+	pmd = huge_pmd_address(vma->vm_mm, address);
+	if (pmd && !PageAnon(pmd_page(*pmd)))
+		__split_huge_page_pmd(vma, address, pmd);
+}
+
+static void split_huge_page_address(struct vm_area_struct *vma,
 				    unsigned long address)
 {
 	pgd_t *pgd;
@@ -2405,7 +2767,7 @@ static void split_huge_page_address(struct mm_struct *mm,
 
 	VM_BUG_ON(!(address & ~HPAGE_PMD_MASK));
 
-	pgd = pgd_offset(mm, address);
+	pgd = pgd_offset(vma->vm_mm, address);
 	if (!pgd_present(*pgd))
 		return;
 
@@ -2420,7 +2782,7 @@ static void split_huge_page_address(struct mm_struct *mm,
 	 * Caller holds the mmap_sem write mode, so a huge pmd cannot
 	 * materialize from under us.
 	 */
-	split_huge_page_pmd(mm, pmd);
+	split_huge_page_pmd(vma, address, pmd);
 }
 
 void __vma_adjust_trans_huge(struct vm_area_struct *vma,
@@ -2436,7 +2798,7 @@ void __vma_adjust_trans_huge(struct vm_area_struct *vma,
 	if (start & ~HPAGE_PMD_MASK &&
 	    (start & HPAGE_PMD_MASK) >= vma->vm_start &&
 	    (start & HPAGE_PMD_MASK) + HPAGE_PMD_SIZE <= vma->vm_end)
-		split_huge_page_address(vma->vm_mm, start);
+		split_huge_page_address(vma, start);
 
 	/*
 	 * If the new end address isn't hpage aligned and it could
@@ -2446,7 +2808,7 @@ void __vma_adjust_trans_huge(struct vm_area_struct *vma,
 	if (end & ~HPAGE_PMD_MASK &&
 	    (end & HPAGE_PMD_MASK) >= vma->vm_start &&
 	    (end & HPAGE_PMD_MASK) + HPAGE_PMD_SIZE <= vma->vm_end)
-		split_huge_page_address(vma->vm_mm, end);
+		split_huge_page_address(vma, end);
 
 	/*
 	 * If we're also updating the vma->vm_next->vm_start, if the new
@@ -2460,6 +2822,6 @@ void __vma_adjust_trans_huge(struct vm_area_struct *vma,
 		if (nstart & ~HPAGE_PMD_MASK &&
 		    (nstart & HPAGE_PMD_MASK) >= next->vm_start &&
 		    (nstart & HPAGE_PMD_MASK) + HPAGE_PMD_SIZE <= next->vm_end)
-			split_huge_page_address(next->vm_mm, nstart);
+			split_huge_page_address(next, nstart);
 	}
 }
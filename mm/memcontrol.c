@@ -32,6 +32,7 @@
 #include <linux/backing-dev.h>
 #include <linux/bit_spinlock.h>
 #include <linux/rcupdate.h>
+#include <linux/srcu.h>
 #include <linux/limits.h>
 #include <linux/export.h>
 #include <linux/mutex.h>
@@ -148,7 +149,8 @@ struct mem_cgroup_reclaim_iter {
  */
 struct mem_cgroup_per_zone {
 	struct lruvec		lruvec;
-	unsigned long		lru_size[NR_LRU_LISTS];
+	/* per LRU sublist, each updated under its sublist's lock */
+	unsigned long		lru_size[NR_LRU_SPLIT][NR_LRU_LISTS];
 
 	struct mem_cgroup_reclaim_iter reclaim_iter[DEF_PRIORITY + 1];
 
@@ -329,6 +331,22 @@ struct mem_cgroup {
 #ifdef CONFIG_INET
 	struct tcp_memcontrol tcp_mem;
 #endif
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+	/*
+	 * the counter to account for kernel memory (slab, stacks, page
+	 * tables). Kernel memory is charged to res and memsw as well.
+	 */
+	struct res_counter kmem;
+	/*
+	 * kmem accounting starts when a kmem limit is set for the first
+	 * time, and kmemcg_id is the index in the root caches'
+	 * memcg_caches arrays from then on.
+	 */
+	bool kmem_active;
+	int kmemcg_id;
+	/* slab caches created for this cgroup, protected by memcg_cache_mutex */
+	struct list_head memcg_slab_caches;
+#endif
 };
 
 /* Stuffs for move charges at task migration. */
@@ -390,6 +408,7 @@ enum charge_type {
 #define _MEM			(0)
 #define _MEMSWAP		(1)
 #define _OOM_TYPE		(2)
+#define _KMEM			(3)
 #define MEMFILE_PRIVATE(x, val)	((x) << 16 | (val))
 #define MEMFILE_TYPE(val)	((val) >> 16 & 0xffff)
 #define MEMFILE_ATTR(val)	((val) & 0xffff)
@@ -755,9 +774,13 @@ unsigned long
 mem_cgroup_get_lru_size(struct lruvec *lruvec, enum lru_list lru)
 {
 	struct mem_cgroup_per_zone *mz;
+	unsigned long ret = 0;
+	int split;
 
 	mz = container_of(lruvec, struct mem_cgroup_per_zone, lruvec);
-	return mz->lru_size[lru];
+	for_each_lru_split(split)
+		ret += mz->lru_size[split][lru];
+	return ret;
 }
 
 static unsigned long
@@ -772,7 +795,7 @@ mem_cgroup_zone_nr_lru_pages(struct mem_cgroup *memcg, int nid, int zid,
 
 	for_each_lru(lru) {
 		if (BIT(lru) & lru_mask)
-			ret += mz->lru_size[lru];
+			ret += mem_cgroup_get_lru_size(&mz->lruvec, lru);
 	}
 	return ret;
 }
@@ -1104,7 +1127,7 @@ struct lruvec *mem_cgroup_page_lruvec(struct page *page, struct zone *zone)
 	 * an uncharged page off lru does nothing to secure
 	 * its former mem_cgroup from sudden removal.
 	 *
-	 * Our caller holds lru_lock, and PageCgroupUsed is updated
+	 * Our caller holds the lru sublist lock, and PageCgroupUsed is updated
 	 * under page_cgroup lock: between them, they make all uses
 	 * of pc->mem_cgroup safe.
 	 */
@@ -1118,14 +1141,15 @@ struct lruvec *mem_cgroup_page_lruvec(struct page *page, struct zone *zone)
 /**
  * mem_cgroup_update_lru_size - account for adding or removing an lru page
  * @lruvec: mem_cgroup per zone lru vector
+ * @split: index of the lru sublist the page is sitting on
  * @lru: index of lru list the page is sitting on
  * @nr_pages: positive when adding or negative when removing
  *
  * This function must be called when a page is added to or removed from an
  * lru list.
  */
-void mem_cgroup_update_lru_size(struct lruvec *lruvec, enum lru_list lru,
-				int nr_pages)
+void mem_cgroup_update_lru_size(struct lruvec *lruvec, int split,
+				enum lru_list lru, int nr_pages)
 {
 	struct mem_cgroup_per_zone *mz;
 	unsigned long *lru_size;
@@ -1134,7 +1158,7 @@ void mem_cgroup_update_lru_size(struct lruvec *lruvec, enum lru_list lru,
 		return;
 
 	mz = container_of(lruvec, struct mem_cgroup_per_zone, lruvec);
-	lru_size = mz->lru_size + lru;
+	lru_size = &mz->lru_size[split][lru];
 	*lru_size += nr_pages;
 	VM_BUG_ON((long)(*lru_size) < 0);
 }
@@ -2489,7 +2513,7 @@ static void __mem_cgroup_commit_charge(struct mem_cgroup *memcg,
 	 */
 	if (lrucare) {
 		zone = page_zone(page);
-		spin_lock_irq(&zone->lru_lock);
+		spin_lock_irq(page_lru_lock(page));
 		if (PageLRU(page)) {
 			lruvec = mem_cgroup_zone_lruvec(zone, pc->mem_cgroup);
 			ClearPageLRU(page);
@@ -2516,7 +2540,7 @@ static void __mem_cgroup_commit_charge(struct mem_cgroup *memcg,
 			SetPageLRU(page);
 			add_page_to_lru_list(page, lruvec, page_lru(page));
 		}
-		spin_unlock_irq(&zone->lru_lock);
+		spin_unlock_irq(page_lru_lock(page));
 	}
 
 	if (ctype == MEM_CGROUP_CHARGE_TYPE_MAPPED)
@@ -2540,7 +2564,7 @@ static void __mem_cgroup_commit_charge(struct mem_cgroup *memcg,
 #define PCGF_NOCOPY_AT_SPLIT (1 << PCG_LOCK | 1 << PCG_MIGRATION)
 /*
  * Because tail pages are not marked as "used", set it. We're under
- * zone->lru_lock, 'splitting on pmd' and compound_lock.
+ * the page's lru sublist lock, 'splitting on pmd' and compound_lock.
  * charge/uncharge will be never happen and move_account() is done under
  * compound_lock(), so we don't have to take care of races.
  */
@@ -3614,21 +3638,23 @@ unsigned long mem_cgroup_soft_limit_reclaim(struct zone *zone, int order,
  * This routine traverse page_cgroup in given list and drop them all.
  * *And* this routine doesn't reclaim page itself, just removes page_cgroup.
  */
-static int mem_cgroup_force_empty_list(struct mem_cgroup *memcg,
-				int node, int zid, enum lru_list lru)
+static int mem_cgroup_force_empty_split(struct mem_cgroup *memcg,
+				int node, int zid, int split, enum lru_list lru)
 {
 	struct mem_cgroup_per_zone *mz;
 	unsigned long flags, loop;
 	struct list_head *list;
+	spinlock_t *lru_lock;
 	struct page *busy;
 	struct zone *zone;
 	int ret = 0;
 
 	zone = &NODE_DATA(node)->node_zones[zid];
+	lru_lock = zone_lru_lock(zone, split);
 	mz = mem_cgroup_zoneinfo(memcg, node, zid);
-	list = &mz->lruvec.lists[lru];
+	list = lruvec_list(&mz->lruvec, split, lru);
 
-	loop = mz->lru_size[lru];
+	loop = mz->lru_size[split][lru];
 	/* give some margin against EBUSY etc...*/
 	loop += 256;
 	busy = NULL;
@@ -3637,19 +3663,19 @@ static int mem_cgroup_force_empty_list(struct mem_cgroup *memcg,
 		struct page *page;
 
 		ret = 0;
-		spin_lock_irqsave(&zone->lru_lock, flags);
+		spin_lock_irqsave(lru_lock, flags);
 		if (list_empty(list)) {
-			spin_unlock_irqrestore(&zone->lru_lock, flags);
+			spin_unlock_irqrestore(lru_lock, flags);
 			break;
 		}
 		page = list_entry(list->prev, struct page, lru);
 		if (busy == page) {
 			list_move(&page->lru, list);
 			busy = NULL;
-			spin_unlock_irqrestore(&zone->lru_lock, flags);
+			spin_unlock_irqrestore(lru_lock, flags);
 			continue;
 		}
-		spin_unlock_irqrestore(&zone->lru_lock, flags);
+		spin_unlock_irqrestore(lru_lock, flags);
 
 		pc = lookup_page_cgroup(page);
 
@@ -3670,10 +3696,680 @@ static int mem_cgroup_force_empty_list(struct mem_cgroup *memcg,
 	return ret;
 }
 
+static int mem_cgroup_force_empty_list(struct mem_cgroup *memcg,
+				int node, int zid, enum lru_list lru)
+{
+	int split, ret = 0;
+
+	for_each_lru_split(split) {
+		ret = mem_cgroup_force_empty_split(memcg, node, zid,
+						   split, lru);
+		if (ret)
+			break;
+	}
+	return ret;
+}
+
 /*
  * make mem_cgroup's charge to be 0 if there is no task.
  * This enables deleting this mem_cgroup.
  */
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+/*
+ * Kernel memory accounting.
+ *
+ * Once a kmem limit is set, pages allocated with __GFP_KMEMCG (kernel
+ * stacks, page tables) and the slab pages of per-memcg copies of the
+ * SLAB_ACCOUNT caches are charged to the current task's cgroup: to the
+ * kmem counter and, like user pages, to res (and memsw). The memcg a
+ * page was charged to is recorded in its page_cgroup.
+ */
+struct static_key memcg_kmem_enabled_key;
+EXPORT_SYMBOL(memcg_kmem_enabled_key);
+
+/*
+ * The root caches' memcg_caches arrays start small and are doubled
+ * whenever a new kmemcg_id does not fit; ids are never larger than
+ * MEMCG_CACHES_MAX_SIZE.
+ */
+#define MEMCG_CACHES_MIN_SIZE 4
+#define MEMCG_CACHES_MAX_SIZE 65535
+int memcg_limited_groups_array_size;
+static DEFINE_IDA(kmem_limited_groups);
+
+/*
+ * Protects the memcg_caches arrays and the memcg_slab_caches lists, and
+ * serializes the creation of per-memcg caches. Nests outside the slab
+ * allocator's own cache list lock.
+ */
+static DEFINE_MUTEX(memcg_cache_mutex);
+static struct workqueue_struct *memcg_kmem_wq;
+/* Allocations from a per-memcg cache are read-side sections of this. */
+static struct srcu_struct memcg_kmem_srcu;
+
+static bool memcg_can_account_kmem(struct mem_cgroup *memcg)
+{
+	return !mem_cgroup_disabled() && !mem_cgroup_is_root(memcg) &&
+		memcg->kmem_active;
+}
+
+static void disarm_kmem_keys(struct mem_cgroup *memcg)
+{
+	if (!memcg->kmem_active)
+		return;
+	ida_simple_remove(&kmem_limited_groups, memcg->kmemcg_id);
+	static_key_slow_dec(&memcg_kmem_enabled_key);
+}
+
+static int memcg_caches_array_size(int num_groups)
+{
+	int size;
+
+	if (num_groups <= 0)
+		return 0;
+	size = 2 * num_groups;
+	if (size < MEMCG_CACHES_MIN_SIZE)
+		size = MEMCG_CACHES_MIN_SIZE;
+	else if (size > MEMCG_CACHES_MAX_SIZE)
+		size = MEMCG_CACHES_MAX_SIZE;
+	return size;
+}
+
+/*
+ * Called by the slab allocator, with its cache list lock held, for each
+ * root cache when the memcg_caches arrays have to grow.
+ */
+int memcg_update_cache_size(struct kmem_cache *s, int num_groups)
+{
+	struct memcg_cache_params *cur_params = s->memcg_params;
+	struct memcg_cache_params *new_params;
+
+	if (!cur_params || !cur_params->is_root_cache)
+		return 0;
+
+	new_params = kzalloc(sizeof(*new_params) +
+			     num_groups * sizeof(struct kmem_cache *),
+			     GFP_KERNEL);
+	if (!new_params)
+		return -ENOMEM;
+
+	new_params->is_root_cache = true;
+	memcpy(new_params->memcg_caches, cur_params->memcg_caches,
+	       memcg_limited_groups_array_size * sizeof(struct kmem_cache *));
+
+	rcu_assign_pointer(s->memcg_params, new_params);
+	kfree_rcu(cur_params, rcu_head);
+	return 0;
+}
+
+/*
+ * Gives @memcg a kmemcg_id, making room for it in the root caches, and
+ * turns kmem accounting on. Accounting is never turned off again for the
+ * life of the cgroup: the pages charged in the meantime refer to it.
+ */
+static int memcg_activate_kmem(struct mem_cgroup *memcg)
+{
+	int id, ret = 0;
+
+	mutex_lock(&memcg_cache_mutex);
+	if (memcg->kmem_active)
+		goto out;
+
+	if (!memcg_kmem_wq) {
+		ret = init_srcu_struct(&memcg_kmem_srcu);
+		if (ret)
+			goto out;
+		memcg_kmem_wq = alloc_workqueue("memcg_kmem", 0, 0);
+		if (!memcg_kmem_wq) {
+			cleanup_srcu_struct(&memcg_kmem_srcu);
+			ret = -ENOMEM;
+			goto out;
+		}
+	}
+
+	id = ida_simple_get(&kmem_limited_groups, 0, MEMCG_CACHES_MAX_SIZE,
+			    GFP_KERNEL);
+	if (id < 0) {
+		ret = id;
+		goto out;
+	}
+
+	if (id >= memcg_limited_groups_array_size) {
+		ret = memcg_update_all_caches(memcg_caches_array_size(id + 1));
+		if (ret) {
+			ida_simple_remove(&kmem_limited_groups, id);
+			goto out;
+		}
+	}
+
+	static_key_slow_inc(&memcg_kmem_enabled_key);
+	memcg->kmemcg_id = id;
+	/* the grown arrays must be visible before the id is used */
+	smp_wmb();
+	memcg->kmem_active = true;
+out:
+	mutex_unlock(&memcg_cache_mutex);
+	return ret;
+}
+
+static int memcg_update_kmem_limit(struct mem_cgroup *memcg, u64 val)
+{
+	int ret;
+
+	ret = res_counter_set_limit(&memcg->kmem, val);
+	if (ret || val == RESOURCE_MAX || memcg->kmem_active)
+		return ret;
+
+	ret = memcg_activate_kmem(memcg);
+	if (ret)
+		res_counter_set_limit(&memcg->kmem, RESOURCE_MAX);
+	return ret;
+}
+
+/*
+ * Returns the empty slabs and the per-cpu leftovers of the caches of
+ * @memcg and its children to the page allocator.
+ */
+static void memcg_shrink_kmem_caches(struct mem_cgroup *memcg)
+{
+	struct memcg_cache_params *params;
+	struct mem_cgroup *iter;
+
+	if (!mutex_trylock(&memcg_cache_mutex))
+		return;
+	for_each_mem_cgroup_tree(iter, memcg) {
+		list_for_each_entry(params, &iter->memcg_slab_caches, list)
+			kmem_cache_shrink(params->cachep);
+	}
+	mutex_unlock(&memcg_cache_mutex);
+}
+
+static int memcg_charge_kmem(struct mem_cgroup *memcg, gfp_t gfp, u64 size)
+{
+	struct res_counter *fail_res;
+	struct mem_cgroup *_memcg;
+	bool may_oom;
+	int ret;
+
+	ret = res_counter_charge(&memcg->kmem, size, &fail_res);
+	if (ret && (gfp & __GFP_WAIT) && (gfp & __GFP_FS)) {
+		/*
+		 * Slab pages are only released by their caches: before
+		 * failing, shrink the caches of the cgroup over its limit.
+		 */
+		memcg_shrink_kmem_caches(mem_cgroup_from_res_counter(fail_res,
+								     kmem));
+		ret = res_counter_charge(&memcg->kmem, size, &fail_res);
+	}
+	if (ret)
+		return ret;
+
+	/*
+	 * Conditions under which we can wait for the oom_killer. Those are
+	 * the same conditions tested by the core page allocator
+	 */
+	may_oom = (gfp & __GFP_FS) && !(gfp & __GFP_NORETRY);
+
+	_memcg = memcg;
+	ret = __mem_cgroup_try_charge(NULL, gfp, size >> PAGE_SHIFT,
+				      &_memcg, may_oom);
+	if (ret == -EINTR) {
+		/*
+		 * __mem_cgroup_try_charge() chose to bypass to root due to
+		 * OOM kill or fatal signal. Since our only options are to
+		 * either fail the allocation or charge it to this cgroup, do
+		 * it as a temporary condition. But we can't fail. From a
+		 * kmem/slab perspective, the cache has already been selected,
+		 * by mem_cgroup_kmem_get_cache(), so it is too late to change
+		 * our minds. This condition will only trigger if the task
+		 * entered memcg_charge_kmem in a sane state, but was
+		 * OOM-killed during __mem_cgroup_try_charge() above. Tasks
+		 * that were already dying when the allocation triggers should
+		 * have been already directed to the root cgroup.
+		 */
+		res_counter_charge_nofail(&memcg->res, size, &fail_res);
+		if (do_swap_account)
+			res_counter_charge_nofail(&memcg->memsw, size,
+						  &fail_res);
+		ret = 0;
+	} else if (ret)
+		res_counter_uncharge(&memcg->kmem, size);
+
+	/* each charged page pins the memcg until it is uncharged */
+	if (!ret)
+		mem_cgroup_get(memcg);
+	return ret;
+}
+
+static void memcg_uncharge_kmem(struct mem_cgroup *memcg, u64 size)
+{
+	res_counter_uncharge(&memcg->res, size);
+	if (do_swap_account)
+		res_counter_uncharge(&memcg->memsw, size);
+	res_counter_uncharge(&memcg->kmem, size);
+	mem_cgroup_put(memcg);
+}
+
+/*
+ * We need to verify if the allocation against current->mm->owner's memcg is
+ * possible for the given order. But the page is not allocated yet, so we'll
+ * need a further commit step to do the final arrangements.
+ *
+ * It is possible for the task to switch cgroups in this mean time, so at
+ * commit time, we can't rely on task conversion any longer.  We'll then use
+ * the handle argument to return to the caller which cgroup we should commit
+ * against. We could also return the memcg directly and avoid the pointer
+ * passing, but a boolean return value gives better semantics considering
+ * the compiled-out case as well.
+ *
+ * Returning true means the allocation is possible.
+ */
+bool __memcg_kmem_newpage_charge(gfp_t gfp, struct mem_cgroup **_memcg,
+				 int order)
+{
+	struct mem_cgroup *memcg;
+	int ret;
+
+	*_memcg = NULL;
+	memcg = try_get_mem_cgroup_from_mm(current->mm);
+	if (!memcg)
+		return true;
+
+	if (!memcg_can_account_kmem(memcg)) {
+		css_put(&memcg->css);
+		return true;
+	}
+
+	ret = memcg_charge_kmem(memcg, gfp, PAGE_SIZE << order);
+	if (!ret)
+		*_memcg = memcg;
+
+	css_put(&memcg->css);
+	return (ret == 0);
+}
+
+void __memcg_kmem_commit_charge(struct page *page, struct mem_cgroup *memcg,
+				int order)
+{
+	struct page_cgroup *pc;
+
+	VM_BUG_ON(mem_cgroup_is_root(memcg));
+
+	/* The page allocation failed. Revert */
+	if (!page) {
+		memcg_uncharge_kmem(memcg, PAGE_SIZE << order);
+		return;
+	}
+
+	pc = lookup_page_cgroup(page);
+	lock_page_cgroup(pc);
+	pc->mem_cgroup = memcg;
+	SetPageCgroupUsed(pc);
+	unlock_page_cgroup(pc);
+}
+
+void __memcg_kmem_uncharge_pages(struct page *page, int order)
+{
+	struct mem_cgroup *memcg = NULL;
+	struct page_cgroup *pc;
+
+	pc = lookup_page_cgroup(page);
+	/*
+	 * Fast unlocked return. Theoretically might have changed, have to
+	 * check again after locking.
+	 */
+	if (!PageCgroupUsed(pc))
+		return;
+
+	lock_page_cgroup(pc);
+	if (PageCgroupUsed(pc)) {
+		memcg = pc->mem_cgroup;
+		ClearPageCgroupUsed(pc);
+	}
+	unlock_page_cgroup(pc);
+
+	/*
+	 * We trust that only if there is a memcg associated with the page, it
+	 * is a valid allocation
+	 */
+	if (!memcg)
+		return;
+
+	VM_BUG_ON(mem_cgroup_is_root(memcg));
+	memcg_uncharge_kmem(memcg, PAGE_SIZE << order);
+}
+
+int __memcg_charge_slab(struct page *page, struct kmem_cache *s, gfp_t gfp,
+			int order)
+{
+	struct memcg_cache_params *params = s->memcg_params;
+	struct mem_cgroup *memcg;
+	int ret = 0;
+
+	if (!params || params->is_root_cache)
+		return 0;
+
+	/*
+	 * Slabs added after the cgroup started going away are not charged;
+	 * the cache is about to be destroyed anyway.
+	 */
+	memcg = params->memcg;
+	if (!ACCESS_ONCE(params->dead) && css_tryget(&memcg->css)) {
+		ret = memcg_charge_kmem(memcg, gfp, PAGE_SIZE << order);
+		if (!ret)
+			__memcg_kmem_commit_charge(page, memcg, order);
+		css_put(&memcg->css);
+	}
+	if (!ret)
+		atomic_add(1 << order, &params->nr_pages);
+	return ret;
+}
+
+void __memcg_uncharge_slab(struct page *page, struct kmem_cache *s, int order)
+{
+	struct memcg_cache_params *params = s->memcg_params;
+
+	if (!params || params->is_root_cache)
+		return;
+
+	__memcg_kmem_uncharge_pages(page, order);
+	if (atomic_sub_and_test(1 << order, &params->nr_pages) &&
+	    ACCESS_ONCE(params->dead))
+		queue_work(memcg_kmem_wq, &params->destroy);
+}
+
+/*
+ * The caches of a dead cgroup are destroyed once their last slab is
+ * freed. Until then, this work only shrinks them; freeing the last slab
+ * queues it again.
+ */
+static void memcg_cache_destroy_func(struct work_struct *work)
+{
+	struct memcg_cache_params *params;
+	struct kmem_cache *cachep;
+
+	params = container_of(work, struct memcg_cache_params, destroy);
+	cachep = params->cachep;
+
+	if (atomic_read(&params->nr_pages) != 0) {
+		kmem_cache_shrink(cachep);
+		return;
+	}
+
+	mutex_lock(&memcg_cache_mutex);
+	list_del(&params->list);
+	mutex_unlock(&memcg_cache_mutex);
+
+	kmem_cache_destroy(cachep);
+}
+
+char *memcg_cache_name(struct mem_cgroup *memcg, struct kmem_cache *root)
+{
+	struct dentry *dentry;
+	char *name;
+
+	rcu_read_lock();
+	dentry = rcu_dereference(memcg->css.cgroup->dentry);
+	name = kasprintf(GFP_KERNEL, "%s(%d:%s)", root->name,
+			 memcg->kmemcg_id, dentry->d_name.name);
+	rcu_read_unlock();
+
+	return name;
+}
+
+/*
+ * Called by the slab allocator, with its cache list lock held, when
+ * cache @s is created. Root caches get the memcg_caches array only if
+ * they are accounted; a per-memcg copy of @root_cache pins @memcg.
+ */
+int memcg_register_cache(struct mem_cgroup *memcg, struct kmem_cache *s,
+			 struct kmem_cache *root_cache)
+{
+	struct memcg_cache_params *params;
+	size_t size = sizeof(struct memcg_cache_params);
+
+	if (!memcg && !(s->flags & SLAB_ACCOUNT))
+		return 0;
+
+	if (!memcg)
+		size += memcg_limited_groups_array_size *
+			sizeof(struct kmem_cache *);
+
+	params = kzalloc(size, GFP_KERNEL);
+	if (!params)
+		return -ENOMEM;
+
+	if (memcg) {
+		params->memcg = memcg;
+		params->cachep = s;
+		params->root_cache = root_cache;
+		INIT_LIST_HEAD(&params->list);
+		INIT_WORK(&params->destroy, memcg_cache_destroy_func);
+		mem_cgroup_get(memcg);
+	} else
+		params->is_root_cache = true;
+
+	s->memcg_params = params;
+	return 0;
+}
+
+/*
+ * Called by the slab allocator when cache @s is destroyed. A per-memcg
+ * copy has already been unlinked from its cgroup by then.
+ */
+void memcg_release_cache(struct kmem_cache *s)
+{
+	struct memcg_cache_params *params = s->memcg_params;
+
+	if (!params)
+		return;
+	s->memcg_params = NULL;
+
+	if (!params->is_root_cache)
+		mem_cgroup_put(params->memcg);
+	kfree(params);
+}
+
+/*
+ * Destroys the per-memcg copies of root cache @s; called before @s
+ * itself is destroyed, at which point all of their objects are free.
+ */
+void memcg_destroy_child_caches(struct kmem_cache *s)
+{
+	struct kmem_cache *c;
+	int i;
+
+	if (!s->memcg_params || !s->memcg_params->is_root_cache)
+		return;
+
+	/* no more copies of @s may be created under our feet */
+	if (memcg_kmem_wq)
+		flush_workqueue(memcg_kmem_wq);
+
+	mutex_lock(&memcg_cache_mutex);
+	for (i = 0; i < memcg_limited_groups_array_size; i++) {
+		c = s->memcg_params->memcg_caches[i];
+		if (!c)
+			continue;
+		s->memcg_params->memcg_caches[i] = NULL;
+		list_del(&c->memcg_params->list);
+
+		mutex_unlock(&memcg_cache_mutex);
+		kmem_cache_destroy(c);
+		mutex_lock(&memcg_cache_mutex);
+	}
+	mutex_unlock(&memcg_cache_mutex);
+}
+
+struct create_work {
+	struct mem_cgroup *memcg;
+	struct kmem_cache *cachep;
+	struct work_struct work;
+};
+
+static void memcg_create_cache_work_func(struct work_struct *w)
+{
+	struct create_work *cw = container_of(w, struct create_work, work);
+	struct mem_cgroup *memcg = cw->memcg;
+	struct kmem_cache *cachep = cw->cachep;
+	struct kmem_cache *new_cachep;
+	int idx = memcg->kmemcg_id;
+
+	mutex_lock(&memcg_cache_mutex);
+	if (cachep->memcg_params && !cachep->memcg_params->memcg_caches[idx]) {
+		new_cachep = kmem_cache_dup(memcg, cachep);
+		if (new_cachep) {
+			list_add(&new_cachep->memcg_params->list,
+				 &memcg->memcg_slab_caches);
+			/* the new cache must be set up before it is found */
+			smp_wmb();
+			cachep->memcg_params->memcg_caches[idx] = new_cachep;
+		}
+	}
+	mutex_unlock(&memcg_cache_mutex);
+
+	css_put(&memcg->css);
+	kfree(cw);
+}
+
+/*
+ * Enqueue the creation of a per-memcg kmem_cache.
+ * Called with rcu_read_lock.
+ */
+static void memcg_create_cache_enqueue(struct mem_cgroup *memcg,
+				       struct kmem_cache *cachep)
+{
+	struct create_work *cw;
+
+	cw = kmalloc(sizeof(struct create_work), GFP_NOWAIT | __GFP_NOWARN);
+	if (cw == NULL)
+		return;
+
+	/* The corresponding put will be done in the workqueue. */
+	if (!css_tryget(&memcg->css)) {
+		kfree(cw);
+		return;
+	}
+
+	cw->memcg = memcg;
+	cw->cachep = cachep;
+
+	INIT_WORK(&cw->work, memcg_create_cache_work_func);
+	queue_work(memcg_kmem_wq, &cw->work);
+}
+
+/*
+ * Return the kmem_cache we're supposed to use for a slab allocation.
+ * We try to use the current memcg's version of the cache.
+ *
+ * If the cache does not exist yet, if we are the first user of it,
+ * we either create it immediately, if possible, or create it asynchronously
+ * in a workqueue.
+ * In the latter case, we will let the current allocation go through with
+ * the original cache.
+ *
+ * A per-memcg cache is returned inside a memcg_kmem_srcu read-side
+ * section, ended by __memcg_kmem_put_cache(); memcg_kmem_destroy_caches()
+ * waits for it. Unlike a reference, this stays on the local CPU.
+ *
+ * Can't be called in interrupt context or from kernel threads.
+ */
+struct kmem_cache *__memcg_kmem_get_cache(struct kmem_cache *cachep,
+					  gfp_t gfp, int *srcu_idx)
+{
+	struct memcg_cache_params *params;
+	struct kmem_cache *memcg_cachep;
+	struct mem_cgroup *memcg;
+	int idx;
+
+	if (!(cachep->flags & SLAB_ACCOUNT))
+		return cachep;
+
+	rcu_read_lock();
+	memcg = mem_cgroup_from_task(rcu_dereference(current->mm->owner));
+	if (!memcg || !memcg_can_account_kmem(memcg))
+		goto out;
+
+	/* before the lookup, so that a cache found is waited for */
+	idx = srcu_read_lock(&memcg_kmem_srcu);
+
+	/* pairs with the smp_wmb() in memcg_activate_kmem() */
+	smp_rmb();
+	params = rcu_dereference(cachep->memcg_params);
+	memcg_cachep = params->memcg_caches[memcg->kmemcg_id];
+	if (likely(memcg_cachep)) {
+		/* pairs with the smp_wmb() in memcg_create_cache_work_func() */
+		smp_read_barrier_depends();
+		cachep = memcg_cachep;
+		*srcu_idx = idx;
+	} else {
+		srcu_read_unlock(&memcg_kmem_srcu, idx);
+		memcg_create_cache_enqueue(memcg, cachep);
+	}
+out:
+	rcu_read_unlock();
+	return cachep;
+}
+
+void __memcg_kmem_put_cache(int srcu_idx)
+{
+	srcu_read_unlock(&memcg_kmem_srcu, srcu_idx);
+}
+
+/*
+ * The caches of a cgroup that goes away are no longer used for new
+ * allocations; they are destroyed once the last of their objects is
+ * freed.
+ */
+static void memcg_kmem_destroy_caches(struct mem_cgroup *memcg)
+{
+	struct memcg_cache_params *params;
+	struct kmem_cache *root;
+
+	if (!memcg->kmem_active)
+		return;
+
+	mutex_lock(&memcg_cache_mutex);
+	list_for_each_entry(params, &memcg->memcg_slab_caches, list) {
+		root = params->root_cache;
+		root->memcg_params->memcg_caches[memcg->kmemcg_id] = NULL;
+	}
+	mutex_unlock(&memcg_cache_mutex);
+
+	/* allocations that found a cache before it was unlinked */
+	synchronize_srcu(&memcg_kmem_srcu);
+
+	mutex_lock(&memcg_cache_mutex);
+	list_for_each_entry(params, &memcg->memcg_slab_caches, list) {
+		params->dead = true;
+		queue_work(memcg_kmem_wq, &params->destroy);
+	}
+	mutex_unlock(&memcg_cache_mutex);
+}
+#else
+static void disarm_kmem_keys(struct mem_cgroup *memcg)
+{
+}
+
+static int memcg_update_kmem_limit(struct mem_cgroup *memcg, u64 val)
+{
+	return -EINVAL;
+}
+#endif /* CONFIG_CGROUP_MEM_RES_CTLR_KMEM */
+
+/*
+ * Kernel memory cannot be moved or reclaimed like user pages, so it is
+ * left charged when a cgroup is emptied.
+ */
+static u64 memcg_kmem_usage(struct mem_cgroup *memcg)
+{
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+	return res_counter_read_u64(&memcg->kmem, RES_USAGE);
+#else
+	return 0;
+#endif
+}
+
 static int mem_cgroup_force_empty(struct mem_cgroup *memcg, bool free_all)
 {
 	int ret;
@@ -3720,7 +4416,8 @@ move_account:
 			goto try_to_free;
 		cond_resched();
 	/* "ret" should also be checked to ensure all lists are empty. */
-	} while (res_counter_read_u64(&memcg->res, RES_USAGE) > 0 || ret);
+	} while (res_counter_read_u64(&memcg->res, RES_USAGE) >
+		 memcg_kmem_usage(memcg) || ret);
 out:
 	css_put(&memcg->css);
 	return ret;
@@ -3735,7 +4432,8 @@ try_to_free:
 	lru_add_drain_all();
 	/* try to free all pages in this cgroup */
 	shrink = 1;
-	while (nr_retries && res_counter_read_u64(&memcg->res, RES_USAGE) > 0) {
+	while (nr_retries && res_counter_read_u64(&memcg->res, RES_USAGE) >
+			    memcg_kmem_usage(memcg)) {
 		int progress;
 
 		if (signal_pending(current)) {
@@ -3864,6 +4562,11 @@ static ssize_t mem_cgroup_read(struct cgroup *cont, struct cftype *cft,
 		else
 			val = res_counter_read_u64(&memcg->memsw, name);
 		break;
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+	case _KMEM:
+		val = res_counter_read_u64(&memcg->kmem, name);
+		break;
+#endif
 	default:
 		BUG();
 	}
@@ -3901,8 +4604,12 @@ static int mem_cgroup_write(struct cgroup *cont, struct cftype *cft,
 			break;
 		if (type == _MEM)
 			ret = mem_cgroup_resize_limit(memcg, val);
-		else
+		else if (type == _MEMSWAP)
 			ret = mem_cgroup_resize_memsw_limit(memcg, val);
+		else if (type == _KMEM)
+			ret = memcg_update_kmem_limit(memcg, val);
+		else
+			ret = -EINVAL;
 		break;
 	case RES_SOFT_LIMIT:
 		ret = res_counter_memparse_write_strategy(buffer, &val);
@@ -3967,14 +4674,22 @@ static int mem_cgroup_reset(struct cgroup *cont, unsigned int event)
 	case RES_MAX_USAGE:
 		if (type == _MEM)
 			res_counter_reset_max(&memcg->res);
-		else
+		else if (type == _MEMSWAP)
 			res_counter_reset_max(&memcg->memsw);
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+		else if (type == _KMEM)
+			res_counter_reset_max(&memcg->kmem);
+#endif
 		break;
 	case RES_FAILCNT:
 		if (type == _MEM)
 			res_counter_reset_failcnt(&memcg->res);
-		else
+		else if (type == _MEMSWAP)
 			res_counter_reset_failcnt(&memcg->memsw);
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+		else if (type == _KMEM)
+			res_counter_reset_failcnt(&memcg->kmem);
+#endif
 		break;
 	}
 
@@ -4140,16 +4855,19 @@ static int mem_control_stat_show(struct cgroup *cont, struct cftype *cft,
 		struct zone_reclaim_stat *rstat;
 		unsigned long recent_rotated[2] = {0, 0};
 		unsigned long recent_scanned[2] = {0, 0};
+		int split;
 
 		for_each_online_node(nid)
 			for (zid = 0; zid < MAX_NR_ZONES; zid++) {
 				mz = mem_cgroup_zoneinfo(memcg, nid, zid);
-				rstat = &mz->lruvec.reclaim_stat;
+				for_each_lru_split(split) {
+					rstat = &mz->lruvec.split[split].reclaim_stat;
 
-				recent_rotated[0] += rstat->recent_rotated[0];
-				recent_rotated[1] += rstat->recent_rotated[1];
-				recent_scanned[0] += rstat->recent_scanned[0];
-				recent_scanned[1] += rstat->recent_scanned[1];
+					recent_rotated[0] += rstat->recent_rotated[0];
+					recent_rotated[1] += rstat->recent_rotated[1];
+					recent_scanned[0] += rstat->recent_scanned[0];
+					recent_scanned[1] += rstat->recent_scanned[1];
+				}
 			}
 		seq_printf(m, "recent_rotated_anon %lu\n", recent_rotated[0]);
 		seq_printf(m, "recent_rotated_file %lu\n", recent_rotated[1]);
@@ -4536,11 +5254,31 @@ static int mem_cgroup_oom_control_write(struct cgroup *cgrp,
 #ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
 static int memcg_init_kmem(struct mem_cgroup *memcg, struct cgroup_subsys *ss)
 {
-	return mem_cgroup_sockets_init(memcg, ss);
+	struct mem_cgroup *parent = parent_mem_cgroup(memcg);
+	int ret;
+
+	INIT_LIST_HEAD(&memcg->memcg_slab_caches);
+	if (parent)
+		res_counter_init(&memcg->kmem, &parent->kmem);
+	else
+		res_counter_init(&memcg->kmem, NULL);
+
+	ret = mem_cgroup_sockets_init(memcg, ss);
+	if (ret)
+		return ret;
+
+	/*
+	 * Children of an accounted cgroup are accounted too when they are
+	 * part of its hierarchy, or their kmem would escape its limit.
+	 */
+	if (parent && parent->kmem_active)
+		ret = memcg_activate_kmem(memcg);
+	return ret;
 };
 
 static void kmem_cgroup_destroy(struct mem_cgroup *memcg)
 {
+	memcg_kmem_destroy_caches(memcg);
 	mem_cgroup_sockets_destroy(memcg);
 }
 #else
@@ -4649,6 +5387,31 @@ static struct cftype mem_cgroup_files[] = {
 		.trigger = mem_cgroup_reset,
 		.read = mem_cgroup_read,
 	},
+#endif
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+	{
+		.name = "kmem.limit_in_bytes",
+		.private = MEMFILE_PRIVATE(_KMEM, RES_LIMIT),
+		.write_string = mem_cgroup_write,
+		.read = mem_cgroup_read,
+	},
+	{
+		.name = "kmem.usage_in_bytes",
+		.private = MEMFILE_PRIVATE(_KMEM, RES_USAGE),
+		.read = mem_cgroup_read,
+	},
+	{
+		.name = "kmem.failcnt",
+		.private = MEMFILE_PRIVATE(_KMEM, RES_FAILCNT),
+		.trigger = mem_cgroup_reset,
+		.read = mem_cgroup_read,
+	},
+	{
+		.name = "kmem.max_usage_in_bytes",
+		.private = MEMFILE_PRIVATE(_KMEM, RES_MAX_USAGE),
+		.trigger = mem_cgroup_reset,
+		.read = mem_cgroup_read,
+	},
 #endif
 	{ },	/* terminate */
 };
@@ -4739,6 +5502,7 @@ static void free_work(struct work_struct *work)
 	 * the cgroup_lock.
 	 */
 	disarm_sock_keys(memcg);
+	disarm_kmem_keys(memcg);
 	if (size < PAGE_SIZE)
 		kfree(memcg);
 	else
@@ -5167,7 +5931,11 @@ static enum mc_target_type get_mctgt_type_thp(struct vm_area_struct *vma,
 	enum mc_target_type ret = MC_TARGET_NONE;
 
 	page = pmd_page(pmd);
-	VM_BUG_ON(!page || !PageHead(page));
+	VM_BUG_ON(!page);
+	/* page cache extents mapped by a pmd stay where they are charged */
+	if (!PageAnon(page))
+		return ret;
+	VM_BUG_ON(!PageHead(page));
 	if (!move_anon())
 		return ret;
 	pc = lookup_page_cgroup(page);
@@ -57,6 +57,9 @@
 #include <linux/swapops.h>
 #include <linux/elf.h>
 #include <linux/gfp.h>
+#include <linux/migrate.h>
+#include <linux/mempolicy.h>
+#include <linux/shmem_fs.h>
 
 #include <asm/io.h>
 #include <asm/pgalloc.h>
@@ -1226,7 +1229,13 @@ static inline unsigned long zap_pmd_range(struct mmu_gather *tlb,
 		if (pmd_trans_huge(*pmd)) {
 			if (next - addr != HPAGE_PMD_SIZE) {
 #ifdef CONFIG_DEBUG_VM
-				if (!rwsem_is_locked(&tlb->mm->mmap_sem)) {
+				/*
+				 * Page cache pmds are split in place under
+				 * the page_table_lock, truncation does it
+				 * without the mmap_sem.
+				 */
+				if (!vma->vm_ops &&
+				    !rwsem_is_locked(&tlb->mm->mmap_sem)) {
 					pr_err("%s: mmap_sem is unlocked! addr=0x%lx end=0x%lx vma->vm_start=0x%lx vma->vm_end=0x%lx\n",
 						__func__, addr, end,
 						vma->vm_start,
@@ -1234,7 +1243,7 @@ static inline unsigned long zap_pmd_range(struct mmu_gather *tlb,
 					BUG();
 				}
 #endif
-				split_huge_page_pmd(vma->vm_mm, pmd);
+				split_huge_page_pmd(vma, addr, pmd);
 			} else if (zap_huge_pmd(tlb, vma, pmd, addr))
 				goto next;
 			/* fall through */
@@ -1499,8 +1508,11 @@ struct page *follow_page(struct vm_area_struct *vma, unsigned long address,
 		goto out;
 	}
 	if (pmd_trans_huge(*pmd)) {
-		if (flags & FOLL_SPLIT) {
-			split_huge_page_pmd(mm, pmd);
+		/* page cache pmds are mlocked page by page */
+		if (flags & FOLL_SPLIT ||
+		    (vma->vm_ops && flags & FOLL_MLOCK &&
+		     vma->vm_flags & VM_LOCKED)) {
+			split_huge_page_pmd(vma, address, pmd);
 			goto split_fallthrough;
 		}
 		spin_lock(&mm->page_table_lock);
@@ -3406,6 +3418,67 @@ static int do_nonlinear_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	return __do_fault(mm, vma, address, pmd, pgoff, flags, orig_pte);
 }
 
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * A NUMA hinting fault: the pte was marked by the task's NUMA scanner
+ * (see task_numa_work()).  Restore the pte, feed the fault into the
+ * task's placement statistics and migrate the page to the faulting node
+ * if the memory policy says it is misplaced.
+ */
+static int do_numa_page(struct mm_struct *mm, struct vm_area_struct *vma,
+			unsigned long addr, pte_t pte, pte_t *ptep, pmd_t *pmd)
+{
+	struct page *page;
+	spinlock_t *ptl;
+	int current_nid, target_nid;
+	bool migrated = false;
+
+	ptl = pte_lockptr(mm, pmd);
+	spin_lock(ptl);
+	if (unlikely(!pte_same(*ptep, pte))) {
+		pte_unmap_unlock(ptep, ptl);
+		return 0;
+	}
+
+	pte = pte_mknonnuma(pte);
+	set_pte_at(mm, addr, ptep, pte);
+	update_mmu_cache(vma, addr, ptep);
+
+	page = vm_normal_page(vma, addr, pte);
+	if (!page) {
+		pte_unmap_unlock(ptep, ptl);
+		return 0;
+	}
+	get_page(page);
+	pte_unmap_unlock(ptep, ptl);
+
+	current_nid = page_to_nid(page);
+	count_vm_event(NUMA_HINT_FAULTS);
+	if (current_nid == numa_node_id())
+		count_vm_event(NUMA_HINT_FAULTS_LOCAL);
+
+	target_nid = mpol_misplaced(page, vma, addr);
+	if (target_nid == -1) {
+		put_page(page);
+	} else {
+		/* migrate_misplaced_page() drops our page reference */
+		migrated = migrate_misplaced_page(page, target_nid);
+		if (migrated)
+			current_nid = target_nid;
+	}
+
+	task_numa_fault(current_nid, 1, migrated);
+	return 0;
+}
+#else
+static int do_numa_page(struct mm_struct *mm, struct vm_area_struct *vma,
+			unsigned long addr, pte_t pte, pte_t *ptep, pmd_t *pmd)
+{
+	BUG();
+	return 0;
+}
+#endif /* CONFIG_NUMA_BALANCING */
+
 /*
  * These routines also need to handle stuff like marking pages dirty
  * and/or accessed for architectures that don't do it in hardware (most
@@ -3444,6 +3517,9 @@ int handle_pte_fault(struct mm_struct *mm,
 					pte, pmd, flags, entry);
 	}
 
+	if (pte_numa(entry) && (vma->vm_flags & (VM_READ|VM_WRITE|VM_EXEC)))
+		return do_numa_page(mm, vma, address, entry, pte, pmd);
+
 	ptl = pte_lockptr(mm, pmd);
 	spin_lock(ptl);
 	if (unlikely(!pte_same(*pte, entry)))
@@ -3502,16 +3578,32 @@ retry:
 	pmd = pmd_alloc(mm, pud, address);
 	if (!pmd)
 		return VM_FAULT_OOM;
-	if (pmd_none(*pmd) && transparent_hugepage_enabled(vma)) {
-		if (!vma->vm_ops)
-			return do_huge_pmd_anonymous_page(mm, vma, address,
-							  pmd, flags);
+	if (pmd_none(*pmd)) {
+		if (!vma->vm_ops) {
+			if (transparent_hugepage_enabled(vma))
+				return do_huge_pmd_anonymous_page(mm, vma,
+							address, pmd, flags);
+		} else if (vma->vm_ops->pmd_fault) {
+			int ret;
+
+			ret = vma->vm_ops->pmd_fault(vma, address, pmd, flags);
+			if (!(ret & VM_FAULT_FALLBACK))
+				return ret;
+		}
 	} else {
 		pmd_t orig_pmd = *pmd;
 		int ret;
 
 		barrier();
-		if (pmd_trans_huge(orig_pmd)) {
+		if (pmd_trans_huge(orig_pmd) && vma->vm_ops) {
+			/*
+			 * A shared page cache pmd is only write protected
+			 * by mprotect: let the pte fault path sort it out.
+			 */
+			if (!(flags & FAULT_FLAG_WRITE) || pmd_write(orig_pmd))
+				return 0;
+			split_huge_page_pmd(vma, address, pmd);
+		} else if (pmd_trans_huge(orig_pmd)) {
 			if (flags & FAULT_FLAG_WRITE &&
 			    !pmd_write(orig_pmd) &&
 			    !pmd_trans_splitting(orig_pmd)) {
@@ -3551,6 +3643,390 @@ retry:
 	return handle_pte_fault(mm, vma, address, pte, pmd, flags);
 }
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/*
+ * Speculative page faults: handle the common user faults without the
+ * mmap_sem, so that faulting threads don't queue up behind a concurrent
+ * mmap, munmap or mprotect.
+ *
+ * The vma is found and pinned by get_vma(), its vm_sequence count is
+ * sampled, and the fault works on a copy of it taken within that count.
+ * Whatever the fault depends on in the vma is changed between
+ * vma_write_begin() and vma_write_end(), before the writer goes through
+ * the page tables of the range under their locks: so a fault which
+ * finds the count unchanged once it holds the page table lock is
+ * ordered before the writer's pte updates, just as if it held the
+ * mmap_sem.
+ *
+ * The page tables are walked with interrupts disabled, like in
+ * get_user_pages_fast(): a page table is only freed after a TLB flush
+ * IPI, which cannot complete while we look at it.
+ *
+ * Only none ptes in anonymous, page cache and shmem vmas, and the
+ * young/dirty update of present ptes, are handled here: anything else,
+ * and any conflict or error, returns VM_FAULT_RETRY and the caller goes
+ * through handle_mm_fault() under the mmap_sem.
+ */
+struct spf_fault {
+	struct mm_struct *mm;
+	struct vm_area_struct *vma;	/* the pinned vma */
+	struct vm_area_struct snap;	/* the copy the fault works on */
+	unsigned int seq;
+	unsigned long address;
+	unsigned int flags;
+	pmd_t *pmd;
+	pmd_t pmdval;
+	pte_t orig_pte;
+};
+
+static inline bool spf_vma_changed(struct spf_fault *spf)
+{
+	return read_seqcount_retry(&spf->vma->vm_sequence, spf->seq) ||
+		RB_EMPTY_NODE(&spf->vma->vm_rb);
+}
+
+static bool spf_walk(struct spf_fault *spf)
+{
+	unsigned long address = spf->address;
+	pgd_t *pgd;
+	pud_t *pud;
+	pte_t *pte;
+	bool ret = false;
+
+	local_irq_disable();
+	pgd = pgd_offset(spf->mm, address);
+	if (pgd_none(*pgd) || unlikely(pgd_bad(*pgd)))
+		goto out;
+	pud = pud_offset(pgd, address);
+	if (pud_none(*pud) || unlikely(pud_bad(*pud)))
+		goto out;
+	spf->pmd = pmd_offset(pud, address);
+	spf->pmdval = *spf->pmd;
+	barrier();
+	/* Page tables and huge pmds are set up under the mmap_sem */
+	if (pmd_none(spf->pmdval) || pmd_trans_huge(spf->pmdval) ||
+	    unlikely(pmd_bad(spf->pmdval)))
+		goto out;
+	pte = pte_offset_map(&spf->pmdval, address);
+	spf->orig_pte = *pte;
+	pte_unmap(pte);
+	ret = true;
+out:
+	local_irq_enable();
+	return ret;
+}
+
+static inline bool spf_pmd_changed(struct spf_fault *spf)
+{
+	pmd_t pmdval = *spf->pmd;
+
+	return pmd_val(pmdval) != pmd_val(spf->pmdval);
+}
+
+/*
+ * Map and lock the pte, if the vma and the pmd are still those the
+ * fault started from.  Whoever holds the page table lock may be waiting
+ * for a TLB flush IPI to us, so the lock is only tried with interrupts
+ * disabled; and the page table can only be freed while they are enabled
+ * if the vma changed, which is checked again each time.
+ */
+static bool spf_pte_map_lock(struct spf_fault *spf, pte_t **ptep,
+			     spinlock_t **ptlp)
+{
+	spinlock_t *ptl;
+
+	local_irq_disable();
+	for (;;) {
+		if (spf_vma_changed(spf) || spf_pmd_changed(spf))
+			goto fail;
+		ptl = pte_lockptr(spf->mm, &spf->pmdval);
+		if (spin_trylock(ptl))
+			break;
+		local_irq_enable();
+		cpu_relax();
+		local_irq_disable();
+	}
+	if (spf_vma_changed(spf) || spf_pmd_changed(spf)) {
+		spin_unlock(ptl);
+		goto fail;
+	}
+	*ptep = pte_offset_map(&spf->pmdval, spf->address);
+	*ptlp = ptl;
+	local_irq_enable();
+	return true;
+fail:
+	local_irq_enable();
+	return false;
+}
+
+/* Like do_anonymous_page() */
+static int spf_anonymous_page(struct spf_fault *spf)
+{
+	struct vm_area_struct *vma = &spf->snap;
+	unsigned long address = spf->address;
+	struct page *page = NULL;
+	spinlock_t *ptl;
+	pte_t *page_table;
+	pte_t entry;
+
+	if (!(spf->flags & FAULT_FLAG_WRITE)) {
+		entry = pte_mkspecial(pfn_pte(my_zero_pfn(address),
+						vma->vm_page_prot));
+	} else {
+		/* anon_vma_prepare() needs the mmap_sem */
+		if (!vma->anon_vma)
+			return VM_FAULT_RETRY;
+		page = alloc_zeroed_user_highpage_movable(vma, address);
+		if (!page)
+			return VM_FAULT_RETRY;
+		__SetPageUptodate(page);
+
+		if (mem_cgroup_newpage_charge(page, spf->mm, GFP_KERNEL)) {
+			page_cache_release(page);
+			return VM_FAULT_RETRY;
+		}
+
+		entry = mk_pte(page, vma->vm_page_prot);
+		if (vma->vm_flags & VM_WRITE)
+			entry = pte_mkwrite(pte_mkdirty(entry));
+	}
+
+	if (!spf_pte_map_lock(spf, &page_table, &ptl)) {
+		if (page) {
+			mem_cgroup_uncharge_page(page);
+			page_cache_release(page);
+		}
+		return VM_FAULT_RETRY;
+	}
+	if (!pte_none(*page_table)) {
+		if (page) {
+			mem_cgroup_uncharge_page(page);
+			page_cache_release(page);
+		}
+		goto unlock;
+	}
+
+	if (page) {
+		inc_mm_counter_fast(spf->mm, MM_ANONPAGES);
+		page_add_new_anon_rmap(page, vma, address);
+	}
+	set_pte_at(spf->mm, address, page_table, entry);
+
+	/* No need to invalidate - it was non-present before */
+	update_mmu_cache(vma, address, page_table);
+unlock:
+	pte_unmap_unlock(page_table, ptl);
+	return 0;
+}
+
+/*
+ * Like __do_fault() for a read, or a write to a private mapping, of a
+ * linear file vma.  ->fault is not allowed to drop the mmap_sem we do
+ * not hold, and its errors are left for the retry to report.
+ */
+static int spf_file_page(struct spf_fault *spf)
+{
+	struct vm_area_struct *vma = &spf->snap;
+	unsigned long address = spf->address;
+	struct page *page, *cow_page = NULL;
+	struct vm_fault vmf;
+	spinlock_t *ptl;
+	pte_t *page_table;
+	pte_t entry;
+	int installed = 0;
+	int ret;
+
+	if (spf->flags & FAULT_FLAG_WRITE) {
+		if (!vma->anon_vma)
+			return VM_FAULT_RETRY;
+		cow_page = alloc_page_vma(GFP_HIGHUSER_MOVABLE, vma, address);
+		if (!cow_page)
+			return VM_FAULT_RETRY;
+		if (mem_cgroup_newpage_charge(cow_page, spf->mm, GFP_KERNEL)) {
+			page_cache_release(cow_page);
+			return VM_FAULT_RETRY;
+		}
+	}
+
+	vmf.virtual_address = (void __user *)(address & PAGE_MASK);
+	vmf.pgoff = (((address & PAGE_MASK) - vma->vm_start) >> PAGE_SHIFT) +
+			vma->vm_pgoff;
+	vmf.flags = spf->flags & ~(FAULT_FLAG_ALLOW_RETRY |
+				   FAULT_FLAG_KILLABLE);
+	vmf.page = NULL;
+
+	ret = vma->vm_ops->fault(vma, &vmf);
+	if (unlikely(ret & (VM_FAULT_ERROR | VM_FAULT_NOPAGE |
+			    VM_FAULT_RETRY)))
+		goto uncharge_out;
+
+	if (unlikely(!(ret & VM_FAULT_LOCKED)))
+		lock_page(vmf.page);
+	else
+		VM_BUG_ON(!PageLocked(vmf.page));
+
+	if (unlikely(PageHWPoison(vmf.page)))
+		goto release_out;
+
+	page = vmf.page;
+	if (cow_page) {
+		page = cow_page;
+		copy_user_highpage(page, vmf.page, address, vma);
+		__SetPageUptodate(page);
+	}
+
+	if (!spf_pte_map_lock(spf, &page_table, &ptl))
+		goto release_out;
+
+	if (likely(pte_same(*page_table, spf->orig_pte))) {
+		flush_icache_page(vma, page);
+		entry = mk_pte(page, vma->vm_page_prot);
+		if (cow_page) {
+			entry = maybe_mkwrite(pte_mkdirty(entry), vma);
+			inc_mm_counter_fast(spf->mm, MM_ANONPAGES);
+			page_add_new_anon_rmap(page, vma, address);
+		} else {
+			inc_mm_counter_fast(spf->mm, MM_FILEPAGES);
+			page_add_file_rmap(page);
+		}
+		set_pte_at(spf->mm, address, page_table, entry);
+
+		/* no need to invalidate: a not-present page won't be cached */
+		update_mmu_cache(vma, address, page_table);
+		installed = 1;
+	}
+	pte_unmap_unlock(page_table, ptl);
+
+	unlock_page(vmf.page);
+	if (cow_page || !installed)
+		page_cache_release(vmf.page);
+	if (cow_page && !installed) {
+		mem_cgroup_uncharge_page(cow_page);
+		page_cache_release(cow_page);
+	}
+	return ret & VM_FAULT_MAJOR;
+
+release_out:
+	unlock_page(vmf.page);
+	page_cache_release(vmf.page);
+uncharge_out:
+	if (cow_page) {
+		mem_cgroup_uncharge_page(cow_page);
+		page_cache_release(cow_page);
+	}
+	return VM_FAULT_RETRY;
+}
+
+/* Like the tail of handle_pte_fault() */
+static int spf_update_pte(struct spf_fault *spf)
+{
+	struct vm_area_struct *vma = &spf->snap;
+	unsigned long address = spf->address;
+	int write = spf->flags & FAULT_FLAG_WRITE;
+	spinlock_t *ptl;
+	pte_t *pte;
+	pte_t entry;
+
+	if (!spf_pte_map_lock(spf, &pte, &ptl))
+		return VM_FAULT_RETRY;
+	if (unlikely(!pte_same(*pte, spf->orig_pte)))
+		goto unlock;
+	entry = spf->orig_pte;
+	if (write)
+		entry = pte_mkdirty(entry);
+	entry = pte_mkyoung(entry);
+	if (ptep_set_access_flags(vma, address, pte, entry, write))
+		update_mmu_cache(vma, address, pte);
+	else if (write)
+		flush_tlb_fix_spurious_fault(vma, address);
+unlock:
+	pte_unmap_unlock(pte, ptl);
+	return 0;
+}
+
+/*
+ * Called by the architecture fault handler before it takes the mmap_sem.
+ * Returns VM_FAULT_RETRY if the fault must go through handle_mm_fault(),
+ * which then reports any error; else the fault has been handled.
+ */
+int handle_speculative_fault(struct mm_struct *mm, unsigned long address,
+			     unsigned int flags)
+{
+	struct spf_fault spf;
+	unsigned long vm_flags;
+	pte_t entry;
+	int ret = VM_FAULT_RETRY;
+
+	/* Nobody else can take the mmap_sem of a single threaded mm */
+	if (atomic_read(&mm->mm_users) == 1)
+		return VM_FAULT_RETRY;
+
+	__set_current_state(TASK_RUNNING);
+	check_sync_rss_stat(current);
+
+	spf.vma = get_vma(mm, address);
+	if (!spf.vma)
+		goto out;
+
+	spf.mm = mm;
+	spf.address = address;
+	spf.flags = flags;
+	spf.seq = raw_seqcount_begin(&spf.vma->vm_sequence);
+	spf.snap = *spf.vma;
+	if (spf_vma_changed(&spf))
+		goto out_put;
+
+	vm_flags = spf.snap.vm_flags;
+	if (address < spf.snap.vm_start || address >= spf.snap.vm_end)
+		goto out_put;
+	if (vm_flags & (VM_HUGETLB | VM_PFNMAP | VM_MIXEDMAP | VM_IO |
+			VM_NONLINEAR | VM_GROWSDOWN | VM_GROWSUP))
+		goto out_put;
+	/* Access errors are reported by the retry */
+	if (flags & FAULT_FLAG_WRITE) {
+		if (!(vm_flags & VM_WRITE))
+			goto out_put;
+	} else if (!(vm_flags & (VM_READ | VM_EXEC | VM_WRITE)))
+		goto out_put;
+	/* The vma's own policy may be freed under us */
+	if (vma_policy(&spf.snap))
+		goto out_put;
+	if (spf.snap.vm_ops) {
+		if (spf.snap.vm_ops->fault != filemap_fault &&
+		    !vma_is_shmem(&spf.snap))
+			goto out_put;
+		/* Leave ->page_mkwrite and dirty accounting to the retry */
+		if ((flags & FAULT_FLAG_WRITE) && (vm_flags & VM_SHARED))
+			goto out_put;
+	}
+
+	if (!spf_walk(&spf))
+		goto out_put;
+
+	entry = spf.orig_pte;
+	if (pte_none(entry)) {
+		if (spf.snap.vm_ops)
+			ret = spf_file_page(&spf);
+		else
+			ret = spf_anonymous_page(&spf);
+	} else if (pte_present(entry) && !pte_numa(entry) &&
+		   (!(flags & FAULT_FLAG_WRITE) || pte_write(entry)))
+		ret = spf_update_pte(&spf);
+
+out_put:
+	put_vma(spf.vma);
+out:
+	if (ret & VM_FAULT_RETRY) {
+		count_vm_event(SPECULATIVE_PGFAULT_RETRY);
+	} else {
+		count_vm_event(PGFAULT);
+		mem_cgroup_count_vm_event(mm, PGFAULT);
+		count_vm_event(SPECULATIVE_PGFAULT);
+	}
+	return ret;
+}
+#endif /* CONFIG_SPECULATIVE_PAGE_FAULT */
+
 #ifndef __PAGETABLE_PUD_FOLDED
 /*
  * Allocate page upper directory.
@@ -511,7 +511,7 @@ static inline int check_pmd_range(struct vm_area_struct *vma, pud_t *pud,
 	pmd = pmd_offset(pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
-		split_huge_page_pmd(vma->vm_mm, pmd);
+		split_huge_page_pmd(vma, addr, pmd);
 		if (pmd_none_or_trans_huge_or_clear_bad(pmd))
 			continue;
 		if (check_pte_range(vma, pmd, addr, next, nodes,
@@ -634,7 +634,9 @@ static int vma_replace_policy(struct vm_area_struct *vma,
 	}
 
 	old = vma->vm_policy;
+	vma_write_begin(vma);
 	vma->vm_policy = new; /* protected by mmap_sem */
+	vma_write_end(vma);
 	mpol_put(old);
 
 	return 0;
@@ -2161,6 +2163,49 @@ mpol_shared_policy_lookup(struct shared_policy *sp, unsigned long idx)
 	return pol;
 }
 
+#ifdef CONFIG_NUMA_BALANCING
+/**
+ * mpol_misplaced - check whether current page node is valid in policy
+ * @page: page to be checked
+ * @vma: vm area where page mapped
+ * @addr: virtual address where page mapped
+ *
+ * Called from the NUMA hinting fault path to decide whether the page
+ * should move to the node of the faulting cpu.
+ *
+ * Only memory under the default, local allocation policy is balanced:
+ * a task or vma with an explicit policy has already said where its
+ * memory belongs.  The page must also have taken two hinting faults in
+ * a row from this node, which filters out pages that are shared between
+ * nodes or touched once by a task passing through.
+ *
+ * Returns:
+ *	-1	- not misplaced, page is in the right node
+ *	node	- node id where the page should be
+ */
+int mpol_misplaced(struct page *page, struct vm_area_struct *vma,
+		   unsigned long addr)
+{
+	struct mempolicy *pol;
+	int curnid = page_to_nid(page);
+	int thisnid = numa_node_id();
+	int ret = -1;
+
+	pol = get_vma_policy(current, vma, addr);
+	if (pol->mode != MPOL_PREFERRED || !(pol->flags & MPOL_F_LOCAL))
+		goto out;
+
+	if (page_nid_xchg_last(page, thisnid) != thisnid)
+		goto out;
+
+	if (curnid != thisnid)
+		ret = thisnid;
+out:
+	mpol_cond_put(pol);
+	return ret;
+}
+#endif
+
 static void sp_free(struct sp_node *n)
 {
 	mpol_put(n->policy);
@@ -1429,3 +1429,98 @@ int migrate_vmas(struct mm_struct *mm, const nodemask_t *to,
  	return err;
 }
 #endif
+
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * Returns true if this is a safe migration target node for misplaced NUMA
+ * pages.  Currently this only checks the zone watermarks.
+ */
+static bool migrate_balanced_pgdat(struct pglist_data *pgdat,
+				   int nr_migrate_pages)
+{
+	int z;
+
+	for (z = pgdat->nr_zones - 1; z >= 0; z--) {
+		struct zone *zone = pgdat->node_zones + z;
+
+		if (!populated_zone(zone))
+			continue;
+
+		if (zone->all_unreclaimable)
+			continue;
+
+		/* Avoid waking kswapd by allocating pages_to_migrate pages. */
+		if (!zone_watermark_ok(zone, 0,
+				       high_wmark_pages(zone) +
+				       nr_migrate_pages,
+				       0, 0))
+			continue;
+		return true;
+	}
+	return false;
+}
+
+static struct page *alloc_misplaced_dst_page(struct page *page,
+					     unsigned long data,
+					     int **result)
+{
+	int nid = (int) data;
+	struct page *newpage;
+
+	newpage = alloc_pages_exact_node(nid,
+					 (GFP_HIGHUSER_MOVABLE | GFP_THISNODE |
+					  __GFP_NOMEMALLOC | __GFP_NORETRY |
+					  __GFP_NOWARN) &
+					 ~GFP_IOFS, 0);
+	return newpage;
+}
+
+/*
+ * Attempt to migrate a misplaced page to the specified destination
+ * node. Caller is expected to have an elevated reference count on
+ * the page that will be dropped by this function before returning.
+ * Returns true if the page was migrated.
+ */
+bool migrate_misplaced_page(struct page *page, int node)
+{
+	pg_data_t *pgdat = NODE_DATA(node);
+	bool migrated = false;
+	int page_lru;
+	LIST_HEAD(migratepages);
+
+	/* Don't migrate pages that are mapped in multiple processes. */
+	if (page_mapcount(page) != 1)
+		goto out;
+
+	/* Avoid migrating to a node that is nearly full */
+	if (!migrate_balanced_pgdat(pgdat, 1))
+		goto out;
+
+	if (isolate_lru_page(page))
+		goto out;
+
+	page_lru = page_is_file_cache(page);
+	inc_zone_page_state(page, NR_ISOLATED_ANON + page_lru);
+	list_add(&page->lru, &migratepages);
+
+	/*
+	 * The page is isolated and isolate_lru_page() took a reference of
+	 * its own, so drop the one the caller gave us.
+	 */
+	put_page(page);
+	page = NULL;
+
+	if (migrate_pages(&migratepages, alloc_misplaced_dst_page,
+			  node, false, MIGRATE_ASYNC)) {
+		putback_lru_pages(&migratepages);
+	} else {
+		count_vm_event(NUMA_PAGE_MIGRATE);
+		migrated = true;
+	}
+	BUG_ON(!list_empty(&migratepages));
+out:
+	if (page)
+		put_page(page);
+	return migrated;
+}
+#endif /* CONFIG_NUMA_BALANCING */
@@ -90,11 +90,13 @@ int memmap_valid_within(unsigned long pfn,
 void lruvec_init(struct lruvec *lruvec, struct zone *zone)
 {
 	enum lru_list lru;
+	int split;
 
 	memset(lruvec, 0, sizeof(struct lruvec));
 
-	for_each_lru(lru)
-		INIT_LIST_HEAD(&lruvec->lists[lru]);
+	for_each_lru_split(split)
+		for_each_lru(lru)
+			INIT_LIST_HEAD(lruvec_list(lruvec, split, lru));
 
 #ifdef CONFIG_CGROUP_MEM_RES_CTLR
 	lruvec->zone = zone;
@@ -26,7 +26,7 @@
  *       mapping->i_mmap_mutex
  *         anon_vma->mutex
  *           mm->page_table_lock or pte_lock
- *             zone->lru_lock (in mark_page_accessed, isolate_lru_page)
+ *             zone->lru_split[].lock (in mark_page_accessed, isolate_lru_page)
  *             swap_lock (in swap_duplicate, swap_info_get)
  *               mmlist_lock (in mmput, drain_mmlist and others)
  *               mapping->private_lock (in __set_page_dirty_buffers)
@@ -694,10 +694,10 @@ int page_referenced_one(struct page *page, struct vm_area_struct *vma,
 			unsigned long *vm_flags)
 {
 	struct mm_struct *mm = vma->vm_mm;
+	pmd_t *pmd;
 	int referenced = 0;
 
 	if (unlikely(PageTransHuge(page))) {
-		pmd_t *pmd;
 
 		spin_lock(&mm->page_table_lock);
 		/*
@@ -722,6 +722,26 @@ int page_referenced_one(struct page *page, struct vm_area_struct *vma,
 		if (pmdp_clear_flush_young_notify(vma, address, pmd))
 			referenced++;
 		spin_unlock(&mm->page_table_lock);
+	} else if (!PageAnon(page) &&
+		   (pmd = page_check_address_file_pmd(page, mm, address))) {
+		if (vma->vm_flags & VM_LOCKED) {
+			spin_unlock(&mm->page_table_lock);
+			*mapcount = 0;	/* break early from loop */
+			*vm_flags |= VM_LOCKED;
+			goto out;
+		}
+
+		/*
+		 * The young bit is shared by the whole page cache
+		 * extent: only its first page ages it, so the others
+		 * are not all found unreferenced right after.
+		 */
+		if (address & ~HPAGE_PMD_MASK) {
+			if (pmd_young(*pmd))
+				referenced++;
+		} else if (pmdp_clear_flush_young_notify(vma, address, pmd))
+			referenced++;
+		spin_unlock(&mm->page_table_lock);
 	} else {
 		pte_t *pte;
 		spinlock_t *ptl;
@@ -1231,6 +1251,10 @@ int try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 	spinlock_t *ptl;
 	int ret = SWAP_AGAIN;
 
+	/* page cache pages may be mapped by a huge pmd */
+	if (!PageAnon(page))
+		split_file_huge_pmd_address(vma, address);
+
 	pte = page_check_address(page, mm, address, &ptl, 0);
 	if (!pte)
 		goto out;
@@ -1404,6 +1428,8 @@ static int try_to_unmap_cluster(unsigned long cursor, unsigned int *mapcount,
 	pmd = pmd_offset(pud, address);
 	if (!pmd_present(*pmd))
 		return ret;
+	/* mapped by a huge pmd before the vma went nonlinear */
+	split_huge_page_pmd(vma, address, pmd);
 
 	/*
 	 * If we can acquire the mmap_sem for read, and vma is VM_LOCKED,
@@ -64,6 +64,7 @@ static struct vfsmount *shm_mnt;
 #include <linux/highmem.h>
 #include <linux/seq_file.h>
 #include <linux/magic.h>
+#include <linux/khugepaged.h>
 
 #include <asm/uaccess.h>
 #include <asm/pgtable.h>
@@ -103,6 +104,7 @@ enum sgp_type {
 	SGP_DIRTY,	/* like SGP_CACHE, but set new page dirty */
 	SGP_WRITE,	/* may exceed i_size, may allocate !Uptodate page */
 	SGP_FALLOC,	/* like SGP_WRITE, but make existing page Uptodate */
+	SGP_HUGE,	/* like SGP_CACHE, but allocate a whole huge extent */
 };
 
 #ifdef CONFIG_TMPFS
@@ -117,6 +119,68 @@ static unsigned long shmem_default_max_inodes(void)
 }
 #endif
 
+#ifdef CONFIG_TRANSPARENT_HUGE_PAGECACHE
+/*
+ * A huge extent is HPAGE_PMD_NR physically contiguous small pages,
+ * naturally aligned both in the file and in memory, which
+ * shmem_pmd_fault() maps with a single pmd.  Each of them remains an
+ * ordinary page cache page: truncation, reclaim and swap still deal
+ * with them one by one, splitting the pmd mappings as they go.
+ *
+ * sbinfo->huge is set by the huge= mount option.  shmem_huge is the
+ * transparent_hugepage/shmem_enabled knob: it sets the policy of the
+ * internal mount, and may deny or force huge extents on all mounts.
+ */
+#define SHMEM_HUGE_NEVER	0
+#define SHMEM_HUGE_ALWAYS	1
+#define SHMEM_HUGE_WITHIN_SIZE	2
+#define SHMEM_HUGE_ADVISE	3
+#define SHMEM_HUGE_DENY		(-1)	/* shmem_enabled only */
+#define SHMEM_HUGE_FORCE	(-2)	/* shmem_enabled only */
+
+static int shmem_huge __read_mostly;
+
+#if defined(CONFIG_SYSFS) || defined(CONFIG_TMPFS)
+static int shmem_parse_huge(const char *str)
+{
+	if (!strcmp(str, "never"))
+		return SHMEM_HUGE_NEVER;
+	if (!strcmp(str, "always"))
+		return SHMEM_HUGE_ALWAYS;
+	if (!strcmp(str, "within_size"))
+		return SHMEM_HUGE_WITHIN_SIZE;
+	if (!strcmp(str, "advise"))
+		return SHMEM_HUGE_ADVISE;
+	if (!strcmp(str, "deny"))
+		return SHMEM_HUGE_DENY;
+	if (!strcmp(str, "force"))
+		return SHMEM_HUGE_FORCE;
+	return -EINVAL;
+}
+
+static const char *shmem_format_huge(int huge)
+{
+	switch (huge) {
+	case SHMEM_HUGE_NEVER:
+		return "never";
+	case SHMEM_HUGE_ALWAYS:
+		return "always";
+	case SHMEM_HUGE_WITHIN_SIZE:
+		return "within_size";
+	case SHMEM_HUGE_ADVISE:
+		return "advise";
+	case SHMEM_HUGE_DENY:
+		return "deny";
+	case SHMEM_HUGE_FORCE:
+		return "force";
+	default:
+		VM_BUG_ON(1);
+		return "bad_val";
+	}
+}
+#endif
+#endif /* CONFIG_TRANSPARENT_HUGE_PAGECACHE */
+
 static bool shmem_should_replace_page(struct page *page, gfp_t gfp);
 static int shmem_replace_page(struct page **pagep, gfp_t gfp,
 				struct shmem_inode_info *info, pgoff_t index);
@@ -951,6 +1015,24 @@ static struct page *shmem_alloc_page(gfp_t gfp,
 	 */
 	return alloc_page_vma(gfp, &pvma, 0);
 }
+
+#ifdef CONFIG_TRANSPARENT_HUGE_PAGECACHE
+static struct page *shmem_alloc_hugepage(gfp_t gfp,
+			struct shmem_inode_info *info, pgoff_t index)
+{
+	struct vm_area_struct pvma;
+
+	/* Create a pseudo vma that just contains the policy */
+	pvma.vm_start = 0;
+	pvma.vm_pgoff = round_down(index, HPAGE_PMD_NR);
+	pvma.vm_ops = NULL;
+	pvma.vm_policy = mpol_shared_policy_lookup(&info->policy,
+						   pvma.vm_pgoff);
+
+	return alloc_pages_vma(gfp, HPAGE_PMD_ORDER, &pvma, 0,
+			       numa_node_id());
+}
+#endif
 #else /* !CONFIG_NUMA */
 #ifdef CONFIG_TMPFS
 static inline void shmem_show_mpol(struct seq_file *seq, struct mempolicy *mpol)
@@ -969,6 +1051,14 @@ static inline struct page *shmem_alloc_page(gfp_t gfp,
 {
 	return alloc_page(gfp);
 }
+
+#ifdef CONFIG_TRANSPARENT_HUGE_PAGECACHE
+static inline struct page *shmem_alloc_hugepage(gfp_t gfp,
+			struct shmem_inode_info *info, pgoff_t index)
+{
+	return alloc_pages(gfp, HPAGE_PMD_ORDER);
+}
+#endif
 #endif /* CONFIG_NUMA */
 
 #if !defined(CONFIG_NUMA) || !defined(CONFIG_TMPFS)
@@ -978,6 +1068,152 @@ static inline struct mempolicy *shmem_get_sbmpol(struct shmem_sb_info *sbinfo)
 }
 #endif
 
+#ifdef CONFIG_TRANSPARENT_HUGE_PAGECACHE
+/*
+ * Should shmem_getpage_gfp() allocate the whole extent around index,
+ * rather than a single page?  SGP_HUGE comes from shmem_pmd_fault(),
+ * which has already applied the policy to its vma.
+ */
+static bool shmem_huge_extent(struct inode *inode, pgoff_t index,
+			      enum sgp_type sgp)
+{
+	pgoff_t end = round_up(index + 1, HPAGE_PMD_NR);
+
+	if (shmem_huge == SHMEM_HUGE_DENY || sgp == SGP_FALLOC)
+		return false;
+	if (sgp == SGP_HUGE || shmem_huge == SHMEM_HUGE_FORCE)
+		return true;
+
+	switch (SHMEM_SB(inode->i_sb)->huge) {
+	case SHMEM_HUGE_ALWAYS:
+		return true;
+	case SHMEM_HUGE_WITHIN_SIZE:
+		return ((loff_t)end << PAGE_CACHE_SHIFT) <= i_size_read(inode);
+	default:
+		return false;
+	}
+}
+
+/*
+ * Allocate, clear and insert all the pages of the empty extent around
+ * index, returning 0 for shmem_getpage_gfp() to look index up again;
+ * or an error for it to fall back to a single page.
+ */
+static int shmem_alloc_huge_extent(struct inode *inode, pgoff_t index,
+				   gfp_t gfp)
+{
+	struct address_space *mapping = inode->i_mapping;
+	struct shmem_inode_info *info = SHMEM_I(inode);
+	struct shmem_sb_info *sbinfo = SHMEM_SB(inode->i_sb);
+	pgoff_t start = round_down(index, HPAGE_PMD_NR);
+	pgoff_t found;
+	struct page *page;
+	void **slot;
+	int error, i;
+
+	/* Only an extent without pages nor swap: don't move data around */
+	rcu_read_lock();
+	i = radix_tree_gang_lookup_slot(&mapping->page_tree, &slot, &found,
+					start, 1);
+	rcu_read_unlock();
+	if (i && found < start + HPAGE_PMD_NR)
+		return -EEXIST;
+
+	if ((info->flags & VM_NORESERVE) &&
+	    security_vm_enough_memory_mm(current->mm,
+			HPAGE_PMD_NR * VM_ACCT(PAGE_CACHE_SIZE)))
+		return -ENOSPC;
+	error = -ENOSPC;
+	if (sbinfo->max_blocks) {
+		if (percpu_counter_compare(&sbinfo->used_blocks,
+				sbinfo->max_blocks - HPAGE_PMD_NR) > 0)
+			goto unacct;
+		percpu_counter_add(&sbinfo->used_blocks, HPAGE_PMD_NR);
+	}
+
+	page = shmem_alloc_hugepage(gfp | __GFP_NORETRY | __GFP_NOWARN |
+				    __GFP_NO_KSWAPD, info, start);
+	if (!page) {
+		count_vm_event(THP_FILE_FALLBACK);
+		error = -ENOMEM;
+		goto decused;
+	}
+	count_vm_event(THP_FILE_ALLOC);
+	split_page(page, HPAGE_PMD_ORDER);
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		SetPageSwapBacked(page + i);
+		__set_page_locked(page + i);
+		clear_highpage(page + i);
+		flush_dcache_page(page + i);
+		SetPageUptodate(page + i);
+		error = mem_cgroup_cache_charge(page + i, current->mm,
+						gfp & GFP_RECLAIM_MASK);
+		if (error)
+			break;
+		error = radix_tree_preload(gfp & GFP_RECLAIM_MASK);
+		if (!error) {
+			error = shmem_add_to_page_cache(page + i, mapping,
+							start + i, gfp, NULL);
+			radix_tree_preload_end();
+		}
+		if (error) {
+			mem_cgroup_uncharge_cache_page(page + i);
+			break;
+		}
+		lru_cache_add_anon(page + i);
+		cond_resched();
+	}
+
+	if (error) {
+		/* Raced with another allocation, or out of memory */
+		int nr = i;
+
+		for (i = 0; i < nr; i++) {
+			delete_from_page_cache(page + i);
+			unlock_page(page + i);
+			page_cache_release(page + i);
+		}
+		unlock_page(page + nr);
+		for (i = nr; i < HPAGE_PMD_NR; i++)
+			page_cache_release(page + i);
+		goto decused;
+	}
+
+	spin_lock(&info->lock);
+	info->alloced += HPAGE_PMD_NR;
+	inode->i_blocks += HPAGE_PMD_NR * BLOCKS_PER_PAGE;
+	shmem_recalc_inode(inode);
+	spin_unlock(&info->lock);
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		unlock_page(page + i);
+		page_cache_release(page + i);
+	}
+	return 0;
+
+decused:
+	if (sbinfo->max_blocks)
+		percpu_counter_add(&sbinfo->used_blocks, -HPAGE_PMD_NR);
+unacct:
+	if (info->flags & VM_NORESERVE)
+		vm_unacct_memory(HPAGE_PMD_NR * VM_ACCT(PAGE_CACHE_SIZE));
+	return error;
+}
+#else
+static inline bool shmem_huge_extent(struct inode *inode, pgoff_t index,
+				     enum sgp_type sgp)
+{
+	return false;
+}
+
+static inline int shmem_alloc_huge_extent(struct inode *inode, pgoff_t index,
+					  gfp_t gfp)
+{
+	return -EINVAL;
+}
+#endif /* CONFIG_TRANSPARENT_HUGE_PAGECACHE */
+
 /*
  * When a page is moved from swapcache to shmem filecache (either by the
  * usual swapin of shmem_getpage_gfp(), or by the less common swapoff of
@@ -1170,6 +1406,9 @@ repeat:
 		swap_free(swap);
 
 	} else {
+		if (shmem_huge_extent(inode, index, sgp) &&
+		    !shmem_alloc_huge_extent(inode, index, gfp))
+			goto repeat;
 		if (shmem_acct_block(info->flags)) {
 			error = -ENOSPC;
 			goto failed;
@@ -1301,6 +1540,217 @@ static int shmem_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
 	return ret;
 }
 
+#ifdef CONFIG_TRANSPARENT_HUGE_PAGECACHE
+bool shmem_huge_enabled(struct vm_area_struct *vma)
+{
+	struct inode *inode;
+
+	if (vma->vm_ops != &shmem_vm_ops)
+		return false;
+	/* Private mappings would have to COW a whole extent */
+	if (!(vma->vm_flags & VM_SHARED) ||
+	    (vma->vm_flags & (VM_NOHUGEPAGE | VM_LOCKED | VM_NONLINEAR)))
+		return false;
+	if (shmem_huge == SHMEM_HUGE_FORCE)
+		return true;
+	if (shmem_huge == SHMEM_HUGE_DENY)
+		return false;
+
+	inode = vma->vm_file->f_path.dentry->d_inode;
+	switch (SHMEM_SB(inode->i_sb)->huge) {
+	case SHMEM_HUGE_ALWAYS:
+	case SHMEM_HUGE_WITHIN_SIZE:
+		return true;
+	case SHMEM_HUGE_ADVISE:
+		return !!(vma->vm_flags & VM_HUGEPAGE);
+	default:
+		return false;
+	}
+}
+
+/*
+ * Map the whole extent around address with a pmd, if it is (or can be
+ * made) a huge extent lying entirely inside both vma and file.  Anything
+ * else is left to shmem_fault(), which reports the errors.
+ */
+static int shmem_pmd_fault(struct vm_area_struct *vma, unsigned long address,
+			   pmd_t *pmd, unsigned int flags)
+{
+	struct inode *inode = vma->vm_file->f_path.dentry->d_inode;
+	struct address_space *mapping = inode->i_mapping;
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	pgoff_t index = linear_page_index(vma, haddr);
+	struct page *page, *subpage;
+	int ret = 0;
+	int i;
+
+	if (haddr < vma->vm_start || haddr + HPAGE_PMD_SIZE > vma->vm_end ||
+	    (index & (HPAGE_PMD_NR - 1)) || !shmem_huge_enabled(vma))
+		return VM_FAULT_FALLBACK;
+	if (((loff_t)(index + HPAGE_PMD_NR) << PAGE_CACHE_SHIFT) >
+	    i_size_read(inode))
+		return VM_FAULT_FALLBACK;
+
+	if (shmem_getpage(inode, index, &page, SGP_HUGE, &ret))
+		return VM_FAULT_FALLBACK;
+	if (page_to_pfn(page) & (HPAGE_PMD_NR - 1)) {
+		unlock_page(page);
+		page_cache_release(page);
+		return VM_FAULT_FALLBACK;
+	}
+
+	/* The rest of the extent must follow it, in memory as in the file */
+	for (i = 1; i < HPAGE_PMD_NR; i++) {
+		subpage = find_lock_page(mapping, index + i);
+		if (subpage == page + i && PageUptodate(subpage))
+			continue;
+		if (subpage && !radix_tree_exceptional_entry(subpage)) {
+			unlock_page(subpage);
+			page_cache_release(subpage);
+		}
+		break;
+	}
+
+	/* Holding the page locks keeps truncation away from here on */
+	ret = VM_FAULT_FALLBACK;
+	if (i == HPAGE_PMD_NR)
+		ret = do_huge_pmd_file_page(vma, address, pmd, page, flags);
+	if (ret) {
+		while (i--) {
+			unlock_page(page + i);
+			page_cache_release(page + i);
+		}
+		return ret;
+	}
+
+	/* The pmd keeps the page references */
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		unlock_page(page + i);
+	return 0;
+}
+
+/*
+ * Called by khugepaged, with no locks held: replace the pages of a fully
+ * populated extent by a huge extent, copying their contents.  Returns 0
+ * if the extent can then be mapped by a pmd.
+ */
+int shmem_collapse_extent(struct address_space *mapping, pgoff_t start)
+{
+	struct inode *inode = mapping->host;
+	struct shmem_inode_info *info = SHMEM_I(inode);
+	struct page **pages, *page, *new;
+	int error, nr, i;
+
+	if (((loff_t)(start + HPAGE_PMD_NR) << PAGE_CACHE_SHIFT) >
+	    i_size_read(inode))
+		return -EINVAL;
+	pages = kmalloc(HPAGE_PMD_NR * sizeof(struct page *), GFP_KERNEL);
+	if (!pages)
+		return -ENOMEM;
+
+	/* References held by pagevecs would fail the page_count checks */
+	lru_add_drain();
+
+	error = -EAGAIN;
+	for (nr = 0; nr < HPAGE_PMD_NR; nr++) {
+		page = find_lock_page(mapping, start + nr);
+		if (!page || radix_tree_exceptional_entry(page))
+			goto out;
+		pages[nr] = page;
+		if (!PageUptodate(page) || PageMlocked(page)) {
+			nr++;
+			goto out;
+		}
+	}
+
+	if (!(page_to_pfn(pages[0]) & (HPAGE_PMD_NR - 1))) {
+		for (i = 1; i < HPAGE_PMD_NR; i++)
+			if (pages[i] != pages[0] + i)
+				break;
+		if (i == HPAGE_PMD_NR) {
+			error = 0;
+			goto out;
+		}
+	}
+
+	new = shmem_alloc_hugepage(mapping_gfp_mask(mapping) |
+				   __GFP_NORETRY | __GFP_NOWARN, info, start);
+	if (!new) {
+		count_vm_event(THP_COLLAPSE_ALLOC_FAILED);
+		error = -ENOMEM;
+		goto out;
+	}
+	count_vm_event(THP_COLLAPSE_ALLOC);
+	split_page(new, HPAGE_PMD_ORDER);
+
+	unmap_mapping_range(mapping, (loff_t)start << PAGE_CACHE_SHIFT,
+			    HPAGE_PMD_SIZE, 0);
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		/* Only the page cache and we may hold a reference */
+		if (page_mapped(pages[i]) || page_count(pages[i]) != 2)
+			goto out_free;
+		copy_highpage(new + i, pages[i]);
+		flush_dcache_page(new + i);
+	}
+
+	spin_lock_irq(&mapping->tree_lock);
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		if (!page_freeze_refs(pages[i], 2))
+			break;
+	if (i < HPAGE_PMD_NR) {
+		while (i--)
+			page_unfreeze_refs(pages[i], 2);
+		spin_unlock_irq(&mapping->tree_lock);
+		goto out_free;
+	}
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		page = new + i;
+		page_cache_get(page);
+		__set_page_locked(page);
+		SetPageUptodate(page);
+		SetPageSwapBacked(page);
+		page->mapping = mapping;
+		page->index = start + i;
+		error = shmem_radix_tree_replace(mapping, start + i,
+						 pages[i], page);
+		VM_BUG_ON(error);	/* the old page is locked */
+		__inc_zone_page_state(page, NR_FILE_PAGES);
+		__inc_zone_page_state(page, NR_SHMEM);
+		__dec_zone_page_state(pages[i], NR_FILE_PAGES);
+		__dec_zone_page_state(pages[i], NR_SHMEM);
+		pages[i]->mapping = NULL;
+		page_unfreeze_refs(pages[i], 1);
+	}
+	spin_unlock_irq(&mapping->tree_lock);
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		page = new + i;
+		mem_cgroup_replace_page_cache(pages[i], page);
+		if (PageDirty(pages[i])) {
+			ClearPageDirty(pages[i]);
+			SetPageDirty(page);
+		}
+		lru_cache_add_anon(page);
+		unlock_page(page);
+		page_cache_release(page);
+		cond_resched();
+	}
+	error = 0;
+	goto out;
+
+out_free:
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		__free_page(new + i);
+out:
+	for (i = 0; i < nr; i++) {
+		unlock_page(pages[i]);
+		page_cache_release(pages[i]);
+	}
+	kfree(pages);
+	return error;
+}
+#endif /* CONFIG_TRANSPARENT_HUGE_PAGECACHE */
+
 #ifdef CONFIG_NUMA
 static int shmem_set_policy(struct vm_area_struct *vma, struct mempolicy *mpol)
 {
@@ -1319,6 +1769,11 @@ static struct mempolicy *shmem_get_policy(struct vm_area_struct *vma,
 }
 #endif
 
+bool vma_is_shmem(struct vm_area_struct *vma)
+{
+	return vma->vm_ops == &shmem_vm_ops;
+}
+
 int shmem_lock(struct file *file, int lock, struct user_struct *user)
 {
 	struct inode *inode = file->f_path.dentry->d_inode;
@@ -1349,6 +1804,8 @@ static int shmem_mmap(struct file *file, struct vm_area_struct *vma)
 	file_accessed(file);
 	vma->vm_ops = &shmem_vm_ops;
 	vma->vm_flags |= VM_CAN_NONLINEAR;
+	if (unlikely(khugepaged_enter_vma_merge(vma)))
+		return -ENOMEM;
 	return 0;
 }
 
@@ -2499,6 +2956,13 @@ static int shmem_parse_options(char *options, struct shmem_sb_info *sbinfo,
 		} else if (!strcmp(this_char,"mpol")) {
 			if (mpol_parse_str(value, &sbinfo->mpol, 1))
 				goto bad_val;
+#ifdef CONFIG_TRANSPARENT_HUGE_PAGECACHE
+		} else if (!strcmp(this_char,"huge")) {
+			int huge = shmem_parse_huge(value);
+			if (huge < SHMEM_HUGE_NEVER)
+				goto bad_val;
+			sbinfo->huge = huge;
+#endif
 		} else {
 			printk(KERN_ERR "tmpfs: Bad mount option %s\n",
 			       this_char);
@@ -2544,6 +3008,7 @@ static int shmem_remount_fs(struct super_block *sb, int *flags, char *data)
 	sbinfo->max_blocks  = config.max_blocks;
 	sbinfo->max_inodes  = config.max_inodes;
 	sbinfo->free_inodes = config.max_inodes - inodes;
+	sbinfo->huge        = config.huge;
 
 	mpol_put(sbinfo->mpol);
 	sbinfo->mpol        = config.mpol;	/* transfers initial ref */
@@ -2569,6 +3034,10 @@ static int shmem_show_options(struct seq_file *seq, struct dentry *root)
 	if (!gid_eq(sbinfo->gid, GLOBAL_ROOT_GID))
 		seq_printf(seq, ",gid=%u",
 				from_kgid_munged(&init_user_ns, sbinfo->gid));
+#ifdef CONFIG_TRANSPARENT_HUGE_PAGECACHE
+	if (sbinfo->huge)
+		seq_printf(seq, ",huge=%s", shmem_format_huge(sbinfo->huge));
+#endif
 	shmem_show_mpol(seq, sbinfo->mpol);
 	return 0;
 }
@@ -2786,6 +3255,9 @@ static const struct vm_operations_struct shmem_vm_ops = {
 	.set_policy     = shmem_set_policy,
 	.get_policy     = shmem_get_policy,
 #endif
+#ifdef CONFIG_TRANSPARENT_HUGE_PAGECACHE
+	.pmd_fault	= shmem_pmd_fault,
+#endif
 };
 
 static struct dentry *shmem_mount(struct file_system_type *fs_type,
@@ -2839,6 +3311,57 @@ out4:
 	return error;
 }
 
+#if defined(CONFIG_TRANSPARENT_HUGE_PAGECACHE) && defined(CONFIG_SYSFS)
+static ssize_t shmem_enabled_show(struct kobject *kobj,
+				  struct kobj_attribute *attr, char *buf)
+{
+	int values[] = {
+		SHMEM_HUGE_ALWAYS,
+		SHMEM_HUGE_WITHIN_SIZE,
+		SHMEM_HUGE_ADVISE,
+		SHMEM_HUGE_NEVER,
+		SHMEM_HUGE_DENY,
+		SHMEM_HUGE_FORCE,
+	};
+	int i, count;
+
+	for (i = 0, count = 0; i < ARRAY_SIZE(values); i++) {
+		const char *fmt = shmem_huge == values[i] ? "[%s] " : "%s ";
+
+		count += sprintf(buf + count, fmt,
+				shmem_format_huge(values[i]));
+	}
+	buf[count - 1] = '\n';
+	return count;
+}
+
+static ssize_t shmem_enabled_store(struct kobject *kobj,
+		struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	char tmp[16];
+	int huge;
+
+	if (count + 1 > sizeof(tmp))
+		return -EINVAL;
+	memcpy(tmp, buf, count);
+	tmp[count] = '\0';
+	if (count && tmp[count - 1] == '\n')
+		tmp[count - 1] = '\0';
+
+	huge = shmem_parse_huge(tmp);
+	if (huge == -EINVAL)
+		return -EINVAL;
+
+	shmem_huge = huge;
+	if (shmem_huge > SHMEM_HUGE_DENY && !IS_ERR_OR_NULL(shm_mnt))
+		SHMEM_SB(shm_mnt->mnt_sb)->huge = shmem_huge;
+	return count;
+}
+
+struct kobj_attribute shmem_enabled_attr =
+	__ATTR(shmem_enabled, 0644, shmem_enabled_show, shmem_enabled_store);
+#endif /* CONFIG_TRANSPARENT_HUGE_PAGECACHE && CONFIG_SYSFS */
+
 #else /* !CONFIG_SHMEM */
 
 /*
@@ -2873,6 +3396,11 @@ int shmem_unuse(swp_entry_t swap, struct page *page)
 	return 0;
 }
 
+bool vma_is_shmem(struct vm_area_struct *vma)
+{
+	return false;
+}
+
 int shmem_lock(struct file *file, int lock, struct user_struct *user)
 {
 	return 0;
@@ -2980,6 +3508,8 @@ int shmem_zero_setup(struct vm_area_struct *vma)
 	vma->vm_file = file;
 	vma->vm_ops = &shmem_vm_ops;
 	vma->vm_flags |= VM_CAN_NONLINEAR;
+	if (unlikely(khugepaged_enter_vma_merge(vma)))
+		return -ENOMEM;
 	return 0;
 }
 
@@ -116,6 +116,7 @@
 #include	<linux/kmemcheck.h>
 #include	<linux/memory.h>
 #include	<linux/prefetch.h>
+#include	<linux/memcontrol.h>
 
 #include	<asm/cacheflush.h>
 #include	<asm/tlbflush.h>
@@ -159,13 +160,15 @@
 			 SLAB_STORE_USER | \
 			 SLAB_RECLAIM_ACCOUNT | SLAB_PANIC | \
 			 SLAB_DESTROY_BY_RCU | SLAB_MEM_SPREAD | \
-			 SLAB_DEBUG_OBJECTS | SLAB_NOLEAKTRACE | SLAB_NOTRACK)
+			 SLAB_DEBUG_OBJECTS | SLAB_NOLEAKTRACE | SLAB_NOTRACK | \
+			 SLAB_ACCOUNT)
 #else
 # define CREATE_MASK	(SLAB_HWCACHE_ALIGN | \
 			 SLAB_CACHE_DMA | \
 			 SLAB_RECLAIM_ACCOUNT | SLAB_PANIC | \
 			 SLAB_DESTROY_BY_RCU | SLAB_MEM_SPREAD | \
-			 SLAB_DEBUG_OBJECTS | SLAB_NOLEAKTRACE | SLAB_NOTRACK)
+			 SLAB_DEBUG_OBJECTS | SLAB_NOLEAKTRACE | SLAB_NOTRACK | \
+			 SLAB_ACCOUNT)
 #endif
 
 /*
@@ -523,6 +526,28 @@ static inline struct kmem_cache *virt_to_cache(const void *obj)
 	return page_get_cache(page);
 }
 
+/*
+ * Objects of the per-memcg copies of a cache are freed with the root
+ * cache they were allocated through; the slab knows its real cache.
+ */
+static inline struct kmem_cache *cache_from_obj(struct kmem_cache *cachep,
+						const void *obj)
+{
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+	struct kmem_cache *c;
+
+	if (!memcg_kmem_enabled())
+		return cachep;
+
+	c = virt_to_cache(obj);
+	if (c != cachep && c->memcg_params &&
+	    !c->memcg_params->is_root_cache &&
+	    c->memcg_params->root_cache == cachep)
+		return c;
+#endif
+	return cachep;
+}
+
 static inline struct slab *virt_to_slab(const void *obj)
 {
 	struct page *page = virt_to_head_page(obj);
@@ -1809,6 +1834,11 @@ static void *kmem_getpages(struct kmem_cache *cachep, gfp_t flags, int nodeid)
 		return NULL;
 	}
 
+	if (memcg_charge_slab(page, cachep, flags, cachep->gfporder)) {
+		__free_pages(page, cachep->gfporder);
+		return NULL;
+	}
+
 	nr_pages = (1 << cachep->gfporder);
 	if (cachep->flags & SLAB_RECLAIM_ACCOUNT)
 		add_zone_page_state(page_zone(page),
@@ -1855,6 +1885,7 @@ static void kmem_freepages(struct kmem_cache *cachep, void *addr)
 	}
 	if (current->reclaim_state)
 		current->reclaim_state->reclaimed_slab += nr_freed;
+	memcg_uncharge_slab(virt_to_page(addr), cachep, cachep->gfporder);
 	free_pages((unsigned long)addr, cachep->gfporder);
 }
 
@@ -2118,6 +2149,12 @@ static void __kmem_cache_destroy(struct kmem_cache *cachep)
 			kfree(l3);
 		}
 	}
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+	/* the name of a per-memcg copy was allocated by kmem_cache_dup() */
+	if (cachep->memcg_params && !cachep->memcg_params->is_root_cache)
+		kfree(cachep->name);
+#endif
+	memcg_release_cache(cachep);
 	kmem_cache_free(&cache_cache, cachep);
 }
 
@@ -2273,9 +2310,10 @@ static int __init_refok setup_cpu_cache(struct kmem_cache *cachep, gfp_t gfp)
  * cacheline.  This can be beneficial if you're counting cycles as closely
  * as davem.
  */
-struct kmem_cache *
-kmem_cache_create (const char *name, size_t size, size_t align,
-	unsigned long flags, void (*ctor)(void *))
+static struct kmem_cache *
+__kmem_cache_create(struct mem_cgroup *memcg, const char *name, size_t size,
+	size_t align, unsigned long flags, void (*ctor)(void *),
+	struct kmem_cache *root_cache)
 {
 	size_t left_over, slab_size, ralign;
 	struct kmem_cache *cachep = NULL, *pc;
@@ -2527,6 +2565,9 @@ kmem_cache_create (const char *name, size_t size, size_t align,
 	}
 	cachep->ctor = ctor;
 	cachep->name = name;
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+	cachep->align = align;
+#endif
 
 	if (setup_cpu_cache(cachep, gfp)) {
 		__kmem_cache_destroy(cachep);
@@ -2534,6 +2575,12 @@ kmem_cache_create (const char *name, size_t size, size_t align,
 		goto oops;
 	}
 
+	if (memcg_register_cache(memcg, cachep, root_cache)) {
+		__kmem_cache_destroy(cachep);
+		cachep = NULL;
+		goto oops;
+	}
+
 	if (flags & SLAB_DEBUG_OBJECTS) {
 		/*
 		 * Would deadlock through slab_destroy()->call_rcu()->
@@ -2556,8 +2603,71 @@ oops:
 	}
 	return cachep;
 }
+
+struct kmem_cache *
+kmem_cache_create (const char *name, size_t size, size_t align,
+	unsigned long flags, void (*ctor)(void *))
+{
+	return __kmem_cache_create(NULL, name, size, align, flags, ctor, NULL);
+}
 EXPORT_SYMBOL(kmem_cache_create);
 
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+struct kmem_cache *
+kmem_cache_create_memcg(struct mem_cgroup *memcg, const char *name,
+	size_t size, size_t align, unsigned long flags, void (*ctor)(void *),
+	struct kmem_cache *root_cache)
+{
+	return __kmem_cache_create(memcg, name, size, align, flags, ctor,
+				   root_cache);
+}
+
+/*
+ * Creates the copy of @cachep used by the tasks of @memcg. Called with
+ * the memcg cache mutex held. The copy owns its name, which is freed
+ * when it is destroyed.
+ */
+struct kmem_cache *kmem_cache_dup(struct mem_cgroup *memcg,
+				  struct kmem_cache *cachep)
+{
+	struct kmem_cache *new;
+	char *name;
+
+	name = memcg_cache_name(memcg, cachep);
+	if (!name)
+		return NULL;
+
+	new = kmem_cache_create_memcg(memcg, name, obj_size(cachep),
+				      cachep->align,
+				      cachep->flags & ~SLAB_PANIC,
+				      cachep->ctor, cachep);
+	if (!new)
+		kfree(name);
+	return new;
+}
+
+/*
+ * Grows the memcg_caches arrays of all root caches so that they have
+ * room for @num_memcgs cgroups.
+ */
+int memcg_update_all_caches(int num_memcgs)
+{
+	struct kmem_cache *cachep;
+	int ret = 0;
+
+	mutex_lock(&cache_chain_mutex);
+	list_for_each_entry(cachep, &cache_chain, next) {
+		ret = memcg_update_cache_size(cachep, num_memcgs);
+		if (ret)
+			goto out;
+	}
+	memcg_limited_groups_array_size = num_memcgs;
+out:
+	mutex_unlock(&cache_chain_mutex);
+	return ret;
+}
+#endif
+
 #if DEBUG
 static void check_irq_off(void)
 {
@@ -2734,6 +2844,8 @@ void kmem_cache_destroy(struct kmem_cache *cachep)
 {
 	BUG_ON(!cachep || in_interrupt());
 
+	memcg_destroy_child_caches(cachep);
+
 	/* Find the cache in the chain of caches. */
 	get_online_cpus();
 	mutex_lock(&cache_chain_mutex);
@@ -3509,6 +3621,7 @@ __cache_alloc_node(struct kmem_cache *cachep, gfp_t flags, int nodeid,
 	unsigned long save_flags;
 	void *ptr;
 	int slab_node = numa_mem_id();
+	int srcu_idx;
 
 	flags &= gfp_allowed_mask;
 
@@ -3517,6 +3630,8 @@ __cache_alloc_node(struct kmem_cache *cachep, gfp_t flags, int nodeid,
 	if (slab_should_failslab(cachep, flags))
 		return NULL;
 
+	cachep = memcg_kmem_get_cache(cachep, flags, &srcu_idx);
+
 	cache_alloc_debugcheck_before(cachep, flags);
 	local_irq_save(save_flags);
 
@@ -3554,6 +3669,7 @@ __cache_alloc_node(struct kmem_cache *cachep, gfp_t flags, int nodeid,
 	if (unlikely((flags & __GFP_ZERO) && ptr))
 		memset(ptr, 0, obj_size(cachep));
 
+	memcg_kmem_put_cache(srcu_idx);
 	return ptr;
 }
 
@@ -3594,6 +3710,7 @@ __cache_alloc(struct kmem_cache *cachep, gfp_t flags, void *caller)
 {
 	unsigned long save_flags;
 	void *objp;
+	int srcu_idx;
 
 	flags &= gfp_allowed_mask;
 
@@ -3602,6 +3719,8 @@ __cache_alloc(struct kmem_cache *cachep, gfp_t flags, void *caller)
 	if (slab_should_failslab(cachep, flags))
 		return NULL;
 
+	cachep = memcg_kmem_get_cache(cachep, flags, &srcu_idx);
+
 	cache_alloc_debugcheck_before(cachep, flags);
 	local_irq_save(save_flags);
 	objp = __do_cache_alloc(cachep, flags);
@@ -3617,6 +3736,7 @@ __cache_alloc(struct kmem_cache *cachep, gfp_t flags, void *caller)
 	if (unlikely((flags & __GFP_ZERO) && objp))
 		memset(objp, 0, obj_size(cachep));
 
+	memcg_kmem_put_cache(srcu_idx);
 	return objp;
 }
 
@@ -3915,6 +4035,8 @@ void kmem_cache_free(struct kmem_cache *cachep, void *objp)
 {
 	unsigned long flags;
 
+	cachep = cache_from_obj(cachep, objp);
+
 	local_irq_save(flags);
 	debug_check_no_locks_freed(objp, obj_size(cachep));
 	if (!(cachep->flags & SLAB_DEBUG_OBJECTS))
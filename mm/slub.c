@@ -30,6 +30,7 @@
 #include <linux/fault-inject.h>
 #include <linux/stacktrace.h>
 #include <linux/prefetch.h>
+#include <linux/memcontrol.h>
 
 #include <trace/events/kmem.h>
 
@@ -163,7 +164,7 @@ static inline int kmem_cache_debug(struct kmem_cache *s)
  */
 #define SLUB_NEVER_MERGE (SLAB_RED_ZONE | SLAB_POISON | SLAB_STORE_USER | \
 		SLAB_TRACE | SLAB_DESTROY_BY_RCU | SLAB_NOLEAKTRACE | \
-		SLAB_FAILSLAB)
+		SLAB_FAILSLAB | SLAB_ACCOUNT)
 
 #define SLUB_MERGE_SAME (SLAB_DEBUG_FREE | SLAB_RECLAIM_ACCOUNT | \
 		SLAB_CACHE_DMA | SLAB_NOTRACK)
@@ -1314,6 +1315,11 @@ static struct page *allocate_slab(struct kmem_cache *s, gfp_t flags, int node)
 			stat(s, ORDER_FALLBACK);
 	}
 
+	if (page && memcg_charge_slab(page, s, flags, oo_order(oo))) {
+		__free_pages(page, oo_order(oo));
+		page = NULL;
+	}
+
 	if (flags & __GFP_WAIT)
 		local_irq_disable();
 
@@ -1417,6 +1423,7 @@ static void __free_slab(struct kmem_cache *s, struct page *page)
 	reset_page_mapcount(page);
 	if (current->reclaim_state)
 		current->reclaim_state->reclaimed_slab += pages;
+	memcg_uncharge_slab(page, s, order);
 	__free_pages(page, order);
 }
 
@@ -2308,10 +2315,12 @@ static __always_inline void *slab_alloc(struct kmem_cache *s,
 	void **object;
 	struct kmem_cache_cpu *c;
 	unsigned long tid;
+	int srcu_idx;
 
 	if (slab_pre_alloc_hook(s, gfpflags))
 		return NULL;
 
+	s = memcg_kmem_get_cache(s, gfpflags, &srcu_idx);
 redo:
 
 	/*
@@ -2367,6 +2376,7 @@ redo:
 		memset(object, 0, s->objsize);
 
 	slab_post_alloc_hook(s, gfpflags, object);
+	memcg_kmem_put_cache(srcu_idx);
 
 	return object;
 }
@@ -2548,6 +2558,28 @@ slab_empty:
 	discard_slab(s, page);
 }
 
+/*
+ * Objects of the per-memcg copies of a cache are freed with the root
+ * cache they were allocated through; the slab knows its real cache.
+ */
+static inline struct kmem_cache *cache_from_obj(struct kmem_cache *s,
+						struct page *page)
+{
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+	struct kmem_cache *cachep;
+
+	if (!memcg_kmem_enabled())
+		return s;
+
+	cachep = page->slab;
+	if (cachep != s && cachep->memcg_params &&
+	    !cachep->memcg_params->is_root_cache &&
+	    cachep->memcg_params->root_cache == s)
+		return cachep;
+#endif
+	return s;
+}
+
 /*
  * Fastpath with forced inlining to produce a kfree and kmem_cache_free that
  * can perform fastpath freeing without additional function calls.
@@ -2602,6 +2634,7 @@ void kmem_cache_free(struct kmem_cache *s, void *x)
 	struct page *page;
 
 	page = virt_to_head_page(x);
+	s = cache_from_obj(s, page);
 
 	slab_free(s, page, x, _RET_IP_);
 
@@ -3192,6 +3225,8 @@ static inline int kmem_cache_close(struct kmem_cache *s)
  */
 void kmem_cache_destroy(struct kmem_cache *s)
 {
+	memcg_destroy_child_caches(s);
+
 	down_write(&slub_lock);
 	s->refcount--;
 	if (!s->refcount) {
@@ -3204,6 +3239,7 @@ void kmem_cache_destroy(struct kmem_cache *s)
 		}
 		if (s->flags & SLAB_DESTROY_BY_RCU)
 			rcu_barrier();
+		memcg_release_cache(s);
 		sysfs_slab_remove(s);
 	} else
 		up_write(&slub_lock);
@@ -3924,8 +3960,10 @@ static struct kmem_cache *find_mergeable(size_t size,
 	return NULL;
 }
 
-struct kmem_cache *kmem_cache_create(const char *name, size_t size,
-		size_t align, unsigned long flags, void (*ctor)(void *))
+static struct kmem_cache *
+__kmem_cache_create(struct mem_cgroup *memcg, const char *name, size_t size,
+		size_t align, unsigned long flags, void (*ctor)(void *),
+		struct kmem_cache *root_cache)
 {
 	struct kmem_cache *s;
 	char *n;
@@ -3934,7 +3972,7 @@ struct kmem_cache *kmem_cache_create(const char *name, size_t size,
 		return NULL;
 
 	down_write(&slub_lock);
-	s = find_mergeable(size, align, flags, name, ctor);
+	s = memcg ? NULL : find_mergeable(size, align, flags, name, ctor);
 	if (s) {
 		s->refcount++;
 		/*
@@ -3960,17 +3998,23 @@ struct kmem_cache *kmem_cache_create(const char *name, size_t size,
 	if (s) {
 		if (kmem_cache_open(s, n,
 				size, align, flags, ctor)) {
+			if (memcg_register_cache(memcg, s, root_cache)) {
+				kmem_cache_close(s);
+				goto err_free;
+			}
 			list_add(&s->list, &slab_caches);
 			up_write(&slub_lock);
 			if (sysfs_slab_add(s)) {
 				down_write(&slub_lock);
 				list_del(&s->list);
+				memcg_release_cache(s);
 				kfree(n);
 				kfree(s);
 				goto err;
 			}
 			return s;
 		}
+err_free:
 		kfree(s);
 	}
 	kfree(n);
@@ -3983,8 +4027,70 @@ err:
 		s = NULL;
 	return s;
 }
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+		size_t align, unsigned long flags, void (*ctor)(void *))
+{
+	return __kmem_cache_create(NULL, name, size, align, flags, ctor, NULL);
+}
 EXPORT_SYMBOL(kmem_cache_create);
 
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+struct kmem_cache *kmem_cache_create_memcg(struct mem_cgroup *memcg,
+		const char *name, size_t size, size_t align,
+		unsigned long flags, void (*ctor)(void *),
+		struct kmem_cache *root_cache)
+{
+	return __kmem_cache_create(memcg, name, size, align, flags, ctor,
+				   root_cache);
+}
+
+/*
+ * Creates the copy of @s used by the tasks of @memcg. Called with the
+ * memcg cache mutex held.
+ */
+struct kmem_cache *kmem_cache_dup(struct mem_cgroup *memcg,
+				  struct kmem_cache *s)
+{
+	struct kmem_cache *new;
+	char *name;
+
+	name = memcg_cache_name(memcg, s);
+	if (!name)
+		return NULL;
+
+	new = kmem_cache_create_memcg(memcg, name, s->objsize, s->align,
+			s->flags & ~(SLAB_PANIC | __OBJECT_POISON |
+				     __CMPXCHG_DOUBLE),
+			s->ctor, s);
+
+	/* the cache keeps a copy of the name */
+	kfree(name);
+	return new;
+}
+
+/*
+ * Grows the memcg_caches arrays of all root caches so that they have
+ * room for @num_memcgs cgroups.
+ */
+int memcg_update_all_caches(int num_memcgs)
+{
+	struct kmem_cache *s;
+	int ret = 0;
+
+	down_write(&slub_lock);
+	list_for_each_entry(s, &slab_caches, list) {
+		ret = memcg_update_cache_size(s, num_memcgs);
+		if (ret)
+			goto out;
+	}
+	memcg_limited_groups_array_size = num_memcgs;
+out:
+	up_write(&slub_lock);
+	return ret;
+}
+#endif
+
 #ifdef CONFIG_SMP
 /*
  * Use the cpu notifier to insure that the cpu slabs are flushed when
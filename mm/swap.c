@@ -48,15 +48,16 @@ static void __page_cache_release(struct page *page)
 {
 	if (PageLRU(page)) {
 		struct zone *zone = page_zone(page);
+		spinlock_t *lru_lock = page_lru_lock(page);
 		struct lruvec *lruvec;
 		unsigned long flags;
 
-		spin_lock_irqsave(&zone->lru_lock, flags);
+		spin_lock_irqsave(lru_lock, flags);
 		lruvec = mem_cgroup_page_lruvec(page, zone);
 		VM_BUG_ON(!PageLRU(page));
 		__ClearPageLRU(page);
 		del_page_from_lru_list(page, lruvec, page_off_lru(page));
-		spin_unlock_irqrestore(&zone->lru_lock, flags);
+		spin_unlock_irqrestore(lru_lock, flags);
 	}
 }
 
@@ -236,31 +237,39 @@ void put_pages_list(struct list_head *pages)
 }
 EXPORT_SYMBOL(put_pages_list);
 
+/*
+ * The pages of a pagevec may sit on several lru sublists.  Rather than
+ * bouncing between their locks, handle the pagevec one sublist at a time,
+ * so that each lock is taken at most once per batch.
+ */
 static void pagevec_lru_move_fn(struct pagevec *pvec,
 	void (*move_fn)(struct page *page, struct lruvec *lruvec, void *arg),
 	void *arg)
 {
-	int i;
-	struct zone *zone = NULL;
+	unsigned long todo = (1UL << pagevec_count(pvec)) - 1;
 	struct lruvec *lruvec;
-	unsigned long flags = 0;
+	unsigned long flags;
+	int i;
 
-	for (i = 0; i < pagevec_count(pvec); i++) {
-		struct page *page = pvec->pages[i];
-		struct zone *pagezone = page_zone(page);
+	BUILD_BUG_ON(PAGEVEC_SIZE >= BITS_PER_LONG);
 
-		if (pagezone != zone) {
-			if (zone)
-				spin_unlock_irqrestore(&zone->lru_lock, flags);
-			zone = pagezone;
-			spin_lock_irqsave(&zone->lru_lock, flags);
-		}
+	while (todo) {
+		spinlock_t *lru_lock = page_lru_lock(pvec->pages[__ffs(todo)]);
 
-		lruvec = mem_cgroup_page_lruvec(page, zone);
-		(*move_fn)(page, lruvec, arg);
+		spin_lock_irqsave(lru_lock, flags);
+		for (i = __ffs(todo); i < pagevec_count(pvec); i++) {
+			struct page *page = pvec->pages[i];
+
+			if (!(todo & (1UL << i)) ||
+			    page_lru_lock(page) != lru_lock)
+				continue;
+
+			lruvec = mem_cgroup_page_lruvec(page, page_zone(page));
+			(*move_fn)(page, lruvec, arg);
+			todo &= ~(1UL << i);
+		}
+		spin_unlock_irqrestore(lru_lock, flags);
 	}
-	if (zone)
-		spin_unlock_irqrestore(&zone->lru_lock, flags);
 	release_pages(pvec->pages, pvec->nr, pvec->cold);
 	pagevec_reinit(pvec);
 }
@@ -272,7 +281,8 @@ static void pagevec_move_tail_fn(struct page *page, struct lruvec *lruvec,
 
 	if (PageLRU(page) && !PageActive(page) && !PageUnevictable(page)) {
 		enum lru_list lru = page_lru_base_type(page);
-		list_move_tail(&page->lru, &lruvec->lists[lru]);
+		list_move_tail(&page->lru,
+			       lruvec_list(lruvec, page_lru_split(page), lru));
 		(*pgmoved)++;
 	}
 }
@@ -310,10 +320,12 @@ void rotate_reclaimable_page(struct page *page)
 	}
 }
 
-static void update_page_reclaim_stat(struct lruvec *lruvec,
+static void update_page_reclaim_stat(struct lruvec *lruvec, struct page *page,
 				     int file, int rotated)
 {
-	struct zone_reclaim_stat *reclaim_stat = &lruvec->reclaim_stat;
+	struct zone_reclaim_stat *reclaim_stat;
+
+	reclaim_stat = &lruvec->split[page_lru_split(page)].reclaim_stat;
 
 	reclaim_stat->recent_scanned[file]++;
 	if (rotated)
@@ -333,7 +345,7 @@ static void __activate_page(struct page *page, struct lruvec *lruvec,
 		add_page_to_lru_list(page, lruvec, lru);
 
 		__count_vm_event(PGACTIVATE);
-		update_page_reclaim_stat(lruvec, file, 1);
+		update_page_reclaim_stat(lruvec, page, file, 1);
 	}
 }
 
@@ -369,9 +381,9 @@ void activate_page(struct page *page)
 {
 	struct zone *zone = page_zone(page);
 
-	spin_lock_irq(&zone->lru_lock);
+	spin_lock_irq(page_lru_lock(page));
 	__activate_page(page, mem_cgroup_page_lruvec(page, zone), NULL);
-	spin_unlock_irq(&zone->lru_lock);
+	spin_unlock_irq(page_lru_lock(page));
 }
 #endif
 
@@ -437,14 +449,15 @@ void lru_cache_add_lru(struct page *page, enum lru_list lru)
 void add_page_to_unevictable_list(struct page *page)
 {
 	struct zone *zone = page_zone(page);
+	spinlock_t *lru_lock = page_lru_lock(page);
 	struct lruvec *lruvec;
 
-	spin_lock_irq(&zone->lru_lock);
+	spin_lock_irq(lru_lock);
 	lruvec = mem_cgroup_page_lruvec(page, zone);
 	SetPageUnevictable(page);
 	SetPageLRU(page);
 	add_page_to_lru_list(page, lruvec, LRU_UNEVICTABLE);
-	spin_unlock_irq(&zone->lru_lock);
+	spin_unlock_irq(lru_lock);
 }
 
 /*
@@ -505,13 +518,14 @@ static void lru_deactivate_fn(struct page *page, struct lruvec *lruvec,
 		 * The page's writeback ends up during pagevec
 		 * We moves tha page into tail of inactive.
 		 */
-		list_move_tail(&page->lru, &lruvec->lists[lru]);
+		list_move_tail(&page->lru,
+			       lruvec_list(lruvec, page_lru_split(page), lru));
 		__count_vm_event(PGROTATED);
 	}
 
 	if (active)
 		__count_vm_event(PGDEACTIVATE);
-	update_page_reclaim_stat(lruvec, file, 0);
+	update_page_reclaim_stat(lruvec, page, file, 0);
 }
 
 /*
@@ -598,8 +612,8 @@ int lru_add_drain_all(void)
  * passed pages.  If it fell to zero then remove the page from the LRU and
  * free it.
  *
- * Avoid taking zone->lru_lock if possible, but if it is taken, retain it
- * for the remainder of the operation.
+ * Avoid taking an lru sublist lock if possible, but if it is taken, retain
+ * it for as long as the following pages belong to the same sublist.
  *
  * The locking in this function is against shrink_inactive_list(): we recheck
  * the page count inside the lock to see whether shrink_inactive_list()
@@ -610,7 +624,7 @@ void release_pages(struct page **pages, int nr, int cold)
 {
 	int i;
 	LIST_HEAD(pages_to_free);
-	struct zone *zone = NULL;
+	spinlock_t *lru_lock = NULL;
 	struct lruvec *lruvec;
 	unsigned long uninitialized_var(flags);
 
@@ -618,9 +632,9 @@ void release_pages(struct page **pages, int nr, int cold)
 		struct page *page = pages[i];
 
 		if (unlikely(PageCompound(page))) {
-			if (zone) {
-				spin_unlock_irqrestore(&zone->lru_lock, flags);
-				zone = NULL;
+			if (lru_lock) {
+				spin_unlock_irqrestore(lru_lock, flags);
+				lru_lock = NULL;
 			}
 			put_compound_page(page);
 			continue;
@@ -630,17 +644,16 @@ void release_pages(struct page **pages, int nr, int cold)
 			continue;
 
 		if (PageLRU(page)) {
-			struct zone *pagezone = page_zone(page);
-
-			if (pagezone != zone) {
-				if (zone)
-					spin_unlock_irqrestore(&zone->lru_lock,
-									flags);
-				zone = pagezone;
-				spin_lock_irqsave(&zone->lru_lock, flags);
+			spinlock_t *pagelock = page_lru_lock(page);
+
+			if (pagelock != lru_lock) {
+				if (lru_lock)
+					spin_unlock_irqrestore(lru_lock, flags);
+				lru_lock = pagelock;
+				spin_lock_irqsave(lru_lock, flags);
 			}
 
-			lruvec = mem_cgroup_page_lruvec(page, zone);
+			lruvec = mem_cgroup_page_lruvec(page, page_zone(page));
 			VM_BUG_ON(!PageLRU(page));
 			__ClearPageLRU(page);
 			del_page_from_lru_list(page, lruvec, page_off_lru(page));
@@ -648,8 +661,8 @@ void release_pages(struct page **pages, int nr, int cold)
 
 		list_add(&page->lru, &pages_to_free);
 	}
-	if (zone)
-		spin_unlock_irqrestore(&zone->lru_lock, flags);
+	if (lru_lock)
+		spin_unlock_irqrestore(lru_lock, flags);
 
 	free_hot_cold_page_list(&pages_to_free, cold);
 }
@@ -685,8 +698,8 @@ void lru_add_page_tail(struct page *page, struct page *page_tail,
 	VM_BUG_ON(!PageHead(page));
 	VM_BUG_ON(PageCompound(page_tail));
 	VM_BUG_ON(PageLRU(page_tail));
-	VM_BUG_ON(NR_CPUS != 1 &&
-		  !spin_is_locked(&lruvec_zone(lruvec)->lru_lock));
+	VM_BUG_ON(page_lru_split(page_tail) != page_lru_split(page));
+	VM_BUG_ON(NR_CPUS != 1 && !spin_is_locked(page_lru_lock(page)));
 
 	SetPageLRU(page_tail);
 
@@ -721,7 +734,7 @@ void lru_add_page_tail(struct page *page, struct page *page_tail,
 	}
 
 	if (!PageUnevictable(page))
-		update_page_reclaim_stat(lruvec, file, active);
+		update_page_reclaim_stat(lruvec, page, file, active);
 }
 #endif /* CONFIG_TRANSPARENT_HUGEPAGE */
 
@@ -740,7 +753,7 @@ static void __pagevec_lru_add_fn(struct page *page, struct lruvec *lruvec,
 	if (active)
 		SetPageActive(page);
 	add_page_to_lru_list(page, lruvec, lru);
-	update_page_reclaim_stat(lruvec, file, active);
+	update_page_reclaim_stat(lruvec, page, file, active);
 }
 
 /*
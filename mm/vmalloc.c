@@ -22,6 +22,7 @@
 #include <linux/kallsyms.h>
 #include <linux/list.h>
 #include <linux/rbtree.h>
+#include <linux/llist.h>
 #include <linux/radix-tree.h>
 #include <linux/rcupdate.h>
 #include <linux/pfn.h>
@@ -245,8 +246,6 @@ EXPORT_SYMBOL(vmalloc_to_pfn);
 
 /*** Global kva allocator ***/
 
-#define VM_LAZY_FREE	0x01
-#define VM_LAZY_FREEING	0x02
 #define VM_VM_AREA	0x04
 
 struct vmap_area {
@@ -255,20 +254,33 @@ struct vmap_area {
 	unsigned long flags;
 	struct rb_node rb_node;		/* address sorted rbtree */
 	struct list_head list;		/* address sorted list */
-	struct list_head purge_list;	/* "lazy purge" list */
+	struct llist_node purge_list;	/* "lazy purge" list */
 	struct vm_struct *vm;
-	struct rcu_head rcu_head;
+	unsigned long subtree_max_size;	/* in the free tree, see below */
 };
 
+/*
+ * vmap_area_lock protects both the tree of busy areas, which are either
+ * allocated or lazily freed and waiting for a purge, and the tree of
+ * free areas they are carved from.
+ */
 static DEFINE_SPINLOCK(vmap_area_lock);
 static LIST_HEAD(vmap_area_list);
 static struct rb_root vmap_area_root = RB_ROOT;
 
-/* The vmap cache globals are protected by vmap_area_lock */
-static struct rb_node *free_vmap_cache;
-static unsigned long cached_hole_size;
-static unsigned long cached_vstart;
-static unsigned long cached_align;
+/*
+ * The free tree covers all the address space that is not busy, with
+ * adjacent free areas merged.  Each node is augmented with the size of
+ * the largest free area in its subtree, so the lowest fit of a given
+ * size and alignment is found in O(log n) without walking the holes.
+ */
+static struct rb_root free_vmap_area_root = RB_ROOT;
+
+/*
+ * A spare vmap_area per CPU, preloaded outside the lock for when the
+ * free area an allocation is carved from must be split in two.
+ */
+static DEFINE_PER_CPU(struct vmap_area *, ne_fit_preload_node);
 
 static unsigned long vmap_area_pcpu_hole;
 
@@ -318,9 +330,279 @@ static void __insert_vmap_area(struct vmap_area *va)
 	if (tmp) {
 		struct vmap_area *prev;
 		prev = rb_entry(tmp, struct vmap_area, rb_node);
-		list_add_rcu(&va->list, &prev->list);
+		list_add(&va->list, &prev->list);
 	} else
-		list_add_rcu(&va->list, &vmap_area_list);
+		list_add(&va->list, &vmap_area_list);
+}
+
+static inline unsigned long va_size(struct vmap_area *va)
+{
+	return va->va_end - va->va_start;
+}
+
+static inline unsigned long get_subtree_max_size(struct rb_node *node)
+{
+	return node ? rb_entry(node, struct vmap_area, rb_node)->subtree_max_size
+		    : 0;
+}
+
+static void free_vmap_area_augment_cb(struct rb_node *node, void *unused)
+{
+	struct vmap_area *va;
+
+	if (!node)
+		return;
+
+	va = rb_entry(node, struct vmap_area, rb_node);
+	va->subtree_max_size = max3(va_size(va),
+				    get_subtree_max_size(node->rb_left),
+				    get_subtree_max_size(node->rb_right));
+}
+
+/*
+ * Recompute the augmented sizes from @va up to the root, after @va
+ * itself was resized.
+ */
+static void free_vmap_area_propagate(struct vmap_area *va)
+{
+	rb_augment_erase_end(&va->rb_node, free_vmap_area_augment_cb, NULL);
+}
+
+static void link_free_vmap_area(struct vmap_area *va, struct rb_node *parent,
+				struct rb_node **link)
+{
+	rb_link_node(&va->rb_node, parent, link);
+	rb_insert_color(&va->rb_node, &free_vmap_area_root);
+	rb_augment_insert(&va->rb_node, free_vmap_area_augment_cb, NULL);
+}
+
+static void insert_free_vmap_area(struct vmap_area *va)
+{
+	struct rb_node **p = &free_vmap_area_root.rb_node;
+	struct rb_node *parent = NULL;
+
+	while (*p) {
+		struct vmap_area *tmp_va;
+
+		parent = *p;
+		tmp_va = rb_entry(parent, struct vmap_area, rb_node);
+		if (va->va_end <= tmp_va->va_start)
+			p = &(*p)->rb_left;
+		else if (va->va_start >= tmp_va->va_end)
+			p = &(*p)->rb_right;
+		else
+			BUG();
+	}
+
+	link_free_vmap_area(va, parent, p);
+}
+
+static void unlink_free_vmap_area(struct vmap_area *va)
+{
+	struct rb_node *deepest;
+
+	deepest = rb_augment_erase_begin(&va->rb_node);
+	rb_erase(&va->rb_node, &free_vmap_area_root);
+	rb_augment_erase_end(deepest, free_vmap_area_augment_cb, NULL);
+	RB_CLEAR_NODE(&va->rb_node);
+}
+
+/*
+ * Give a busy area back to the free tree, merging it with the free
+ * areas it touches.  @va is either inserted or freed.
+ */
+static void merge_or_add_free_vmap_area(struct vmap_area *va)
+{
+	struct rb_node **p = &free_vmap_area_root.rb_node;
+	struct rb_node *parent = NULL;
+	struct rb_node *n = NULL;
+	struct vmap_area *prev = NULL, *next = NULL;
+	bool merged = false;
+
+	while (*p) {
+		struct vmap_area *tmp_va;
+
+		parent = *p;
+		tmp_va = rb_entry(parent, struct vmap_area, rb_node);
+		if (va->va_end <= tmp_va->va_start)
+			p = &(*p)->rb_left;
+		else if (va->va_start >= tmp_va->va_end)
+			p = &(*p)->rb_right;
+		else
+			BUG();
+	}
+
+	/* the free areas on either side of @va */
+	if (parent) {
+		if (p == &parent->rb_left) {
+			next = rb_entry(parent, struct vmap_area, rb_node);
+			n = rb_prev(parent);
+			if (n)
+				prev = rb_entry(n, struct vmap_area, rb_node);
+		} else {
+			prev = rb_entry(parent, struct vmap_area, rb_node);
+			n = rb_next(parent);
+			if (n)
+				next = rb_entry(n, struct vmap_area, rb_node);
+		}
+	}
+
+	if (next && next->va_start == va->va_end) {
+		next->va_start = va->va_start;
+		kfree(va);
+		va = next;
+		merged = true;
+	}
+
+	if (prev && prev->va_end == va->va_start) {
+		prev->va_end = va->va_end;
+		if (merged)
+			unlink_free_vmap_area(va);
+		kfree(va);
+		va = prev;
+		merged = true;
+	}
+
+	if (merged)
+		free_vmap_area_propagate(va);
+	else
+		link_free_vmap_area(va, parent, p);
+}
+
+/*
+ * Can a block of @size, aligned to @align and at or above @vstart, be
+ * carved out of the free area @va?
+ */
+static inline bool is_within_this_va(struct vmap_area *va, unsigned long size,
+				     unsigned long align, unsigned long vstart)
+{
+	unsigned long addr;
+
+	addr = ALIGN(max(va->va_start, vstart), align);
+
+	/* can overflow with a big size or alignment */
+	if (addr + size < addr || addr < vstart)
+		return false;
+
+	return addr + size <= va->va_end;
+}
+
+/*
+ * Find the lowest free area a block of @size and @align can be carved
+ * out of, at or above @vstart.  Subtrees whose largest free area is too
+ * small, accounting for the alignment, are skipped.
+ */
+static struct vmap_area *find_vmap_lowest_match(unsigned long size,
+				unsigned long align, unsigned long vstart)
+{
+	struct rb_node *node = free_vmap_area_root.rb_node;
+	unsigned long length = size + align - 1;
+	struct vmap_area *va;
+
+	while (node) {
+		va = rb_entry(node, struct vmap_area, rb_node);
+
+		if (get_subtree_max_size(node->rb_left) >= length &&
+				vstart < va->va_start) {
+			node = node->rb_left;
+			continue;
+		}
+
+		if (is_within_this_va(va, size, align, vstart))
+			return va;
+
+		if (get_subtree_max_size(node->rb_right) >= length) {
+			node = node->rb_right;
+			continue;
+		}
+
+		/*
+		 * Nothing fits below: go back up to the first right subtree
+		 * that is big enough.  Those lie wholly above vstart, so
+		 * this happens at most once.
+		 */
+		while ((node = rb_parent(node))) {
+			va = rb_entry(node, struct vmap_area, rb_node);
+			if (is_within_this_va(va, size, align, vstart))
+				return va;
+
+			if (get_subtree_max_size(node->rb_right) >= length &&
+					vstart <= va->va_start) {
+				node = node->rb_right;
+				break;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Take [@start, @start + @size) out of the free area @va, which must
+ * contain it.  Returns 0, or -ENOMEM if @va had to be split and there
+ * was no vmap_area to spare.
+ */
+static int carve_free_vmap_area(struct vmap_area *va, unsigned long start,
+				unsigned long size)
+{
+	unsigned long end = start + size;
+	struct vmap_area *lva;
+
+	BUG_ON(start < va->va_start || end > va->va_end);
+
+	if (start == va->va_start && end == va->va_end) {
+		/* the whole area */
+		unlink_free_vmap_area(va);
+		kfree(va);
+		return 0;
+	}
+
+	if (start == va->va_start) {
+		/* the left edge */
+		va->va_start = end;
+	} else if (end == va->va_end) {
+		/* the right edge */
+		va->va_end = start;
+	} else {
+		/* the middle: split into two free areas */
+		lva = __this_cpu_xchg(ne_fit_preload_node, NULL);
+		if (unlikely(!lva)) {
+			lva = kmalloc(sizeof(struct vmap_area), GFP_NOWAIT);
+			if (!lva)
+				return -ENOMEM;
+		}
+		lva->va_start = va->va_start;
+		lva->va_end = start;
+		va->va_start = end;
+		free_vmap_area_propagate(va);
+		insert_free_vmap_area(lva);
+		return 0;
+	}
+
+	free_vmap_area_propagate(va);
+	return 0;
+}
+
+/*
+ * Find the free area enclosing @addr.
+ */
+static struct vmap_area *find_free_vmap_area(unsigned long addr)
+{
+	struct rb_node *n = free_vmap_area_root.rb_node;
+
+	while (n) {
+		struct vmap_area *va;
+
+		va = rb_entry(n, struct vmap_area, rb_node);
+		if (addr < va->va_start)
+			n = n->rb_left;
+		else if (addr >= va->va_end)
+			n = n->rb_right;
+		else
+			return va;
+	}
+
+	return NULL;
 }
 
 static void purge_vmap_area_lazy(void);
@@ -334,11 +616,9 @@ static struct vmap_area *alloc_vmap_area(unsigned long size,
 				unsigned long vstart, unsigned long vend,
 				int node, gfp_t gfp_mask)
 {
-	struct vmap_area *va;
-	struct rb_node *n;
+	struct vmap_area *va, *free;
 	unsigned long addr;
 	int purged = 0;
-	struct vmap_area *first;
 
 	BUG_ON(!size);
 	BUG_ON(size & ~PAGE_MASK);
@@ -350,85 +630,40 @@ static struct vmap_area *alloc_vmap_area(unsigned long size,
 		return ERR_PTR(-ENOMEM);
 
 retry:
-	spin_lock(&vmap_area_lock);
 	/*
-	 * Invalidate cache if we have more permissive parameters.
-	 * cached_hole_size notes the largest hole noticed _below_
-	 * the vmap_area cached in free_vmap_cache: if size fits
-	 * into that hole, we want to scan from vstart to reuse
-	 * the hole instead of allocating above free_vmap_cache.
-	 * Note that __free_vmap_area may update free_vmap_cache
-	 * without updating cached_hole_size or cached_align.
+	 * Preload the spare area for a split.  If that fails, the split
+	 * still tries GFP_NOWAIT under the lock.
 	 */
-	if (!free_vmap_cache ||
-			size < cached_hole_size ||
-			vstart < cached_vstart ||
-			align < cached_align) {
-nocache:
-		cached_hole_size = 0;
-		free_vmap_cache = NULL;
+	preempt_disable();
+	if (!__this_cpu_read(ne_fit_preload_node)) {
+		struct vmap_area *pva;
+
+		preempt_enable();
+		pva = kmalloc_node(sizeof(struct vmap_area),
+				gfp_mask & GFP_RECLAIM_MASK, node);
+		preempt_disable();
+		if (pva && __this_cpu_cmpxchg(ne_fit_preload_node, NULL, pva))
+			kfree(pva);
 	}
-	/* record if we encounter less permissive parameters */
-	cached_vstart = vstart;
-	cached_align = align;
-
-	/* find starting point for our search */
-	if (free_vmap_cache) {
-		first = rb_entry(free_vmap_cache, struct vmap_area, rb_node);
-		addr = ALIGN(first->va_end, align);
-		if (addr < vstart)
-			goto nocache;
-		if (addr + size - 1 < addr)
-			goto overflow;
-
-	} else {
-		addr = ALIGN(vstart, align);
-		if (addr + size - 1 < addr)
-			goto overflow;
-
-		n = vmap_area_root.rb_node;
-		first = NULL;
-
-		while (n) {
-			struct vmap_area *tmp;
-			tmp = rb_entry(n, struct vmap_area, rb_node);
-			if (tmp->va_end >= addr) {
-				first = tmp;
-				if (tmp->va_start <= addr)
-					break;
-				n = n->rb_left;
-			} else
-				n = n->rb_right;
-		}
 
-		if (!first)
-			goto found;
-	}
+	spin_lock(&vmap_area_lock);
+	preempt_enable();
 
-	/* from the starting point, walk areas until a suitable hole is found */
-	while (addr + size > first->va_start && addr + size <= vend) {
-		if (addr + cached_hole_size < first->va_start)
-			cached_hole_size = first->va_start - addr;
-		addr = ALIGN(first->va_end, align);
-		if (addr + size - 1 < addr)
-			goto overflow;
-
-		n = rb_next(&first->rb_node);
-		if (n)
-			first = rb_entry(n, struct vmap_area, rb_node);
-		else
-			goto found;
-	}
+	free = find_vmap_lowest_match(size, align, vstart);
+	if (!free)
+		goto overflow;
 
-found:
+	addr = ALIGN(max(free->va_start, vstart), align);
 	if (addr + size > vend)
 		goto overflow;
 
+	if (carve_free_vmap_area(free, addr, size))
+		goto overflow;
+
 	va->va_start = addr;
 	va->va_end = addr + size;
 	va->flags = 0;
 	__insert_vmap_area(va);
-	free_vmap_cache = &va->rb_node;
 	spin_unlock(&vmap_area_lock);
 
 	BUG_ON(va->va_start & (align-1));
@@ -456,24 +691,9 @@ static void __free_vmap_area(struct vmap_area *va)
 {
 	BUG_ON(RB_EMPTY_NODE(&va->rb_node));
 
-	if (free_vmap_cache) {
-		if (va->va_end < cached_vstart) {
-			free_vmap_cache = NULL;
-		} else {
-			struct vmap_area *cache;
-			cache = rb_entry(free_vmap_cache, struct vmap_area, rb_node);
-			if (va->va_start <= cache->va_start) {
-				free_vmap_cache = rb_prev(&va->rb_node);
-				/*
-				 * We don't try to update cached_hole_size or
-				 * cached_align, but it won't go very wrong.
-				 */
-			}
-		}
-	}
 	rb_erase(&va->rb_node, &vmap_area_root);
 	RB_CLEAR_NODE(&va->rb_node);
-	list_del_rcu(&va->list);
+	list_del(&va->list);
 
 	/*
 	 * Track the highest possible candidate for pcpu area
@@ -484,7 +704,7 @@ static void __free_vmap_area(struct vmap_area *va)
 	if (va->va_end > VMALLOC_START && va->va_end <= VMALLOC_END)
 		vmap_area_pcpu_hole = max(vmap_area_pcpu_hole, va->va_end);
 
-	kfree_rcu(va, rcu_head);
+	merge_or_add_free_vmap_area(va);
 }
 
 /*
@@ -552,6 +772,7 @@ static unsigned long lazy_max_pages(void)
 }
 
 static atomic_t vmap_lazy_nr = ATOMIC_INIT(0);
+static LLIST_HEAD(vmap_purge_list);
 
 /* for per-CPU blocks */
 static void purge_fragmented_blocks_allcpus(void);
@@ -565,6 +786,12 @@ void set_iounmap_nonlazy(void)
 	atomic_set(&vmap_lazy_nr, lazy_max_pages()+1);
 }
 
+/*
+ * Lazily freed areas given back to the free tree under one hold of
+ * vmap_area_lock, before allocators get a chance at it.
+ */
+#define VMAP_PURGE_BATCH	32
+
 /*
  * Purges all lazily-freed vmap areas.
  *
@@ -579,10 +806,10 @@ static void __purge_vmap_area_lazy(unsigned long *start, unsigned long *end,
 					int sync, int force_flush)
 {
 	static DEFINE_SPINLOCK(purge_lock);
-	LIST_HEAD(valist);
+	struct llist_node *valist, *n;
 	struct vmap_area *va;
-	struct vmap_area *n_va;
 	int nr = 0;
+	int batch = 0;
 
 	/*
 	 * If sync is 0 but force_flush is 1, we'll go sync anyway but callers
@@ -598,20 +825,15 @@ static void __purge_vmap_area_lazy(unsigned long *start, unsigned long *end,
 	if (sync)
 		purge_fragmented_blocks_allcpus();
 
-	rcu_read_lock();
-	list_for_each_entry_rcu(va, &vmap_area_list, list) {
-		if (va->flags & VM_LAZY_FREE) {
-			if (va->va_start < *start)
-				*start = va->va_start;
-			if (va->va_end > *end)
-				*end = va->va_end;
-			nr += (va->va_end - va->va_start) >> PAGE_SHIFT;
-			list_add_tail(&va->purge_list, &valist);
-			va->flags |= VM_LAZY_FREEING;
-			va->flags &= ~VM_LAZY_FREE;
-		}
+	valist = llist_del_all(&vmap_purge_list);
+	for (n = valist; n; n = n->next) {
+		va = llist_entry(n, struct vmap_area, purge_list);
+		if (va->va_start < *start)
+			*start = va->va_start;
+		if (va->va_end > *end)
+			*end = va->va_end;
+		nr += (va->va_end - va->va_start) >> PAGE_SHIFT;
 	}
-	rcu_read_unlock();
 
 	if (nr)
 		atomic_sub(nr, &vmap_lazy_nr);
@@ -621,8 +843,18 @@ static void __purge_vmap_area_lazy(unsigned long *start, unsigned long *end,
 
 	if (nr) {
 		spin_lock(&vmap_area_lock);
-		list_for_each_entry_safe(va, n_va, &valist, purge_list)
+		while (valist) {
+			va = llist_entry(valist, struct vmap_area, purge_list);
+			valist = valist->next;
 			__free_vmap_area(va);
+
+			if (++batch == VMAP_PURGE_BATCH && valist) {
+				spin_unlock(&vmap_area_lock);
+				cpu_relax();
+				spin_lock(&vmap_area_lock);
+				batch = 0;
+			}
+		}
 		spin_unlock(&vmap_area_lock);
 	}
 	spin_unlock(&purge_lock);
@@ -656,9 +888,12 @@ static void purge_vmap_area_lazy(void)
  */
 static void free_vmap_area_noflush(struct vmap_area *va)
 {
-	va->flags |= VM_LAZY_FREE;
-	atomic_add((va->va_end - va->va_start) >> PAGE_SHIFT, &vmap_lazy_nr);
-	if (unlikely(atomic_read(&vmap_lazy_nr) > lazy_max_pages()))
+	int nr_lazy;
+
+	nr_lazy = atomic_add_return((va->va_end - va->va_start) >> PAGE_SHIFT,
+				    &vmap_lazy_nr);
+	llist_add(&va->purge_list, &vmap_purge_list);
+	if (unlikely(nr_lazy > lazy_max_pages()))
 		try_purge_vmap_area_lazy();
 }
 
@@ -1168,6 +1403,40 @@ void __init vm_area_register_early(struct vm_struct *vm, size_t align)
 	vm_area_add_early(vm);
 }
 
+/*
+ * Seed the free tree with the holes between the areas imported from
+ * the early vmlist: everything else is free.
+ */
+static void __init vmap_init_free_space(void)
+{
+	unsigned long vmap_start = 1;
+	const unsigned long vmap_end = ULONG_MAX;
+	struct vmap_area *busy, *free;
+
+	list_for_each_entry(busy, &vmap_area_list, list) {
+		if (busy->va_start > vmap_start) {
+			free = kzalloc(sizeof(struct vmap_area), GFP_NOWAIT);
+			if (WARN_ON_ONCE(!free))
+				return;
+
+			free->va_start = vmap_start;
+			free->va_end = busy->va_start;
+			insert_free_vmap_area(free);
+		}
+		vmap_start = busy->va_end;
+	}
+
+	if (vmap_end > vmap_start) {
+		free = kzalloc(sizeof(struct vmap_area), GFP_NOWAIT);
+		if (WARN_ON_ONCE(!free))
+			return;
+
+		free->va_start = vmap_start;
+		free->va_end = vmap_end;
+		insert_free_vmap_area(free);
+	}
+}
+
 void __init vmalloc_init(void)
 {
 	struct vmap_area *va;
@@ -1191,6 +1460,7 @@ void __init vmalloc_init(void)
 		va->vm = tmp;
 		__insert_vmap_area(va);
 	}
+	vmap_init_free_space();
 
 	vmap_area_pcpu_hole = VMALLOC_END;
 
@@ -2454,12 +2724,19 @@ retry:
 		pvm_find_next_prev(base + end, &next, &prev);
 	}
 found:
-	/* we've found a fitting base, insert all va's */
+	/* we've found a fitting base, carve and insert all va's */
 	for (area = 0; area < nr_vms; area++) {
 		struct vmap_area *va = vas[area];
+		struct vmap_area *free;
+
+		start = base + offsets[area];
+		free = find_free_vmap_area(start);
+		if (WARN_ON_ONCE(!free) ||
+		    carve_free_vmap_area(free, start, sizes[area]))
+			goto err_unwind;
 
-		va->va_start = base + offsets[area];
-		va->va_end = va->va_start + sizes[area];
+		va->va_start = start;
+		va->va_end = start + sizes[area];
 		__insert_vmap_area(va);
 	}
 
@@ -2475,6 +2752,17 @@ found:
 	kfree(vas);
 	return vms;
 
+err_unwind:
+	/* the areas inserted so far go back to the free tree with their va */
+	for (area2 = 0; area2 < area; area2++)
+		__free_vmap_area(vas[area2]);
+	spin_unlock(&vmap_area_lock);
+	for (; area < nr_vms; area++)
+		kfree(vas[area]);
+	for (area = 0; area < nr_vms; area++)
+		kfree(vms[area]);
+	goto err_free2;
+
 err_free:
 	for (area = 0; area < nr_vms; area++) {
 		kfree(vas[area]);
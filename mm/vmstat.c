@@ -739,6 +739,10 @@ const char * const vmstat_text[] = {
 
 	"pgfault",
 	"pgmajfault",
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	"speculative_pgfault",
+	"speculative_pgfault_retry",
+#endif
 
 	TEXTS_FOR_ZONES("pgrefill")
 	TEXTS_FOR_ZONES("pgsteal_kswapd")
@@ -760,6 +764,13 @@ const char * const vmstat_text[] = {
 
 	"pgrotated",
 
+#ifdef CONFIG_NUMA_BALANCING
+	"numa_pte_updates",
+	"numa_hint_faults",
+	"numa_hint_faults_local",
+	"numa_pages_migrated",
+#endif
+
 #ifdef CONFIG_COMPACTION
 	"compact_blocks_moved",
 	"compact_pages_moved",
@@ -788,6 +799,9 @@ const char * const vmstat_text[] = {
 	"thp_collapse_alloc",
 	"thp_collapse_alloc_failed",
 	"thp_split",
+	"thp_file_alloc",
+	"thp_file_fallback",
+	"thp_file_mapped",
 #endif
 
 #endif /* CONFIG_VM_EVENTS_COUNTERS */
@@ -1018,6 +1032,15 @@ static void zoneinfo_show_print(struct seq_file *m, pg_data_t *pgdat,
 				pageset->stat_threshold);
 #endif
 	}
+	for (i = 0; i < NR_LRU_SPLIT; i++) {
+		enum lru_list lru;
+
+		seq_printf(m, "\n  lru sublist: %i", i);
+		for_each_lru(lru)
+			seq_printf(m, "\n    %-12s %lu",
+				   vmstat_text[NR_LRU_BASE + lru],
+				   zone->lru_split[i].nr_pages[lru]);
+	}
 	seq_printf(m,
 		   "\n  all_unreclaimable: %u"
 		   "\n  start_pfn:         %lu"
@@ -39,6 +39,7 @@
 #include <linux/reciprocal_div.h>
 #include <linux/ratelimit.h>
 #include <linux/seccomp.h>
+#include <linux/bpf.h>
 
 /* No hurry in this branch
  *
@@ -346,7 +347,7 @@ load_b:
 				return 0;
 
 			nla = (struct nlattr *)&skb->data[A];
-			if (nla->nla_len > A - skb->len)
+			if (nla->nla_len > skb->len - A)
 				return 0;
 
 			nla = nla_find_nested(nla, X);
@@ -586,6 +587,486 @@ int sk_chk_filter(struct sock_filter *filter, unsigned int flen)
 }
 EXPORT_SYMBOL(sk_chk_filter);
 
+/* Helpers called from converted programs for the ancillary loads that
+ * have no single instruction equivalent.  The extended calling
+ * convention passes ctx, A and X in the first three argument registers.
+ * A return value of ~0 makes the program return 0, as sk_run_filter()
+ * does on the same conditions.
+ */
+static u64 __skb_get_pkt_type(u64 ctx, u64 a, u64 x, u64 r4, u64 r5)
+{
+	struct sk_buff *skb = (struct sk_buff *)(unsigned long) ctx;
+
+	return skb->pkt_type;
+}
+
+static u64 __skb_get_nlattr(u64 ctx, u64 a, u64 x, u64 r4, u64 r5)
+{
+	struct sk_buff *skb = (struct sk_buff *)(unsigned long) ctx;
+	struct nlattr *nla;
+
+	if (skb_is_nonlinear(skb))
+		return ~0ULL;
+	if (skb->len < sizeof(struct nlattr) ||
+	    a > skb->len - sizeof(struct nlattr))
+		return ~0ULL;
+
+	nla = nla_find((struct nlattr *)&skb->data[a], skb->len - a, x);
+	if (nla)
+		return (void *)nla - (void *)skb->data;
+	return 0;
+}
+
+static u64 __skb_get_nlattr_nest(u64 ctx, u64 a, u64 x, u64 r4, u64 r5)
+{
+	struct sk_buff *skb = (struct sk_buff *)(unsigned long) ctx;
+	struct nlattr *nla;
+
+	if (skb_is_nonlinear(skb))
+		return ~0ULL;
+	if (skb->len < sizeof(struct nlattr) ||
+	    a > skb->len - sizeof(struct nlattr))
+		return ~0ULL;
+
+	nla = (struct nlattr *)&skb->data[a];
+	if (nla->nla_len > skb->len - a)
+		return ~0ULL;
+
+	nla = nla_find_nested(nla, x);
+	if (nla)
+		return (void *)nla - (void *)skb->data;
+	return 0;
+}
+
+static u64 __get_raw_cpu_id(u64 ctx, u64 a, u64 x, u64 r4, u64 r5)
+{
+	return raw_smp_processor_id();
+}
+
+/* Emit a call to one of the helpers above with ctx, A and X loaded. */
+static struct bpf_insn *convert_anc_call(struct bpf_insn *insn,
+					 u64 (*func)(u64, u64, u64, u64, u64),
+					 bool may_abort)
+{
+	*insn++ = BPF_MOV64_REG(BPF_REG_ARG1, BPF_REG_CTX);
+	*insn++ = BPF_MOV64_REG(BPF_REG_ARG2, BPF_REG_A);
+	*insn++ = BPF_MOV64_REG(BPF_REG_ARG3, BPF_REG_X);
+	*insn++ = BPF_EMIT_CALL(func);
+	if (may_abort) {
+		*insn++ = BPF_JMP_IMM(BPF_JNE, BPF_REG_A, -1, 2);
+		*insn++ = BPF_MOV32_IMM(BPF_REG_A, 0);
+		*insn++ = BPF_EXIT_INSN();
+	}
+	return insn;
+}
+
+/* Load a net_device field into A, returning 0 from the program when
+ * skb->dev is NULL.
+ */
+static struct bpf_insn *convert_dev_load(struct bpf_insn *insn,
+					 int size, int off)
+{
+	*insn++ = BPF_LDX_MEM(bytes_to_bpf_size(sizeof(void *)),
+			      BPF_REG_TMP, BPF_REG_CTX,
+			      offsetof(struct sk_buff, dev));
+	*insn++ = BPF_JMP_IMM(BPF_JNE, BPF_REG_TMP, 0, 2);
+	*insn++ = BPF_MOV32_IMM(BPF_REG_A, 0);
+	*insn++ = BPF_EXIT_INSN();
+	*insn++ = BPF_LDX_MEM(size, BPF_REG_A, BPF_REG_TMP, off);
+	return insn;
+}
+
+/* Classic scratch memory M[k] lives at the top of the extended stack. */
+#define BPF_MEM_OFF(k)	(-(int)(BPF_MEMWORDS - (k)) * 4)
+
+/**
+ *	sk_convert_filter - convert filter program
+ *	@prog: the user passed filter program, already checked by sk_chk_filter()
+ *	@len: the length of the user passed filter program
+ *	@new_prog: buffer where converted program will be stored
+ *	@new_len: pointer to store length of converted program
+ *
+ * Remap 'sock_filter' style classic BPF instruction set to the extended
+ * one: A lives in R0, X in R7, the context in R6 and the sixteen scratch
+ * words on the stack.
+ *
+ * Conversion workflow:
+ *
+ * 1) First pass for calculating the new program length:
+ *   sk_convert_filter(old_prog, old_len, NULL, &new_len)
+ *
+ * 2) 2nd call to remap, internally does two passes, the first one to
+ *    compute the jump offsets, the second one to emit them:
+ *   sk_convert_filter(old_prog, old_len, new_prog, &new_len);
+ */
+int sk_convert_filter(struct sock_filter *prog, int len,
+		      struct bpf_insn *new_prog, int *new_len)
+{
+	int new_flen = 0, pass = 0, target, i;
+	struct bpf_insn *new_insn;
+	struct sock_filter *fp;
+	int *addrs = NULL;
+	u8 bpf_src;
+
+	BUILD_BUG_ON(BPF_MEMWORDS * sizeof(u32) > MAX_BPF_STACK);
+	BUILD_BUG_ON(BPF_REG_FP + 1 != MAX_BPF_REG);
+	BUILD_BUG_ON(sizeof(struct sock_filter) != sizeof(struct bpf_insn));
+
+	if (len <= 0 || len > BPF_MAXINSNS)
+		return -EINVAL;
+
+	if (new_prog) {
+		addrs = kcalloc(len, sizeof(*addrs), GFP_KERNEL);
+		if (!addrs)
+			return -ENOMEM;
+	}
+
+do_pass:
+	new_insn = new_prog;
+	fp = prog;
+
+	/* ctx into R6, classic A and X start out as zero */
+	if (new_insn) {
+		new_insn[0] = BPF_MOV64_REG(BPF_REG_CTX, BPF_REG_ARG1);
+		new_insn[1] = BPF_ALU32_REG(BPF_XOR, BPF_REG_A, BPF_REG_A);
+		new_insn[2] = BPF_ALU32_REG(BPF_XOR, BPF_REG_X, BPF_REG_X);
+	}
+	new_insn += 3;
+
+	for (i = 0; i < len; fp++, i++) {
+		struct bpf_insn tmp_insns[8] = { };
+		struct bpf_insn *insn = tmp_insns;
+
+		if (addrs)
+			addrs[i] = new_insn - new_prog;
+
+		switch (fp->code) {
+		/* All arithmetic insns and skb loads map as-is. */
+		case BPF_S_ALU_ADD_X:
+		case BPF_S_ALU_ADD_K:
+		case BPF_S_ALU_SUB_X:
+		case BPF_S_ALU_SUB_K:
+		case BPF_S_ALU_AND_X:
+		case BPF_S_ALU_AND_K:
+		case BPF_S_ALU_OR_X:
+		case BPF_S_ALU_OR_K:
+		case BPF_S_ALU_LSH_X:
+		case BPF_S_ALU_LSH_K:
+		case BPF_S_ALU_RSH_X:
+		case BPF_S_ALU_RSH_K:
+		case BPF_S_ALU_MUL_X:
+		case BPF_S_ALU_MUL_K:
+		case BPF_S_ALU_DIV_X: {
+			static const u8 ops[] = {
+				[BPF_S_ALU_ADD_X] = BPF_ADD,
+				[BPF_S_ALU_ADD_K] = BPF_ADD,
+				[BPF_S_ALU_SUB_X] = BPF_SUB,
+				[BPF_S_ALU_SUB_K] = BPF_SUB,
+				[BPF_S_ALU_AND_X] = BPF_AND,
+				[BPF_S_ALU_AND_K] = BPF_AND,
+				[BPF_S_ALU_OR_X]  = BPF_OR,
+				[BPF_S_ALU_OR_K]  = BPF_OR,
+				[BPF_S_ALU_LSH_X] = BPF_LSH,
+				[BPF_S_ALU_LSH_K] = BPF_LSH,
+				[BPF_S_ALU_RSH_X] = BPF_RSH,
+				[BPF_S_ALU_RSH_K] = BPF_RSH,
+				[BPF_S_ALU_MUL_X] = BPF_MUL,
+				[BPF_S_ALU_MUL_K] = BPF_MUL,
+				[BPF_S_ALU_DIV_X] = BPF_DIV,
+			};
+
+			switch (fp->code) {
+			case BPF_S_ALU_ADD_X:
+			case BPF_S_ALU_SUB_X:
+			case BPF_S_ALU_AND_X:
+			case BPF_S_ALU_OR_X:
+			case BPF_S_ALU_LSH_X:
+			case BPF_S_ALU_RSH_X:
+			case BPF_S_ALU_MUL_X:
+			case BPF_S_ALU_DIV_X:
+				*insn = BPF_ALU32_REG(ops[fp->code], BPF_REG_A,
+						      BPF_REG_X);
+				break;
+			default:
+				*insn = BPF_ALU32_IMM(ops[fp->code], BPF_REG_A,
+						      fp->k);
+				break;
+			}
+			break;
+		}
+		case BPF_S_ANC_ALU_XOR_X:
+			*insn = BPF_ALU32_REG(BPF_XOR, BPF_REG_A, BPF_REG_X);
+			break;
+
+		case BPF_S_ALU_DIV_K:
+			/* sk_chk_filter() replaced k by its reciprocal */
+			*insn++ = BPF_MOV32_IMM(BPF_REG_TMP, fp->k);
+			*insn++ = BPF_ALU64_REG(BPF_MUL, BPF_REG_A, BPF_REG_TMP);
+			*insn = BPF_ALU64_IMM(BPF_RSH, BPF_REG_A, 32);
+			break;
+
+		case BPF_S_ALU_NEG:
+			*insn = BPF_ALU32_IMM(BPF_NEG, BPF_REG_A, 0);
+			break;
+
+		case BPF_S_LD_W_ABS:
+			*insn = BPF_LD_ABS(BPF_W, fp->k);
+			break;
+		case BPF_S_LD_H_ABS:
+			*insn = BPF_LD_ABS(BPF_H, fp->k);
+			break;
+		case BPF_S_LD_B_ABS:
+			*insn = BPF_LD_ABS(BPF_B, fp->k);
+			break;
+		case BPF_S_LD_W_IND:
+			*insn = BPF_LD_IND(BPF_W, BPF_REG_X, fp->k);
+			break;
+		case BPF_S_LD_H_IND:
+			*insn = BPF_LD_IND(BPF_H, BPF_REG_X, fp->k);
+			break;
+		case BPF_S_LD_B_IND:
+			*insn = BPF_LD_IND(BPF_B, BPF_REG_X, fp->k);
+			break;
+
+		/* X = 4 * (P[k] & 0xf), A is preserved */
+		case BPF_S_LDX_B_MSH:
+			*insn++ = BPF_MOV64_REG(BPF_REG_TMP, BPF_REG_A);
+			*insn++ = BPF_LD_ABS(BPF_B, fp->k);
+			*insn++ = BPF_ALU32_IMM(BPF_AND, BPF_REG_A, 0xf);
+			*insn++ = BPF_ALU32_IMM(BPF_LSH, BPF_REG_A, 2);
+			*insn++ = BPF_MOV64_REG(BPF_REG_X, BPF_REG_A);
+			*insn = BPF_MOV64_REG(BPF_REG_A, BPF_REG_TMP);
+			break;
+
+		case BPF_S_LD_W_LEN:
+			*insn = BPF_LDX_MEM(BPF_W, BPF_REG_A, BPF_REG_CTX,
+					    offsetof(struct sk_buff, len));
+			break;
+		case BPF_S_LDX_W_LEN:
+			*insn = BPF_LDX_MEM(BPF_W, BPF_REG_X, BPF_REG_CTX,
+					    offsetof(struct sk_buff, len));
+			break;
+
+		case BPF_S_LD_IMM:
+			*insn = BPF_MOV32_IMM(BPF_REG_A, fp->k);
+			break;
+		case BPF_S_LDX_IMM:
+			*insn = BPF_MOV32_IMM(BPF_REG_X, fp->k);
+			break;
+
+		case BPF_S_MISC_TAX:
+			*insn = BPF_MOV32_REG(BPF_REG_X, BPF_REG_A);
+			break;
+		case BPF_S_MISC_TXA:
+			*insn = BPF_MOV32_REG(BPF_REG_A, BPF_REG_X);
+			break;
+
+		case BPF_S_LD_MEM:
+			*insn = BPF_LDX_MEM(BPF_W, BPF_REG_A, BPF_REG_FP,
+					    BPF_MEM_OFF(fp->k));
+			break;
+		case BPF_S_LDX_MEM:
+			*insn = BPF_LDX_MEM(BPF_W, BPF_REG_X, BPF_REG_FP,
+					    BPF_MEM_OFF(fp->k));
+			break;
+		case BPF_S_ST:
+			*insn = BPF_STX_MEM(BPF_W, BPF_REG_FP, BPF_REG_A,
+					    BPF_MEM_OFF(fp->k));
+			break;
+		case BPF_S_STX:
+			*insn = BPF_STX_MEM(BPF_W, BPF_REG_FP, BPF_REG_X,
+					    BPF_MEM_OFF(fp->k));
+			break;
+
+		case BPF_S_RET_K:
+			*insn++ = BPF_MOV32_IMM(BPF_REG_A, fp->k);
+			*insn = BPF_EXIT_INSN();
+			break;
+		case BPF_S_RET_A:
+			*insn = BPF_EXIT_INSN();
+			break;
+
+		case BPF_S_JMP_JA:
+			target = i + fp->k + 1;
+			insn->code = BPF_JMP | BPF_JA;
+			if (addrs)
+				insn->off = addrs[target] - addrs[i] -
+					    (insn - tmp_insns) - 1;
+			break;
+
+		case BPF_S_JMP_JEQ_K:
+		case BPF_S_JMP_JEQ_X:
+		case BPF_S_JMP_JSET_K:
+		case BPF_S_JMP_JSET_X:
+		case BPF_S_JMP_JGT_K:
+		case BPF_S_JMP_JGT_X:
+		case BPF_S_JMP_JGE_K:
+		case BPF_S_JMP_JGE_X: {
+			u8 op;
+
+			switch (fp->code) {
+			case BPF_S_JMP_JEQ_K:
+			case BPF_S_JMP_JEQ_X:
+				op = BPF_JEQ;
+				break;
+			case BPF_S_JMP_JSET_K:
+			case BPF_S_JMP_JSET_X:
+				op = BPF_JSET;
+				break;
+			case BPF_S_JMP_JGT_K:
+			case BPF_S_JMP_JGT_X:
+				op = BPF_JGT;
+				break;
+			default:
+				op = BPF_JGE;
+				break;
+			}
+
+			switch (fp->code) {
+			case BPF_S_JMP_JEQ_X:
+			case BPF_S_JMP_JSET_X:
+			case BPF_S_JMP_JGT_X:
+			case BPF_S_JMP_JGE_X:
+				bpf_src = BPF_X;
+				insn->src_reg = BPF_REG_X;
+				break;
+			default:
+				if ((int) fp->k < 0) {
+					/* Immediates are sign extended,
+					 * compare against a zero extended
+					 * copy of k instead.
+					 */
+					*insn++ = BPF_MOV32_IMM(BPF_REG_TMP,
+								fp->k);
+					bpf_src = BPF_X;
+					insn->src_reg = BPF_REG_TMP;
+				} else {
+					bpf_src = BPF_K;
+					insn->imm = fp->k;
+				}
+				break;
+			}
+			insn->dst_reg = BPF_REG_A;
+
+#define BPF_JMP_OFF(t)						\
+	(addrs ? addrs[(t)] - addrs[i] - (insn - tmp_insns) - 1 : 0)
+
+			/* Common case where 'jump_false' is next insn. */
+			if (fp->jf == 0) {
+				insn->code = BPF_JMP | op | bpf_src;
+				target = i + fp->jt + 1;
+				insn->off = BPF_JMP_OFF(target);
+				break;
+			}
+
+			/* Convert JEQ into JNE when 'jump_true' is next insn. */
+			if (fp->jt == 0 && op == BPF_JEQ) {
+				insn->code = BPF_JMP | BPF_JNE | bpf_src;
+				target = i + fp->jf + 1;
+				insn->off = BPF_JMP_OFF(target);
+				break;
+			}
+
+			/* Other jumps are mapped into two insns: Jxx and JA. */
+			target = i + fp->jt + 1;
+			insn->code = BPF_JMP | op | bpf_src;
+			insn->off = BPF_JMP_OFF(target);
+			insn++;
+
+			insn->code = BPF_JMP | BPF_JA;
+			target = i + fp->jf + 1;
+			insn->off = BPF_JMP_OFF(target);
+#undef BPF_JMP_OFF
+			break;
+		}
+
+		case BPF_S_ANC_PROTOCOL:
+			*insn++ = BPF_LDX_MEM(BPF_H, BPF_REG_A, BPF_REG_CTX,
+					      offsetof(struct sk_buff, protocol));
+			/* A = ntohs(A) [emitting a nop or swap16] */
+			*insn = BPF_ENDIAN(BPF_FROM_BE, BPF_REG_A, 16);
+			break;
+		case BPF_S_ANC_PKTTYPE:
+			insn = convert_anc_call(insn, __skb_get_pkt_type, false);
+			insn--;
+			break;
+		case BPF_S_ANC_IFINDEX:
+			BUILD_BUG_ON(FIELD_SIZEOF(struct net_device, ifindex) != 4);
+			insn = convert_dev_load(insn, BPF_W,
+					offsetof(struct net_device, ifindex));
+			insn--;
+			break;
+		case BPF_S_ANC_HATYPE:
+			BUILD_BUG_ON(FIELD_SIZEOF(struct net_device, type) != 2);
+			insn = convert_dev_load(insn, BPF_H,
+					offsetof(struct net_device, type));
+			insn--;
+			break;
+		case BPF_S_ANC_NLATTR:
+			insn = convert_anc_call(insn, __skb_get_nlattr, true);
+			insn--;
+			break;
+		case BPF_S_ANC_NLATTR_NEST:
+			insn = convert_anc_call(insn, __skb_get_nlattr_nest, true);
+			insn--;
+			break;
+		case BPF_S_ANC_MARK:
+			BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, mark) != 4);
+			*insn = BPF_LDX_MEM(BPF_W, BPF_REG_A, BPF_REG_CTX,
+					    offsetof(struct sk_buff, mark));
+			break;
+		case BPF_S_ANC_QUEUE:
+			BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, queue_mapping) != 2);
+			*insn = BPF_LDX_MEM(BPF_H, BPF_REG_A, BPF_REG_CTX,
+					    offsetof(struct sk_buff, queue_mapping));
+			break;
+		case BPF_S_ANC_RXHASH:
+			BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, rxhash) != 4);
+			*insn = BPF_LDX_MEM(BPF_W, BPF_REG_A, BPF_REG_CTX,
+					    offsetof(struct sk_buff, rxhash));
+			break;
+		case BPF_S_ANC_CPU:
+			insn = convert_anc_call(insn, __get_raw_cpu_id, false);
+			insn--;
+			break;
+
+		default:
+			/* BPF_S_ANC_SECCOMP_LD_W and friends have no
+			 * socket filter counterpart.
+			 */
+			goto err;
+		}
+
+		insn++;
+		if (new_prog)
+			memcpy(new_insn, tmp_insns,
+			       sizeof(*insn) * (insn - tmp_insns));
+		new_insn += insn - tmp_insns;
+	}
+
+	if (!new_prog) {
+		/* Only calculating new length. */
+		*new_len = new_insn - new_prog;
+		return 0;
+	}
+
+	pass++;
+	if (new_flen != new_insn - new_prog) {
+		new_flen = new_insn - new_prog;
+		if (pass > 2)
+			goto err;
+		goto do_pass;
+	}
+
+	kfree(addrs);
+	BUG_ON(*new_len != new_flen);
+	return 0;
+err:
+	kfree(addrs);
+	return -EINVAL;
+}
+EXPORT_SYMBOL_GPL(sk_convert_filter);
+
 /**
  * 	sk_filter_release_rcu - Release a socket filter by rcu_head
  *	@rcu: rcu_head that contains the sk_filter to free
@@ -594,23 +1075,125 @@ void sk_filter_release_rcu(struct rcu_head *rcu)
 {
 	struct sk_filter *fp = container_of(rcu, struct sk_filter, rcu);
 
+	bpf_prog_free_aux(fp);
 	bpf_jit_free(fp);
 	kfree(fp);
 }
 EXPORT_SYMBOL(sk_filter_release_rcu);
 
-static int __sk_prepare_filter(struct sk_filter *fp)
+static void __sk_filter_free(struct sk_filter *fp, struct sock *sk)
+{
+	if (sk)
+		sk_filter_uncharge(sk, fp);
+	else
+		kfree(fp);
+}
+
+static struct sk_filter *__sk_migrate_realloc(struct sk_filter *fp,
+					      struct sock *sk,
+					      unsigned int len)
+{
+	struct sk_filter *fp_new;
+
+	if (sk == NULL)
+		return krealloc(fp, len, GFP_KERNEL);
+
+	fp_new = sock_kmalloc(sk, len, GFP_KERNEL);
+	if (fp_new) {
+		memcpy(fp_new, fp, sizeof(struct sk_filter));
+		/* nobody else has seen the old filter yet */
+		sock_kfree_s(sk, fp, sk_filter_len(fp));
+	}
+
+	return fp_new;
+}
+
+static struct sk_filter *__sk_migrate_filter(struct sk_filter *fp,
+					     struct sock *sk)
+{
+	struct sock_filter *old_prog;
+	struct sk_filter *old_fp;
+	int err, new_len, old_len = fp->len;
+
+	/* The classic program is converted from a private copy, as
+	 * the realloc below may move or overwrite fp->insns.
+	 */
+	old_prog = kmemdup(fp->insns, old_len * sizeof(struct sock_filter),
+			   GFP_KERNEL);
+	if (!old_prog) {
+		err = -ENOMEM;
+		goto out_err;
+	}
+
+	/* 1st pass: calculate the new program length. */
+	err = sk_convert_filter(old_prog, old_len, NULL, &new_len);
+	if (err)
+		goto out_err_free;
+
+	/* Expand fp for appending the new filter representation. */
+	old_fp = fp;
+	fp = __sk_migrate_realloc(old_fp, sk, sk_filter_size(new_len));
+	if (!fp) {
+		/* The old_fp is still around in case we couldn't
+		 * allocate new memory, so uncharge on that one.
+		 */
+		fp = old_fp;
+		err = -ENOMEM;
+		goto out_err_free;
+	}
+
+	fp->len = new_len;
+	fp->ebpf = 1;
+
+	/* 2nd pass: remap sock_filter insns into bpf_insn insns. */
+	err = sk_convert_filter(old_prog, old_len, fp->insnsi, &new_len);
+	if (err)
+		/* 2nd sk_convert_filter() can fail only if it fails
+		 * to allocate memory, remapping must succeed.
+		 */
+		goto out_err_free;
+
+	bpf_prog_select_runtime(fp);
+
+	kfree(old_prog);
+	return fp;
+
+out_err_free:
+	kfree(old_prog);
+out_err:
+	__sk_filter_free(fp, sk);
+	return ERR_PTR(err);
+}
+
+static struct sk_filter *__sk_prepare_filter(struct sk_filter *fp,
+					     struct sock *sk)
 {
 	int err;
 
-	fp->bpf_func = sk_run_filter;
+	fp->bpf_func = NULL;
+	fp->jited = 0;
+	fp->ebpf = 0;
+	fp->aux = NULL;
 
 	err = sk_chk_filter(fp->insns, fp->len);
-	if (err)
-		return err;
+	if (err) {
+		__sk_filter_free(fp, sk);
+		return ERR_PTR(err);
+	}
 
+	/* Probe if we can JIT compile the filter and if so, do
+	 * the compilation of the filter.
+	 */
 	bpf_jit_compile(fp);
-	return 0;
+
+	/* JIT compiler couldn't process this filter, so do the
+	 * conversion to the extended instruction set, which is
+	 * either JITed or run by the extended interpreter.
+	 */
+	if (!fp->jited)
+		fp = __sk_migrate_filter(fp, sk);
+
+	return fp;
 }
 
 /**
@@ -628,7 +1211,6 @@ int sk_unattached_filter_create(struct sk_filter **pfp,
 {
 	struct sk_filter *fp;
 	unsigned int fsize = sizeof(struct sock_filter) * fprog->len;
-	int err;
 
 	/* Make sure new filter is there and in the right amounts. */
 	if (fprog->filter == NULL)
@@ -642,15 +1224,12 @@ int sk_unattached_filter_create(struct sk_filter **pfp,
 	atomic_set(&fp->refcnt, 1);
 	fp->len = fprog->len;
 
-	err = __sk_prepare_filter(fp);
-	if (err)
-		goto free_mem;
+	fp = __sk_prepare_filter(fp, NULL);
+	if (IS_ERR(fp))
+		return PTR_ERR(fp);
 
 	*pfp = fp;
 	return 0;
-free_mem:
-	kfree(fp);
-	return err;
 }
 EXPORT_SYMBOL_GPL(sk_unattached_filter_create);
 
@@ -674,7 +1253,6 @@ int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk)
 {
 	struct sk_filter *fp, *old_fp;
 	unsigned int fsize = sizeof(struct sock_filter) * fprog->len;
-	int err;
 
 	/* Make sure new filter is there and in the right amounts. */
 	if (fprog->filter == NULL)
@@ -691,11 +1269,9 @@ int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk)
 	atomic_set(&fp->refcnt, 1);
 	fp->len = fprog->len;
 
-	err = __sk_prepare_filter(fp);
-	if (err) {
-		sk_filter_uncharge(sk, fp);
-		return err;
-	}
+	fp = __sk_prepare_filter(fp, sk);
+	if (IS_ERR(fp))
+		return PTR_ERR(fp);
 
 	old_fp = rcu_dereference_protected(sk->sk_filter,
 					   sock_owned_by_user(sk));
@@ -707,6 +1283,40 @@ int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk)
 }
 EXPORT_SYMBOL_GPL(sk_attach_filter);
 
+/**
+ *	sk_attach_bpf - attach a program loaded with bpf(2)
+ *	@ufd: file descriptor of the program
+ *	@sk: the socket to use
+ *
+ * The program was checked by the verifier when it was loaded, it is
+ * shared with the file descriptor and any other socket it is attached to.
+ */
+int sk_attach_bpf(u32 ufd, struct sock *sk)
+{
+	struct sk_filter *prog, *old_fp;
+
+	prog = bpf_prog_get(ufd);
+	if (IS_ERR(prog))
+		return PTR_ERR(prog);
+
+	if (prog->aux->prog_type != BPF_PROG_TYPE_SOCKET_FILTER) {
+		bpf_prog_put(prog);
+		return -EINVAL;
+	}
+
+	/* bpf_prog_get() took the reference the socket holds */
+	atomic_add(sk_filter_len(prog), &sk->sk_omem_alloc);
+
+	old_fp = rcu_dereference_protected(sk->sk_filter,
+					   sock_owned_by_user(sk));
+	rcu_assign_pointer(sk->sk_filter, prog);
+
+	if (old_fp)
+		sk_filter_uncharge(sk, old_fp);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(sk_attach_bpf);
+
 int sk_detach_filter(struct sock *sk)
 {
 	int ret = -ENOENT;
@@ -722,3 +1332,91 @@ int sk_detach_filter(struct sock *sk)
 	return ret;
 }
 EXPORT_SYMBOL_GPL(sk_detach_filter);
+
+#ifdef CONFIG_BPF_SYSCALL
+static const struct bpf_func_proto *
+sk_filter_func_proto(enum bpf_func_id func_id)
+{
+	switch (func_id) {
+	case BPF_FUNC_map_lookup_elem:
+		return &bpf_map_lookup_elem_proto;
+	case BPF_FUNC_map_update_elem:
+		return &bpf_map_update_elem_proto;
+	case BPF_FUNC_map_delete_elem:
+		return &bpf_map_delete_elem_proto;
+	case BPF_FUNC_get_prandom_u32:
+		return &bpf_get_prandom_u32_proto;
+	case BPF_FUNC_get_smp_processor_id:
+		return &bpf_get_smp_processor_id_proto;
+	case BPF_FUNC_ktime_get_ns:
+		return &bpf_ktime_get_ns_proto;
+	default:
+		return NULL;
+	}
+}
+
+static bool sk_filter_is_valid_access(int off, int size,
+				      enum bpf_access_type type)
+{
+	/* only read is allowed */
+	if (type != BPF_READ)
+		return false;
+
+	/* check bounds */
+	if (off < 0 || off >= sizeof(struct __sk_buff))
+		return false;
+
+	/* every __sk_buff field is a naturally aligned u32 */
+	if (size != sizeof(__u32) || off % size != 0)
+		return false;
+
+	return true;
+}
+
+/* Rewrite a load from struct __sk_buff into the load of the matching
+ * struct sk_buff field.
+ */
+static struct bpf_insn sk_filter_convert_ctx_access(const struct bpf_insn *insn)
+{
+	int dst = insn->dst_reg, src = insn->src_reg;
+
+#define SKB_LOAD(field)							\
+	BPF_LDX_MEM(bytes_to_bpf_size(FIELD_SIZEOF(struct sk_buff, field)), \
+		    dst, src, offsetof(struct sk_buff, field))
+
+	switch (insn->off) {
+	case offsetof(struct __sk_buff, len):
+		return SKB_LOAD(len);
+	case offsetof(struct __sk_buff, mark):
+		return SKB_LOAD(mark);
+	case offsetof(struct __sk_buff, queue_mapping):
+		return SKB_LOAD(queue_mapping);
+	case offsetof(struct __sk_buff, protocol):
+		return SKB_LOAD(protocol);
+	case offsetof(struct __sk_buff, priority):
+		return SKB_LOAD(priority);
+	case offsetof(struct __sk_buff, hash):
+	default:
+		return SKB_LOAD(rxhash);
+	}
+#undef SKB_LOAD
+}
+
+static const struct bpf_verifier_ops sk_filter_ops = {
+	.get_func_proto = sk_filter_func_proto,
+	.is_valid_access = sk_filter_is_valid_access,
+	.convert_ctx_access = sk_filter_convert_ctx_access,
+};
+
+static struct bpf_prog_type_list sk_filter_type __read_mostly = {
+	.ops = &sk_filter_ops,
+	.type = BPF_PROG_TYPE_SOCKET_FILTER,
+};
+
+static int __init register_sk_filter_ops(void)
+{
+	bpf_register_prog_type(&sk_filter_type);
+	return 0;
+}
+late_initcall(register_sk_filter_ops);
+#endif /* CONFIG_BPF_SYSCALL */
@@ -18,6 +18,7 @@
 #include <linux/vmalloc.h>
 
 #include <net/request_sock.h>
+#include <linux/tcp.h>
 
 /*
  * Maximum number of SYN_RECV sockets in queue per LISTEN socket.
@@ -41,6 +42,7 @@ int reqsk_queue_alloc(struct request_sock_queue *queue,
 {
 	size_t lopt_size = sizeof(struct listen_sock);
 	struct listen_sock *lopt;
+	int i;
 
 	nr_table_entries = min_t(u32, nr_table_entries, sysctl_max_syn_backlog);
 	nr_table_entries = max_t(u32, nr_table_entries, 8);
@@ -57,6 +59,9 @@ int reqsk_queue_alloc(struct request_sock_queue *queue,
 	     (1 << lopt->max_qlen_log) < nr_table_entries;
 	     lopt->max_qlen_log++);
 
+	for (i = 0; i < LISTEN_SOCK_SYN_LOCKS; i++)
+		spin_lock_init(&lopt->syn_lock[i].lock);
+
 	get_random_bytes(&lopt->hash_rnd, sizeof(lopt->hash_rnd));
 	rwlock_init(&queue->syn_wait_lock);
 	queue->rskq_accept_head = NULL;
@@ -109,7 +114,7 @@ void reqsk_queue_destroy(struct request_sock_queue *queue)
 	size_t lopt_size = sizeof(struct listen_sock) +
 		lopt->nr_table_entries * sizeof(struct request_sock *);
 
-	if (lopt->qlen != 0) {
+	if (atomic_read(&lopt->qlen) != 0) {
 		unsigned int i;
 
 		for (i = 0; i < lopt->nr_table_entries; i++) {
@@ -117,16 +122,70 @@ void reqsk_queue_destroy(struct request_sock_queue *queue)
 
 			while ((req = lopt->syn_table[i]) != NULL) {
 				lopt->syn_table[i] = req->dl_next;
-				lopt->qlen--;
+				atomic_dec(&lopt->qlen);
 				reqsk_free(req);
 			}
 		}
 	}
 
-	WARN_ON(lopt->qlen != 0);
+	WARN_ON(atomic_read(&lopt->qlen) != 0);
 	if (lopt_size > PAGE_SIZE)
 		vfree(lopt);
 	else
 		kfree(lopt);
 }
 
+
+/*
+ * Called from the child's context, with its socket lock held, once a
+ * Fast Open child no longer needs its request_sock: the 3WHS has either
+ * completed or been aborted (e.g. by a RST).
+ *
+ * A Fast Open req is shared by the child (through fastopen_rsk, for SYN-ACK
+ * retransmits) and the listener (through its accept queue), so it may only
+ * be freed once BOTH the handshake is over and the child has been accepted
+ * (or the listener closed).  accept() signals the latter by clearing
+ * req->sk.  Both sides serialize on fastopenq->lock rather than on the
+ * listener's socket lock, which inet_csk_listen_stop() already holds while
+ * taking child locks.
+ *
+ * A req whose child was reset stays queued on rskq_rst_head for 60 seconds
+ * and keeps counting against max_qlen, as a cheap defense against spoofed
+ * Fast Open SYNs.
+ */
+void reqsk_fastopen_remove(struct sock *sk, struct request_sock *req,
+			   bool reset)
+{
+	struct sock *lsk = tcp_rsk(req)->listener;
+	struct fastopen_queue *fastopenq =
+	    inet_csk(lsk)->icsk_accept_queue.fastopenq;
+
+	tcp_sk(sk)->fastopen_rsk = NULL;
+	spin_lock_bh(&fastopenq->lock);
+	fastopenq->qlen--;
+	tcp_rsk(req)->listener = NULL;
+	if (req->sk)	/* the child socket hasn't been accepted yet */
+		goto out;
+
+	if (!reset || lsk->sk_state != TCP_LISTEN) {
+		/* If the listener has been closed don't bother with the
+		 * special RST handling below.
+		 */
+		spin_unlock_bh(&fastopenq->lock);
+		sock_put(lsk);
+		reqsk_free(req);
+		return;
+	}
+	req->expires = jiffies + 60*HZ;
+	if (fastopenq->rskq_rst_head == NULL)
+		fastopenq->rskq_rst_head = req;
+	else
+		fastopenq->rskq_rst_tail->dl_next = req;
+
+	req->dl_next = NULL;
+	fastopenq->rskq_rst_tail = req;
+	fastopenq->qlen++;
+out:
+	spin_unlock_bh(&fastopenq->lock);
+	sock_put(lsk);
+}
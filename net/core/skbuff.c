@@ -431,13 +431,7 @@ static void skb_release_data(struct sk_buff *skb)
 		 * If skb buf is from userspace, we need to notify the caller
 		 * the lower device DMA has done;
 		 */
-		if (skb_shinfo(skb)->tx_flags & SKBTX_DEV_ZEROCOPY) {
-			struct ubuf_info *uarg;
-
-			uarg = skb_shinfo(skb)->destructor_arg;
-			if (uarg->callback)
-				uarg->callback(uarg);
-		}
+		skb_zcopy_clear(skb, true);
 
 		if (skb_has_frag_list(skb))
 			skb_drop_fraglist(skb);
@@ -613,6 +607,10 @@ static void __copy_skb_header(struct sk_buff *new, const struct sk_buff *old)
 	new->vlan_tci		= old->vlan_tci;
 
 	skb_copy_secmark(new, old);
+
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	new->napi_id		= old->napi_id;
+#endif
 }
 
 /*
@@ -666,13 +664,240 @@ struct sk_buff *skb_morph(struct sk_buff *dst, struct sk_buff *src)
 }
 EXPORT_SYMBOL_GPL(skb_morph);
 
+#define skb_from_uarg(uarg) container_of((void *)uarg, struct sk_buff, cb)
+
+/**
+ *	sock_zerocopy_alloc - start a MSG_ZEROCOPY send
+ *	@sk: sending socket
+ *
+ *	Allocates the completion notification for one send call up front,
+ *	so that completing it cannot fail.  The caller owns the returned
+ *	reference and drops it with sock_zerocopy_put() once done queueing,
+ *	or with sock_zerocopy_put_abort() if nothing was sent.
+ */
+struct ubuf_info *sock_zerocopy_alloc(struct sock *sk)
+{
+	struct ubuf_info *uarg;
+	struct sk_buff *skb;
+
+	BUILD_BUG_ON(sizeof(*uarg) > sizeof(skb->cb));
+
+	skb = sock_omalloc(sk, 0, GFP_KERNEL);
+	if (!skb)
+		return NULL;
+
+	uarg = (void *)skb->cb;
+	uarg->callback = sock_zerocopy_callback;
+	uarg->id = ((u32)atomic_inc_return(&sk->sk_zckey)) - 1;
+	uarg->len = 1;
+	uarg->zerocopy = 1;
+	atomic_set(&uarg->refcnt, 1);
+	sock_hold(sk);
+
+	return uarg;
+}
+EXPORT_SYMBOL_GPL(sock_zerocopy_alloc);
+
+/* Extend the notification at the tail of the error queue if the range
+ * [lo, lo + len) follows it directly. Caller holds the queue lock. */
+static bool skb_zerocopy_notify_extend(struct sk_buff *skb, u32 lo, u16 len,
+				       u8 code)
+{
+	struct sock_exterr_skb *serr = SKB_EXT_ERR(skb);
+	u32 old_lo, old_hi;
+	u64 sum_len;
+
+	if (serr->ee.ee_origin != SO_EE_ORIGIN_ZEROCOPY ||
+	    serr->ee.ee_code != code)
+		return false;
+
+	old_lo = serr->ee.ee_info;
+	old_hi = serr->ee.ee_data;
+	sum_len = old_hi - old_lo + 1ULL + len;
+
+	if (sum_len >= (1ULL << 32))
+		return false;
+
+	if (lo != old_hi + 1)
+		return false;
+
+	serr->ee.ee_data += len;
+	return true;
+}
+
+/* Called when the last skb referencing the user pages of a send is freed:
+ * report the send as completed on the socket error queue. */
+void sock_zerocopy_callback(struct ubuf_info *uarg)
+{
+	struct sk_buff *tail, *skb = skb_from_uarg(uarg);
+	struct sock_exterr_skb *serr;
+	struct sock *sk = skb->sk;
+	struct sk_buff_head *q;
+	unsigned long flags;
+	u32 lo, hi;
+	u16 len;
+	u8 code;
+
+	/* if !len, the send was aborted: there is nothing to report */
+	if (!uarg->len || sock_flag(sk, SOCK_DEAD))
+		goto release;
+
+	len = uarg->len;
+	lo = uarg->id;
+	hi = uarg->id + len - 1;
+	code = uarg->zerocopy ? 0 : SO_EE_CODE_ZEROCOPY_COPIED;
+
+	/* the control block is reused for the notification */
+	serr = SKB_EXT_ERR(skb);
+	memset(serr, 0, sizeof(*serr));
+	serr->ee.ee_errno = 0;
+	serr->ee.ee_origin = SO_EE_ORIGIN_ZEROCOPY;
+	serr->ee.ee_code = code;
+	serr->ee.ee_info = lo;
+	serr->ee.ee_data = hi;
+
+	q = &sk->sk_error_queue;
+	spin_lock_irqsave(&q->lock, flags);
+	tail = skb_peek_tail(q);
+	if (!tail || !skb_zerocopy_notify_extend(tail, lo, len, code)) {
+		__skb_queue_tail(q, skb);
+		skb = NULL;
+	}
+	spin_unlock_irqrestore(&q->lock, flags);
+
+	sk->sk_error_report(sk);
+
+release:
+	consume_skb(skb);
+	sock_put(sk);
+}
+EXPORT_SYMBOL_GPL(sock_zerocopy_callback);
+
+void sock_zerocopy_put(struct ubuf_info *uarg)
+{
+	if (uarg && atomic_dec_and_test(&uarg->refcnt))
+		uarg->callback(uarg);
+}
+EXPORT_SYMBOL_GPL(sock_zerocopy_put);
+
+/* Release a send that queued no data: its id is given back. */
+void sock_zerocopy_put_abort(struct ubuf_info *uarg)
+{
+	if (uarg) {
+		struct sock *sk = skb_from_uarg(uarg)->sk;
+
+		atomic_dec(&sk->sk_zckey);
+		uarg->len--;
+
+		sock_zerocopy_put(uarg);
+	}
+}
+EXPORT_SYMBOL_GPL(sock_zerocopy_put_abort);
+
+/**
+ *	skb_zerocopy_add_frags - append user pages to an skb
+ *	@skb: buffer to extend
+ *	@from: user address of the data
+ *	@length: number of bytes to append
+ *
+ *	Pins the user pages backing @from and adds them to @skb as page
+ *	fragments, extending the last fragment where the data is contiguous.
+ *	Updates the length and truesize of @skb; charging the socket is up
+ *	to the caller.  Returns the number of bytes added, which is short
+ *	when @skb runs out of fragment slots, or a negative error if nothing
+ *	could be added.
+ */
+int skb_zerocopy_add_frags(struct sk_buff *skb, const void __user *from,
+			   int length)
+{
+	struct page *pages[MAX_SKB_FRAGS];
+	unsigned long addr = (unsigned long)from;
+	int copied = 0, err = 0;
+
+	while (copied < length) {
+		int off = addr & ~PAGE_MASK;
+		int left = length - copied;
+		int npages, n, j;
+
+		npages = min_t(int, DIV_ROUND_UP(off + left, PAGE_SIZE),
+			       ARRAY_SIZE(pages));
+		n = get_user_pages_fast(addr & PAGE_MASK, npages, 0, pages);
+		if (n <= 0) {
+			err = n ? n : -EFAULT;
+			break;
+		}
+
+		for (j = 0; j < n; j++) {
+			int i = skb_shinfo(skb)->nr_frags;
+			int size = min_t(int, left, PAGE_SIZE - off);
+
+			if (skb_can_coalesce(skb, i, pages[j], off)) {
+				skb_frag_size_add(&skb_shinfo(skb)->frags[i - 1],
+						  size);
+				put_page(pages[j]);
+			} else if (i < MAX_SKB_FRAGS) {
+				skb_fill_page_desc(skb, i, pages[j], off, size);
+			} else {
+				while (j < n)
+					put_page(pages[j++]);
+				goto out;
+			}
+			copied += size;
+			left -= size;
+			addr += size;
+			off = 0;
+		}
+	}
+out:
+	skb->len += copied;
+	skb->data_len += copied;
+	skb->truesize += copied;
+
+	return copied ? copied : err;
+}
+EXPORT_SYMBOL_GPL(skb_zerocopy_add_frags);
+
+/**
+ *	skb_zerocopy_clone - share the user pages of one skb with another
+ *	@nskb: buffer that received frags of @orig
+ *	@orig: MSG_ZEROCOPY buffer
+ *	@gfp_mask: allocation mask, 0 if @nskb is known to carry no user pages
+ *
+ *	Makes @nskb hold a reference on the completion of @orig, so the send
+ *	is reported only once both are freed.  Buffers of the same send may
+ *	share pages; pages of another send in @nskb are copied first.
+ */
+int skb_zerocopy_clone(struct sk_buff *nskb, struct sk_buff *orig,
+		       gfp_t gfp_mask)
+{
+	struct ubuf_info *uarg = skb_zcopy(orig);
+
+	if (!uarg || !skb_zcopy_refcounted(uarg))
+		return 0;
+
+	if (skb_zcopy(nskb)) {
+		if (!gfp_mask) {
+			WARN_ON_ONCE(1);
+			return -ENOMEM;
+		}
+		if (skb_uarg(nskb) == uarg)
+			return 0;
+		if (skb_copy_ubufs(nskb, GFP_ATOMIC))
+			return -EIO;
+	}
+	skb_zcopy_set(nskb, uarg);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(skb_zerocopy_clone);
+
 /*	skb_copy_ubufs	-	copy userspace skb frags buffers to kernel
  *	@skb: the skb to modify
  *	@gfp_mask: allocation priority
  *
  *	This must be called on SKBTX_DEV_ZEROCOPY skb.
  *	It will copy all frags into kernel and drop the reference
- *	to userspace pages.
+ *	to userspace pages.  The shared info of a MSG_ZEROCOPY skb is
+ *	made private first, so the skb must not be shared.
  *
  *	If this function is called from an interrupt gfp_mask() must be
  *	%GFP_ATOMIC.
@@ -685,7 +910,13 @@ int skb_copy_ubufs(struct sk_buff *skb, gfp_t gfp_mask)
 	int i;
 	int num_frags = skb_shinfo(skb)->nr_frags;
 	struct page *page, *head = NULL;
-	struct ubuf_info *uarg = skb_shinfo(skb)->destructor_arg;
+
+	if (skb_zcopy_refcounted(skb_uarg(skb))) {
+		if (skb_shared(skb))
+			return -EINVAL;
+		if (skb_cloned(skb) && pskb_expand_head(skb, 0, 0, gfp_mask))
+			return -ENOMEM;
+	}
 
 	for (i = 0; i < num_frags; i++) {
 		u8 *vaddr;
@@ -712,7 +943,7 @@ int skb_copy_ubufs(struct sk_buff *skb, gfp_t gfp_mask)
 	for (i = 0; i < skb_shinfo(skb)->nr_frags; i++)
 		skb_frag_unref(skb, i);
 
-	uarg->callback(uarg);
+	skb_zcopy_clear(skb, false);
 
 	/* skb frags point to kernel buffers */
 	for (i = skb_shinfo(skb)->nr_frags; i > 0; i--) {
@@ -721,7 +952,6 @@ int skb_copy_ubufs(struct sk_buff *skb, gfp_t gfp_mask)
 		head = (struct page *)head->private;
 	}
 
-	skb_shinfo(skb)->tx_flags &= ~SKBTX_DEV_ZEROCOPY;
 	return 0;
 }
 
@@ -744,10 +974,8 @@ struct sk_buff *skb_clone(struct sk_buff *skb, gfp_t gfp_mask)
 {
 	struct sk_buff *n;
 
-	if (skb_shinfo(skb)->tx_flags & SKBTX_DEV_ZEROCOPY) {
-		if (skb_copy_ubufs(skb, gfp_mask))
-			return NULL;
-	}
+	if (skb_orphan_frags(skb, gfp_mask))
+		return NULL;
 
 	n = skb + 1;
 	if (skb->fclone == SKB_FCLONE_ORIG &&
@@ -867,12 +1095,11 @@ struct sk_buff *__pskb_copy(struct sk_buff *skb, int headroom, gfp_t gfp_mask)
 	if (skb_shinfo(skb)->nr_frags) {
 		int i;
 
-		if (skb_shinfo(skb)->tx_flags & SKBTX_DEV_ZEROCOPY) {
-			if (skb_copy_ubufs(skb, gfp_mask)) {
-				kfree_skb(n);
-				n = NULL;
-				goto out;
-			}
+		if (skb_orphan_frags(skb, gfp_mask) ||
+		    skb_zerocopy_clone(n, skb, gfp_mask)) {
+			kfree_skb(n);
+			n = NULL;
+			goto out;
 		}
 		for (i = 0; i < skb_shinfo(skb)->nr_frags; i++) {
 			skb_shinfo(n)->frags[i] = skb_shinfo(skb)->frags[i];
@@ -945,10 +1172,11 @@ int pskb_expand_head(struct sk_buff *skb, int nhead, int ntail,
 	 */
 	if (skb_cloned(skb)) {
 		/* copy this zero copy skb frags */
-		if (skb_shinfo(skb)->tx_flags & SKBTX_DEV_ZEROCOPY) {
-			if (skb_copy_ubufs(skb, gfp_mask))
-				goto nofrags;
-		}
+		if (skb_orphan_frags(skb, gfp_mask))
+			goto nofrags;
+		/* the new shared info references the user pages as well */
+		if (skb_zcopy(skb))
+			atomic_inc(&skb_uarg(skb)->refcnt);
 		for (i = 0; i < skb_shinfo(skb)->nr_frags; i++)
 			skb_frag_ref(skb, i);
 
@@ -2251,6 +2479,8 @@ void skb_split(struct sk_buff *skb, struct sk_buff *skb1, const u32 len)
 {
 	int pos = skb_headlen(skb);
 
+	/* skb1 is fresh, so this cannot fail */
+	skb_zerocopy_clone(skb1, skb, 0);
 	if (len < pos)	/* Split line is inside header. */
 		skb_split_inside_header(skb, skb1, len, pos);
 	else		/* Second chunk has no header, nothing to copy. */
@@ -2293,6 +2523,10 @@ int skb_shift(struct sk_buff *tgt, struct sk_buff *skb, int shiftlen)
 	BUG_ON(shiftlen > skb->len);
 	BUG_ON(skb_headlen(skb));	/* Would corrupt stream */
 
+	/* Pages of different sends must not end up under one notification */
+	if (skb_zcopy(tgt) || skb_zcopy(skb))
+		return 0;
+
 	todo = shiftlen;
 	from = 0;
 	to = skb_shinfo(tgt)->nr_frags;
@@ -2763,6 +2997,9 @@ struct sk_buff *skb_segment(struct sk_buff *skb, netdev_features_t features)
 
 		frag = skb_shinfo(nskb)->frags;
 
+		if (unlikely(skb_zerocopy_clone(nskb, skb, GFP_ATOMIC)))
+			goto err;
+
 		skb_copy_from_linear_data_offset(skb, offset,
 						 skb_put(nskb, hsize), hsize);
 
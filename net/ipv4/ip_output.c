@@ -749,6 +749,29 @@ csum_page(struct page *page, int offset, int copy)
 	return csum;
 }
 
+/* Add len bytes at offset of the user iovec to skb as pinned page frags. */
+static int ip_zerocopy_getfrag(struct iovec *iov, struct sk_buff *skb,
+			       int offset, int len)
+{
+	while (len > 0) {
+		int copy, n;
+
+		while (offset >= iov->iov_len) {
+			offset -= iov->iov_len;
+			iov++;
+		}
+		copy = min_t(int, len, iov->iov_len - offset);
+		n = skb_zerocopy_add_frags(skb, iov->iov_base + offset, copy);
+		if (n < 0)
+			return n;
+		if (n < copy)
+			return -EMSGSIZE;
+		offset += n;
+		len -= n;
+	}
+	return 0;
+}
+
 static inline int ip_ufo_append_data(struct sock *sk,
 			struct sk_buff_head *queue,
 			int getfrag(void *from, char *to, int offset, int len,
@@ -806,7 +829,9 @@ static int __ip_append_data(struct sock *sk,
 			    unsigned int flags)
 {
 	struct inet_sock *inet = inet_sk(sk);
+	struct ubuf_info *uarg = NULL;
 	struct sk_buff *skb;
+	bool paged, zc = false;
 
 	struct ip_options *opt = cork->opt;
 	int hh_len;
@@ -822,7 +847,8 @@ static int __ip_append_data(struct sock *sk,
 	skb = skb_peek_tail(queue);
 
 	exthdrlen = !skb ? rt->dst.header_len : 0;
-	mtu = cork->fragsize;
+	mtu = cork->gso_size ? 0xFFFF : cork->fragsize;
+	paged = !!cork->gso_size && (rt->dst.dev->features & NETIF_F_SG);
 
 	hh_len = LL_RESERVED_SPACE(rt->dst.dev);
 
@@ -845,6 +871,21 @@ static int __ip_append_data(struct sock *sk,
 	    !exthdrlen)
 		csummode = CHECKSUM_PARTIAL;
 
+	/* MSG_ZEROCOPY: only a datagram started here that fits a single
+	 * packet is sent from user pages.  Otherwise the data is copied
+	 * and the completion reported as soon as we are done. */
+	if ((flags & MSG_ZEROCOPY) && length && sock_flag(sk, SOCK_ZEROCOPY) &&
+	    sk->sk_protocol == IPPROTO_UDP && getfrag == ip_generic_getfrag) {
+		uarg = sock_zerocopy_alloc(sk);
+		if (!uarg)
+			return -ENOBUFS;
+		if (!skb && csummode == CHECKSUM_PARTIAL &&
+		    (rt->dst.dev->features & NETIF_F_SG))
+			zc = true;
+		else
+			uarg->zerocopy = 0;
+	}
+
 	cork->length += length;
 	if (((length > mtu) || (skb && skb_is_gso(skb))) &&
 	    (sk->sk_protocol == IPPROTO_UDP) &&
@@ -854,6 +895,7 @@ static int __ip_append_data(struct sock *sk,
 					 maxfraglen, flags);
 		if (err)
 			goto error;
+		sock_zerocopy_put(uarg);
 		return 0;
 	}
 
@@ -878,6 +920,7 @@ static int __ip_append_data(struct sock *sk,
 			unsigned int fraglen;
 			unsigned int fraggap;
 			unsigned int alloclen;
+			unsigned int pagedlen;
 			struct sk_buff *skb_prev;
 alloc_new_skb:
 			skb_prev = skb;
@@ -901,6 +944,10 @@ alloc_new_skb:
 			else
 				alloclen = fraglen;
 
+			/* Only headers go to the linear part */
+			pagedlen = (zc || paged) ?
+				   datalen - transhdrlen - fraggap : 0;
+			alloclen -= pagedlen;
 			alloclen += exthdrlen;
 
 			/* The last fragment gets additional space at tail.
@@ -943,7 +990,7 @@ alloc_new_skb:
 			/*
 			 *	Find where to start putting bytes.
 			 */
-			data = skb_put(skb, fraglen + exthdrlen);
+			data = skb_put(skb, fraglen + exthdrlen - pagedlen);
 			skb_set_network_header(skb, exthdrlen);
 			skb->transport_header = (skb->network_header +
 						 fragheaderlen);
@@ -959,7 +1006,7 @@ alloc_new_skb:
 				pskb_trim_unique(skb_prev, maxfraglen);
 			}
 
-			copy = datalen - transhdrlen - fraggap;
+			copy = datalen - transhdrlen - fraggap - pagedlen;
 			if (copy > 0 && getfrag(from, data + transhdrlen, offset, copy, fraggap, skb) < 0) {
 				err = -EFAULT;
 				kfree_skb(skb);
@@ -967,7 +1014,7 @@ alloc_new_skb:
 			}
 
 			offset += copy;
-			length -= datalen - fraggap;
+			length -= datalen - fraggap - pagedlen;
 			transhdrlen = 0;
 			exthdrlen = 0;
 			csummode = CHECKSUM_NONE;
@@ -992,6 +1039,13 @@ alloc_new_skb:
 				err = -EFAULT;
 				goto error;
 			}
+		} else if (zc) {
+			err = ip_zerocopy_getfrag(from, skb, offset, copy);
+			if (err)
+				goto error;
+			if (!skb_zcopy(skb))
+				skb_zcopy_set(skb, uarg);
+			atomic_add(copy, &sk->sk_wmem_alloc);
 		} else {
 			int i = skb_shinfo(skb)->nr_frags;
 			skb_frag_t *frag = &skb_shinfo(skb)->frags[i-1];
@@ -1044,9 +1098,11 @@ alloc_new_skb:
 		length -= copy;
 	}
 
+	sock_zerocopy_put(uarg);
 	return 0;
 
 error:
+	sock_zerocopy_put_abort(uarg);
 	cork->length -= length;
 	IP_INC_STATS(sock_net(sk), IPSTATS_MIB_OUTDISCARDS);
 	return err;
@@ -1086,6 +1142,7 @@ static int ip_setup_cork(struct sock *sk, struct inet_cork *cork,
 	cork->dst = &rt->dst;
 	cork->length = 0;
 	cork->tx_flags = ipc->tx_flags;
+	cork->gso_size = ipc->gso_size;
 	cork->page = NULL;
 	cork->off = 0;
 
@@ -1492,6 +1549,7 @@ void ip_send_reply(struct sock *sk, struct sk_buff *skb, __be32 daddr,
 	ipc.addr = daddr;
 	ipc.opt = NULL;
 	ipc.tx_flags = 0;
+	ipc.gso_size = 0;
 
 	if (replyopts.opt.opt.optlen) {
 		ipc.opt = &replyopts.opt;
@@ -24,8 +24,12 @@
 #include <linux/proc_fs.h>
 #include <linux/err.h>
 #include <linux/cpumask.h>
+#include <linux/jhash.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
 
 #include <linux/netfilter/x_tables.h>
+#include <linux/netfilter/xt_tcpudp.h>
 #include <linux/netfilter_ipv4/ip_tables.h>
 #include <net/netfilter/nf_log.h>
 #include "../../netfilter/xt_repldata.h"
@@ -283,6 +287,352 @@ struct ipt_entry *ipt_next_entry(const struct ipt_entry *entry)
 	return (void *)entry + entry->next_offset;
 }
 
+/*
+ * Compiled classification.
+ *
+ * At replace time, each maximal run of consecutive rules that test the
+ * same set of exact fields (source and destination address, protocol,
+ * interface names and a single TCP/UDP destination port) and nothing
+ * else is folded into a hash table keyed on those fields.  Because all
+ * rules of a run test the same fields, the first rule of the run whose
+ * key equals the packet's is also the first one that matches, so
+ * ipt_do_table() can jump straight to it, or past the whole run when
+ * there is none.  The rule found is then evaluated as usual, which keeps
+ * verdicts and counters identical to the linear walk.  Rules using any
+ * other match fall back to that walk.
+ */
+static unsigned int compile_min_run __read_mostly = 16;
+module_param(compile_min_run, uint, 0644);
+MODULE_PARM_DESC(compile_min_run,
+		 "Shortest run of rules compiled into a lookup table on replace (0 to disable)");
+
+#define IPT_CLS_SRC	0x01
+#define IPT_CLS_DST	0x02
+#define IPT_CLS_PROTO	0x04
+#define IPT_CLS_IN	0x08
+#define IPT_CLS_OUT	0x10
+#define IPT_CLS_DPORT	0x20
+
+#define IPT_CLS_EMPTY	(~0U)
+#define IPT_CLS_ALIGN	__alignof__(struct ipt_entry)
+
+struct ipt_cls_key {
+	__be32		src;
+	__be32		dst;
+	char		iniface[IFNAMSIZ];
+	char		outiface[IFNAMSIZ];
+	u32		run;
+	u16		dport;
+	u8		proto;
+	u8		pad;
+};
+
+struct ipt_cls_slot {
+	struct ipt_cls_key	key;
+	unsigned int		offset;		/* IPT_CLS_EMPTY if unused */
+};
+
+struct ipt_cls_run {
+	unsigned int		start;		/* offset of the first rule */
+	unsigned int		end;		/* offset just past the last rule */
+	unsigned int		shape;		/* IPT_CLS_* fields tested */
+};
+
+struct ipt_classifier {
+	unsigned int		nruns;
+	unsigned int		hmask;
+	struct ipt_cls_run	*runs;
+	struct ipt_cls_slot	*slots;
+	/* One bit per possible entry offset, set where a run starts */
+	unsigned long		starts[0];
+};
+
+static inline u32 ipt_cls_hash(const struct ipt_cls_key *key)
+{
+	return jhash2((const u32 *)key, sizeof(*key) / sizeof(u32), 0);
+}
+
+/* Returns 0 for a wildcard, 1 for an exact name and -1 otherwise. */
+static int ipt_cls_iface(const char *iface, const unsigned char *mask,
+			 char *key)
+{
+	unsigned int i, len;
+
+	if (!memchr_inv(mask, 0, IFNAMSIZ))
+		return 0;
+
+	len = strnlen(iface, IFNAMSIZ);
+	if (len == IFNAMSIZ)
+		return -1;
+	for (i = 0; i < IFNAMSIZ; i++)
+		if (mask[i] != (i <= len ? 0xFF : 0))
+			return -1;
+
+	memcpy(key, iface, len);
+	return 1;
+}
+
+/* Returns the set of fields rule @e tests and fills in its key, or 0 if
+ * it tests anything we cannot compile. */
+static unsigned int ipt_cls_shape(const struct ipt_entry *e,
+				  struct ipt_cls_key *key)
+{
+	const struct ipt_ip *ip = &e->ip;
+	const struct xt_entry_match *ematch;
+	unsigned int shape = 0, nmatch = 0;
+	const u16 *spts, *dpts;
+	int ret;
+
+	memset(key, 0, sizeof(*key));
+	if (ip->invflags || (ip->flags & IPT_F_FRAG))
+		return 0;
+
+	if (ip->smsk.s_addr == htonl(0xFFFFFFFF)) {
+		key->src = ip->src.s_addr;
+		shape |= IPT_CLS_SRC;
+	} else if (ip->smsk.s_addr || ip->src.s_addr) {
+		return 0;
+	}
+	if (ip->dmsk.s_addr == htonl(0xFFFFFFFF)) {
+		key->dst = ip->dst.s_addr;
+		shape |= IPT_CLS_DST;
+	} else if (ip->dmsk.s_addr || ip->dst.s_addr) {
+		return 0;
+	}
+	if (ip->proto) {
+		key->proto = ip->proto;
+		shape |= IPT_CLS_PROTO;
+	}
+
+	ret = ipt_cls_iface(ip->iniface, ip->iniface_mask, key->iniface);
+	if (ret < 0)
+		return 0;
+	if (ret > 0)
+		shape |= IPT_CLS_IN;
+	ret = ipt_cls_iface(ip->outiface, ip->outiface_mask, key->outiface);
+	if (ret < 0)
+		return 0;
+	if (ret > 0)
+		shape |= IPT_CLS_OUT;
+
+	xt_ematch_foreach(ematch, e) {
+		const struct xt_match *match = ematch->u.kernel.match;
+
+		if (++nmatch > 1 || match->revision != 0)
+			return 0;
+
+		if (ip->proto == IPPROTO_TCP && !strcmp(match->name, "tcp")) {
+			const struct xt_tcp *tcpinfo = (const void *)ematch->data;
+
+			if (tcpinfo->option || tcpinfo->flg_mask ||
+			    tcpinfo->flg_cmp || tcpinfo->invflags)
+				return 0;
+			spts = tcpinfo->spts;
+			dpts = tcpinfo->dpts;
+		} else if (ip->proto == IPPROTO_UDP &&
+			   !strcmp(match->name, "udp")) {
+			const struct xt_udp *udpinfo = (const void *)ematch->data;
+
+			if (udpinfo->invflags)
+				return 0;
+			spts = udpinfo->spts;
+			dpts = udpinfo->dpts;
+		} else {
+			return 0;
+		}
+
+		if (spts[0] != 0 || spts[1] != 0xFFFF || dpts[0] != dpts[1])
+			return 0;
+		key->dport = dpts[0];
+		shape |= IPT_CLS_DPORT;
+	}
+	return shape;
+}
+
+static void ipt_cls_insert(struct ipt_classifier *cls,
+			   const struct ipt_cls_key *key, unsigned int offset)
+{
+	unsigned int h = ipt_cls_hash(key) & cls->hmask;
+
+	while (cls->slots[h].offset != IPT_CLS_EMPTY) {
+		/* An earlier rule of the run shadows this one */
+		if (!memcmp(&cls->slots[h].key, key, sizeof(*key)))
+			return;
+		h = (h + 1) & cls->hmask;
+	}
+	cls->slots[h].key = *key;
+	cls->slots[h].offset = offset;
+}
+
+static void ipt_cls_add_run(struct ipt_classifier *cls, void *entry0,
+			    struct ipt_entry *start, void *end,
+			    unsigned int shape)
+{
+	struct ipt_cls_run *run = &cls->runs[cls->nruns];
+	struct ipt_entry *iter;
+	struct ipt_cls_key key;
+
+	run->start = (void *)start - entry0;
+	run->end = end - entry0;
+	run->shape = shape;
+	__set_bit(run->start / IPT_CLS_ALIGN, cls->starts);
+
+	for (iter = start; (void *)iter < end; iter = ipt_next_entry(iter)) {
+		ipt_cls_shape(iter, &key);
+		key.run = cls->nruns;
+		ipt_cls_insert(cls, &key, (void *)iter - entry0);
+	}
+	cls->nruns++;
+}
+
+/* Finds the runs worth compiling; counts them when @cls is NULL and
+ * fills @cls in otherwise. */
+static unsigned int ipt_cls_scan(void *entry0, unsigned int size,
+				 unsigned int min_run,
+				 struct ipt_classifier *cls,
+				 unsigned int *nrules)
+{
+	struct ipt_entry *iter, *start = NULL;
+	struct ipt_cls_key key;
+	unsigned int shape, run_shape = 0, len = 0, nruns = 0;
+
+	xt_entry_foreach(iter, entry0, size) {
+		shape = ipt_cls_shape(iter, &key);
+		if (shape != 0 && shape == run_shape) {
+			len++;
+			continue;
+		}
+		/* Every chain ends in an unconditional rule, so a run
+		 * never reaches the end of the table. */
+		if (run_shape != 0 && len >= min_run) {
+			if (cls != NULL)
+				ipt_cls_add_run(cls, entry0, start, iter,
+						run_shape);
+			nruns++;
+			*nrules += len;
+		}
+		start = iter;
+		run_shape = shape;
+		len = 1;
+	}
+	return nruns;
+}
+
+static struct ipt_classifier *ipt_cls_build(void *entry0, unsigned int size)
+{
+	unsigned int min_run = ACCESS_ONCE(compile_min_run);
+	unsigned int nruns, nrules = 0, hsize, i;
+	struct ipt_classifier *cls;
+	size_t bitmap_len;
+
+	BUILD_BUG_ON(sizeof(struct ipt_cls_key) % sizeof(u32));
+
+	if (min_run == 0)
+		return NULL;
+	nruns = ipt_cls_scan(entry0, size, min_run, NULL, &nrules);
+	if (nruns == 0)
+		return NULL;
+
+	bitmap_len = BITS_TO_LONGS(size / IPT_CLS_ALIGN) * sizeof(long);
+	hsize = roundup_pow_of_two(2 * nrules);
+	cls = vzalloc(sizeof(*cls) + bitmap_len +
+		      nruns * sizeof(struct ipt_cls_run) +
+		      hsize * sizeof(struct ipt_cls_slot));
+	if (cls == NULL)
+		return NULL;
+
+	cls->runs = (void *)cls->starts + bitmap_len;
+	cls->slots = (void *)(cls->runs + nruns);
+	cls->hmask = hsize - 1;
+	for (i = 0; i < hsize; i++)
+		cls->slots[i].offset = IPT_CLS_EMPTY;
+
+	nrules = 0;
+	ipt_cls_scan(entry0, size, min_run, cls, &nrules);
+	duprintf("ipt_cls_build: %u rules in %u runs\n", nrules, nruns);
+	return cls;
+}
+
+static const struct ipt_cls_run *
+ipt_cls_find_run(const struct ipt_classifier *cls, unsigned int offset)
+{
+	unsigned int lo = 0, hi = cls->nruns;
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if (cls->runs[mid].start < offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return &cls->runs[lo];
+}
+
+/* If @e starts a compiled run, returns the first rule of it that can
+ * match, or the first rule past it. */
+static struct ipt_entry *
+ipt_cls_next(const struct ipt_classifier *cls, const void *table_base,
+	     struct ipt_entry *e, const struct sk_buff *skb,
+	     const struct iphdr *ip, const char *indev, const char *outdev,
+	     const struct xt_action_param *par)
+{
+	unsigned int offset = (void *)e - table_base;
+
+	while (test_bit(offset / IPT_CLS_ALIGN, cls->starts)) {
+		const struct ipt_cls_run *run = ipt_cls_find_run(cls, offset);
+		const struct ipt_cls_slot *slot;
+		struct ipt_cls_key key;
+		unsigned int h;
+
+		memset(&key, 0, sizeof(key));
+		key.run = run - cls->runs;
+		if (run->shape & IPT_CLS_SRC)
+			key.src = ip->saddr;
+		if (run->shape & IPT_CLS_DST)
+			key.dst = ip->daddr;
+		if (run->shape & IPT_CLS_PROTO)
+			key.proto = ip->protocol;
+		if (run->shape & IPT_CLS_IN)
+			memcpy(key.iniface, indev, IFNAMSIZ);
+		if (run->shape & IPT_CLS_OUT)
+			memcpy(key.outiface, outdev, IFNAMSIZ);
+		if ((run->shape & IPT_CLS_DPORT) &&
+		    (ip->protocol == IPPROTO_TCP ||
+		     ip->protocol == IPPROTO_UDP)) {
+			union {
+				struct tcphdr	tcph;
+				struct udphdr	udph;
+			} _hdr;
+			const __be16 *ports;
+
+			/* Let the matches decide on fragments and
+			 * truncated headers, they may drop those. */
+			if (par->fragoff != 0)
+				break;
+			ports = skb_header_pointer(skb, par->thoff,
+						   ip->protocol == IPPROTO_TCP ?
+						   sizeof(_hdr.tcph) :
+						   sizeof(_hdr.udph), &_hdr);
+			if (ports == NULL)
+				break;
+			key.dport = ntohs(ports[1]);
+		}
+
+		h = ipt_cls_hash(&key) & cls->hmask;
+		for (slot = &cls->slots[h]; slot->offset != IPT_CLS_EMPTY;
+		     slot = &cls->slots[h]) {
+			if (!memcmp(&slot->key, &key, sizeof(key)))
+				return get_entry(table_base, slot->offset);
+			h = (h + 1) & cls->hmask;
+		}
+
+		offset = run->end;
+		e = get_entry(table_base, offset);
+	}
+	return e;
+}
+
 /* Returns one of the generic firewall policies, like NF_ACCEPT. */
 unsigned int
 ipt_do_table(struct sk_buff *skb,
@@ -300,6 +650,7 @@ ipt_do_table(struct sk_buff *skb,
 	struct ipt_entry *e, **jumpstack;
 	unsigned int *stackptr, origptr, cpu;
 	const struct xt_table_info *private;
+	const struct ipt_classifier *cls;
 	struct xt_action_param acpar;
 	unsigned int addend;
 
@@ -330,6 +681,7 @@ ipt_do_table(struct sk_buff *skb,
 	jumpstack  = (struct ipt_entry **)private->jumpstack[cpu];
 	stackptr   = per_cpu_ptr(private->stackptr, cpu);
 	origptr    = *stackptr;
+	cls        = private->compiled;
 
 	e = get_entry(table_base, private->hook_entry[hook]);
 
@@ -342,6 +694,9 @@ ipt_do_table(struct sk_buff *skb,
 		const struct xt_entry_match *ematch;
 
 		IP_NF_ASSERT(e);
+		if (cls != NULL)
+			e = ipt_cls_next(cls, table_base, e, skb, ip,
+					 indev, outdev, &acpar);
 		if (!ip_packet_match(ip, indev, outdev,
 		    &e->ip, acpar.fragoff)) {
  no_match:
@@ -868,6 +1223,7 @@ translate_table(struct net *net, struct xt_table_info *newinfo, void *entry0,
 			memcpy(newinfo->entries[i], entry0, newinfo->size);
 	}
 
+	newinfo->compiled = ipt_cls_build(entry0, newinfo->size);
 	return ret;
 }
 
@@ -1766,6 +2122,7 @@ translate_compat_table(struct net *net,
 		if (newinfo->entries[i] && newinfo->entries[i] != entry1)
 			memcpy(newinfo->entries[i], entry1, newinfo->size);
 
+	newinfo->compiled = ipt_cls_build(entry1, newinfo->size);
 	*pinfo = newinfo;
 	*pentry0 = entry1;
 	xt_free_table_info(info);
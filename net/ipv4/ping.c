@@ -518,6 +518,7 @@ static int ping_sendmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 	ipc.opt = NULL;
 	ipc.oif = sk->sk_bound_dev_if;
 	ipc.tx_flags = 0;
+	ipc.gso_size = 0;
 	err = sock_tx_timestamp(sk, &ipc.tx_flags);
 	if (err)
 		return err;
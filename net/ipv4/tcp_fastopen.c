@@ -0,0 +1,119 @@
+/*
+ * TCP Fast Open: data in the SYN of the three-way handshake.
+ *
+ * The server hands out a cookie that is a keyed hash of the client's
+ * address.  A client presenting that cookie in a later SYN may carry
+ * data in it, which the server delivers to the application before the
+ * handshake completes.  Clients remember the cookie (and the peer's
+ * MSS) in the inet_peer entry of the server.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/percpu.h>
+#include <linux/random.h>
+#include <linux/seqlock.h>
+#include <linux/slab.h>
+#include <linux/cryptohash.h>
+#include <net/inetpeer.h>
+#include <net/tcp.h>
+
+int sysctl_tcp_fastopen __read_mostly;
+
+static __u32 tcp_fastopen_secret[16 - 4 + SHA_DIGEST_WORDS] __read_mostly;
+
+static DEFINE_PER_CPU(__u32 [16 + 5 + SHA_WORKSPACE_WORDS],
+		      tcp_fastopen_scratch);
+
+/* Protects the Fast Open fields of struct inet_peer */
+static DEFINE_SEQLOCK(fastopen_seqlock);
+
+static int __init tcp_fastopen_init(void)
+{
+	get_random_bytes(tcp_fastopen_secret, sizeof(tcp_fastopen_secret));
+	return 0;
+}
+__initcall(tcp_fastopen_init);
+
+/* Computes the fastopen cookie for the peer.  The peer address is hashed
+ * as 128 bits (padded with zeros for IPv4) together with the secret, in
+ * the same way syncookies are made.
+ */
+void tcp_fastopen_cookie_gen(__be32 addr, struct tcp_fastopen_cookie *foc)
+{
+	__u32 *tmp = get_cpu_var(tcp_fastopen_scratch);
+
+	memcpy(tmp + 4, tcp_fastopen_secret, sizeof(tcp_fastopen_secret));
+	tmp[0] = (__force u32)addr;
+	tmp[1] = tmp[2] = tmp[3] = 0;
+	sha_transform(tmp + 16, (const char *)tmp, tmp + 16 + 5);
+
+	BUILD_BUG_ON(TCP_FASTOPEN_COOKIE_SIZE > SHA_DIGEST_WORDS * 4);
+	memcpy(foc->val, tmp + 16, TCP_FASTOPEN_COOKIE_SIZE);
+	foc->len = TCP_FASTOPEN_COOKIE_SIZE;
+	put_cpu_var(tcp_fastopen_scratch);
+}
+
+void tcp_free_fastopen_req(struct tcp_sock *tp)
+{
+	if (tp->fastopen_req != NULL) {
+		kfree(tp->fastopen_req);
+		tp->fastopen_req = NULL;
+	}
+}
+
+void tcp_fastopen_cache_get(struct sock *sk, u16 *mss,
+			    struct tcp_fastopen_cookie *cookie,
+			    int *syn_loss, unsigned long *last_syn_loss)
+{
+	struct inet_peer *peer;
+	bool release_it;
+	unsigned int seq;
+
+	peer = inet_csk(sk)->icsk_af_ops->get_peer(sk, &release_it);
+	if (!peer)
+		return;
+
+	do {
+		seq = read_seqbegin(&fastopen_seqlock);
+		if (peer->tcp_fastopen_mss)
+			*mss = peer->tcp_fastopen_mss;
+		*cookie = peer->tcp_fastopen_cookie;
+		*syn_loss = peer->tcp_fastopen_syn_loss;
+		*last_syn_loss = *syn_loss ?
+				 peer->tcp_fastopen_last_syn_loss : 0;
+	} while (read_seqretry(&fastopen_seqlock, seq));
+
+	if (release_it)
+		inet_putpeer(peer);
+}
+
+void tcp_fastopen_cache_set(struct sock *sk, u16 mss,
+			    struct tcp_fastopen_cookie *cookie, bool syn_lost)
+{
+	struct inet_peer *peer;
+	bool release_it;
+
+	peer = inet_csk(sk)->icsk_af_ops->get_peer(sk, &release_it);
+	if (!peer)
+		return;
+
+	write_seqlock_bh(&fastopen_seqlock);
+	peer->tcp_fastopen_mss = mss;
+	if (cookie->len > 0)
+		peer->tcp_fastopen_cookie = *cookie;
+	if (syn_lost) {
+		++peer->tcp_fastopen_syn_loss;
+		peer->tcp_fastopen_last_syn_loss = jiffies;
+	} else
+		peer->tcp_fastopen_syn_loss = 0;
+	write_sequnlock_bh(&fastopen_seqlock);
+
+	if (release_it)
+		inet_putpeer(peer);
+}
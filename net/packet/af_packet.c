@@ -202,6 +202,9 @@ struct tpacket_kbdq_core {
 
 	atomic_t	blk_fill_in_prog;
 
+	/* Tx-ring only: frames of each block still owned by the device */
+	atomic_t	*tx_blk_pending;
+
 	/* Default is set to 8ms */
 #define DEFAULT_PRB_RETIRE_TOV	(8)
 
@@ -293,6 +296,7 @@ struct packet_sock {
 	unsigned int		tp_hdrlen;
 	unsigned int		tp_reserve;
 	unsigned int		tp_loss:1;
+	unsigned int		tp_qdisc_bypass:1;
 	unsigned int		tp_tstamp;
 	struct packet_type	prot_hook ____cacheline_aligned_in_smp;
 };
@@ -483,6 +487,55 @@ static void *packet_current_frame(struct packet_sock *po,
 	return packet_lookup_frame(po, rb, rb->head, status);
 }
 
+/*
+ * TPACKET_V3 Tx-ring: user space hands over whole blocks, so the
+ * status word that matters is the one in the block descriptor.
+ */
+static void __packet_set_block_status(struct tpacket_block_desc *pbd,
+		__u32 status)
+{
+	BLOCK_STATUS(pbd) = status;
+	flush_dcache_page(pgv_to_page(&BLOCK_STATUS(pbd)));
+	smp_wmb();
+}
+
+static __u32 __packet_get_block_status(struct tpacket_block_desc *pbd)
+{
+	smp_rmb();
+	flush_dcache_page(pgv_to_page(&BLOCK_STATUS(pbd)));
+	return BLOCK_STATUS(pbd);
+}
+
+static struct tpacket_block_desc *packet_current_tx_block(
+		struct packet_ring_buffer *rb, __u32 status)
+{
+	struct tpacket_kbdq_core *pkc = GET_PBDQC_FROM_RB(rb);
+	struct tpacket_block_desc *pbd;
+
+	pbd = GET_PBLOCK_DESC(pkc, pkc->kactive_blk_num);
+	if (status != __packet_get_block_status(pbd))
+		return NULL;
+
+	return pbd;
+}
+
+static void packet_increment_tx_block(struct packet_ring_buffer *rb)
+{
+	struct tpacket_kbdq_core *pkc = GET_PBDQC_FROM_RB(rb);
+
+	if (++pkc->kactive_blk_num == pkc->knum_blocks)
+		pkc->kactive_blk_num = 0;
+}
+
+static bool packet_tx_ring_writable(struct packet_sock *po)
+{
+	if (po->tp_version == TPACKET_V3)
+		return packet_current_tx_block(&po->tx_ring,
+					       TP_STATUS_AVAILABLE) != NULL;
+	return packet_current_frame(po, &po->tx_ring,
+				    TP_STATUS_AVAILABLE) != NULL;
+}
+
 static void prb_del_retire_blk_timer(struct tpacket_kbdq_core *pkc)
 {
 	del_timer_sync(&pkc->retire_blk_timer);
@@ -1954,12 +2007,86 @@ static void tpacket_destruct_skb(struct sk_buff *skb)
 		ph = skb_shinfo(skb)->destructor_arg;
 		BUG_ON(atomic_read(&po->tx_ring.pending) == 0);
 		atomic_dec(&po->tx_ring.pending);
-		__packet_set_status(po, ph, TP_STATUS_AVAILABLE);
+		if (po->tp_version == TPACKET_V3) {
+			struct tpacket_kbdq_core *pkc;
+			atomic_t *blk_pending = ph;
+
+			/* The block goes back to user space with its last frame */
+			pkc = GET_PBDQC_FROM_RB(&po->tx_ring);
+			if (atomic_dec_and_test(blk_pending))
+				__packet_set_block_status(GET_PBLOCK_DESC(pkc,
+					blk_pending - pkc->tx_blk_pending),
+					TP_STATUS_AVAILABLE);
+		} else
+			__packet_set_status(po, ph, TP_STATUS_AVAILABLE);
 	}
 
 	sock_wfree(skb);
 }
 
+/*
+ * Hand a list of skbs for one device straight to the driver, taking the
+ * tx queue lock once for the whole batch instead of going through the
+ * qdisc layer for every frame.  Whatever the driver does not accept
+ * (queue stopped or busy) is passed on to dev_queue_xmit(), which will
+ * hold it in the qdisc.  All skbs are consumed; the return value is the
+ * first error seen, if any.
+ */
+static int packet_direct_xmit(struct net_device *dev,
+		struct sk_buff_head *list)
+{
+	struct netdev_queue *txq;
+	struct sk_buff *skb;
+	u16 queue_index;
+	int ret = 0;
+	int rc;
+
+	if (unlikely(!netif_running(dev) || !netif_carrier_ok(dev))) {
+		__skb_queue_purge(list);
+		return -ENETDOWN;
+	}
+
+	queue_index = raw_smp_processor_id() % dev->real_num_tx_queues;
+	txq = netdev_get_tx_queue(dev, queue_index);
+
+	local_bh_disable();
+	HARD_TX_LOCK(dev, txq, smp_processor_id());
+	while ((skb = skb_peek(list)) != NULL) {
+		if (netif_xmit_frozen_or_stopped(txq))
+			break;
+
+		__skb_unlink(skb, list);
+		skb_set_queue_mapping(skb, queue_index);
+		rc = dev_hard_start_xmit(skb, dev, txq);
+		if (!dev_xmit_complete(rc)) {
+			__skb_queue_head(list, skb);
+			break;
+		}
+	}
+	HARD_TX_UNLOCK(dev, txq);
+	local_bh_enable();
+
+	while ((skb = __skb_dequeue(list)) != NULL) {
+		rc = dev_queue_xmit(skb);
+		if (rc && !ret)
+			ret = rc;
+	}
+
+	return ret;
+}
+
+static int packet_xmit(struct packet_sock *po, struct sk_buff *skb)
+{
+	struct sk_buff_head list;
+
+	if (!po->tp_qdisc_bypass)
+		return dev_queue_xmit(skb);
+
+	__skb_queue_head_init(&list);
+	__skb_queue_tail(&list, skb);
+	return packet_direct_xmit(skb->dev, &list);
+}
+
 static int tpacket_fill_skb(struct packet_sock *po, struct sk_buff *skb,
 		void *frame, struct net_device *dev, int size_max,
 		__be16 proto, unsigned char *addr, int hlen)
@@ -1967,6 +2094,7 @@ static int tpacket_fill_skb(struct packet_sock *po, struct sk_buff *skb,
 	union {
 		struct tpacket_hdr *h1;
 		struct tpacket2_hdr *h2;
+		struct tpacket3_hdr *h3;
 		void *raw;
 	} ph;
 	int to_write, offset, len, tp_len, nr_frags, len_max;
@@ -1984,6 +2112,9 @@ static int tpacket_fill_skb(struct packet_sock *po, struct sk_buff *skb,
 	skb_shinfo(skb)->destructor_arg = ph.raw;
 
 	switch (po->tp_version) {
+	case TPACKET_V3:
+		tp_len = ph.h3->tp_len;
+		break;
 	case TPACKET_V2:
 		tp_len = ph.h2->tp_len;
 		break;
@@ -2058,6 +2189,134 @@ static int tpacket_fill_skb(struct packet_sock *po, struct sk_buff *skb,
 	return tp_len;
 }
 
+/*
+ * Build the skbs for all frames of one TPACKET_V3 Tx block and send them
+ * as a batch.  Frames are chained through tp_next_offset, starting at
+ * offset_to_first_pkt, and must lie entirely inside the block.  On a
+ * malformed frame nothing of the block is sent (unless PACKET_LOSS is
+ * set, in which case the frame is skipped) and the block is handed back
+ * with TP_STATUS_WRONG_FORMAT.
+ */
+static int tpacket_snd_block(struct packet_sock *po,
+		struct tpacket_block_desc *pbd, struct net_device *dev,
+		__be16 proto, unsigned char *addr, int size_max)
+{
+	struct tpacket_kbdq_core *pkc = GET_PBDQC_FROM_RB(&po->tx_ring);
+	unsigned int hdrlen = po->tp_hdrlen - sizeof(struct sockaddr_ll);
+	unsigned int blk_size = pkc->kblk_size;
+	atomic_t *blk_pending;
+	struct tpacket3_hdr *ph;
+	struct sk_buff_head list;
+	struct sk_buff *skb;
+	unsigned int num, off, i;
+	int tp_len, frame_max, len_sum = 0;
+	int hlen, tlen;
+	int err = 0;
+
+	blk_pending = &pkc->tx_blk_pending[pkc->kactive_blk_num];
+	/* Bias so the block cannot complete while it is being built */
+	atomic_set(blk_pending, 1);
+	__packet_set_block_status(pbd, TP_STATUS_SENDING);
+
+	__skb_queue_head_init(&list);
+	hlen = LL_RESERVED_SPACE(dev);
+	tlen = dev->needed_tailroom;
+
+	num = BLOCK_NUM_PKTS(pbd);
+	off = BLOCK_O2FP(pbd);
+	for (i = 0; i < num; i++) {
+		err = -EINVAL;
+		if (unlikely(off < BLK_HDR_LEN || off > blk_size - hdrlen ||
+			     (off & (TPACKET_ALIGNMENT - 1))))
+			goto out_wrong_format;
+
+		ph = (struct tpacket3_hdr *)((char *)pbd + off);
+		frame_max = min_t(int, size_max, blk_size - off - hdrlen);
+
+		skb = sock_alloc_send_skb(&po->sk,
+				hlen + tlen + sizeof(struct sockaddr_ll),
+				0, &err);
+		if (unlikely(skb == NULL))
+			goto out_purge;
+
+		tp_len = tpacket_fill_skb(po, skb, ph, dev, frame_max, proto,
+				addr, hlen);
+		if (unlikely(tp_len < 0)) {
+			kfree_skb(skb);
+			err = tp_len;
+			if (!po->tp_loss)
+				goto out_wrong_format;
+		} else {
+			skb_shinfo(skb)->destructor_arg = blk_pending;
+			skb->destructor = tpacket_destruct_skb;
+			atomic_inc(blk_pending);
+			atomic_inc(&po->tx_ring.pending);
+			__skb_queue_tail(&list, skb);
+			len_sum += tp_len;
+		}
+
+		if (!ph->tp_next_offset)
+			break;
+		off += ph->tp_next_offset;
+	}
+
+	if (!skb_queue_empty(&list)) {
+		if (po->tp_qdisc_bypass) {
+			packet_direct_xmit(dev, &list);
+		} else {
+			while ((skb = __skb_dequeue(&list)) != NULL)
+				dev_queue_xmit(skb);
+		}
+	}
+
+	if (atomic_dec_and_test(blk_pending))
+		__packet_set_block_status(pbd, TP_STATUS_AVAILABLE);
+	packet_increment_tx_block(&po->tx_ring);
+	return len_sum;
+
+out_wrong_format:
+	__skb_queue_purge(&list);
+	atomic_set(blk_pending, 0);
+	__packet_set_block_status(pbd, TP_STATUS_WRONG_FORMAT);
+	packet_increment_tx_block(&po->tx_ring);
+	return err;
+
+out_purge:
+	/* Out of memory: leave the block to user space to retry */
+	__skb_queue_purge(&list);
+	atomic_set(blk_pending, 0);
+	__packet_set_block_status(pbd, TP_STATUS_SEND_REQUEST);
+	return err;
+}
+
+static int tpacket_snd_v3(struct packet_sock *po, struct msghdr *msg,
+		struct net_device *dev, __be16 proto, unsigned char *addr)
+{
+	struct tpacket_block_desc *pbd;
+	int size_max = dev->mtu + dev->hard_header_len;
+	int len_sum = 0;
+	int err;
+
+	do {
+		pbd = packet_current_tx_block(&po->tx_ring,
+				TP_STATUS_SEND_REQUEST);
+		if (unlikely(pbd == NULL)) {
+			schedule();
+			continue;
+		}
+
+		err = tpacket_snd_block(po, pbd, dev, proto, addr, size_max);
+		if (unlikely(err < 0))
+			return err;
+		len_sum += err;
+	} while (likely((pbd != NULL) ||
+			((!(msg->msg_flags & MSG_DONTWAIT)) &&
+			 (atomic_read(&po->tx_ring.pending))))
+		);
+
+	return len_sum;
+}
+
 static int tpacket_snd(struct packet_sock *po, struct msghdr *msg)
 {
 	struct sk_buff *skb;
@@ -2104,6 +2363,11 @@ static int tpacket_snd(struct packet_sock *po, struct msghdr *msg)
 	if (unlikely(!(dev->flags & IFF_UP)))
 		goto out_put;
 
+	if (po->tp_version == TPACKET_V3) {
+		err = tpacket_snd_v3(po, msg, dev, proto, addr);
+		goto out_put;
+	}
+
 	size_max = po->tx_ring.frame_size
 		- (po->tp_hdrlen - sizeof(struct sockaddr_ll));
 
@@ -2151,7 +2415,7 @@ static int tpacket_snd(struct packet_sock *po, struct msghdr *msg)
 		atomic_inc(&po->tx_ring.pending);
 
 		status = TP_STATUS_SEND_REQUEST;
-		err = dev_queue_xmit(skb);
+		err = packet_xmit(po, skb);
 		if (unlikely(err > 0)) {
 			err = net_xmit_errno(err);
 			if (err && __packet_get_status(po, ph) ==
@@ -2388,7 +2652,7 @@ static int packet_snd(struct socket *sock,
 	 *	Now send it
 	 */
 
-	err = dev_queue_xmit(skb);
+	err = packet_xmit(po, skb);
 	if (err > 0 && (err = net_xmit_errno(err)) != 0)
 		goto out_unlock;
 
@@ -3160,6 +3424,18 @@ packet_setsockopt(struct socket *sock, int level, int optname, char __user *optv
 		po->tp_loss = !!val;
 		return 0;
 	}
+	case PACKET_QDISC_BYPASS:
+	{
+		int val;
+
+		if (optlen != sizeof(val))
+			return -EINVAL;
+		if (copy_from_user(&val, optval, sizeof(val)))
+			return -EFAULT;
+
+		po->tp_qdisc_bypass = !!val;
+		return 0;
+	}
 	case PACKET_AUXDATA:
 	{
 		int val;
@@ -3305,6 +3581,9 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 	case PACKET_LOSS:
 		val = po->tp_loss;
 		break;
+	case PACKET_QDISC_BYPASS:
+		val = po->tp_qdisc_bypass;
+		break;
 	case PACKET_TIMESTAMP:
 		val = po->tp_tstamp;
 		break;
@@ -3447,7 +3726,7 @@ static unsigned int packet_poll(struct file *file, struct socket *sock,
 	spin_unlock_bh(&sk->sk_receive_queue.lock);
 	spin_lock_bh(&sk->sk_write_queue.lock);
 	if (po->tx_ring.pg_vec) {
-		if (packet_current_frame(po, &po->tx_ring, TP_STATUS_AVAILABLE))
+		if (packet_tx_ring_writable(po))
 			mask |= POLLOUT | POLLWRNORM;
 	}
 	spin_unlock_bh(&sk->sk_write_queue.lock);
@@ -3564,6 +3843,7 @@ static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 		int closing, int tx_ring)
 {
 	struct pgv *pg_vec = NULL;
+	atomic_t *blk_pending = NULL;
 	struct packet_sock *po = pkt_sk(sk);
 	int was_running, order = 0;
 	struct packet_ring_buffer *rb;
@@ -3573,12 +3853,6 @@ static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 	/* Added to avoid minimal code churn */
 	struct tpacket_req *req = &req_u->req;
 
-	/* Opening a Tx-ring is NOT supported in TPACKET_V3 */
-	if (!closing && tx_ring && (po->tp_version > TPACKET_V2)) {
-		WARN(1, "Tx-ring is not supported.\n");
-		goto out;
-	}
-
 	rb = tx_ring ? &po->tx_ring : &po->rx_ring;
 	rb_queue = tx_ring ? &sk->sk_write_queue : &sk->sk_receive_queue;
 
@@ -3633,12 +3907,20 @@ static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 			goto out;
 		switch (po->tp_version) {
 		case TPACKET_V3:
-		/* Transmit path is not supported. We checked
-		 * it above but just being paranoid
-		 */
-			if (!tx_ring)
+			/* The Tx-ring has no retire timer; user space
+			 * decides when a block is complete.
+			 */
+			if (!tx_ring) {
 				init_prb_bdqc(po, rb, pg_vec, req_u, tx_ring);
 				break;
+			}
+			blk_pending = kcalloc(req->tp_block_nr,
+					      sizeof(atomic_t), GFP_KERNEL);
+			if (unlikely(!blk_pending)) {
+				free_pg_vec(pg_vec, order, req->tp_block_nr);
+				goto out;
+			}
+			break;
 		default:
 			break;
 		}
@@ -3673,6 +3955,15 @@ static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 		rb->frame_max = (req->tp_frame_nr - 1);
 		rb->head = 0;
 		rb->frame_size = req->tp_frame_size;
+		if (tx_ring && po->tp_version == TPACKET_V3) {
+			struct tpacket_kbdq_core *pkc = GET_PBDQC_FROM_RB(rb);
+
+			swap(pkc->tx_blk_pending, blk_pending);
+			pkc->pkbdq = rb->pg_vec;
+			pkc->kblk_size = req->tp_block_size;
+			pkc->knum_blocks = req->tp_block_nr;
+			pkc->kactive_blk_num = 0;
+		}
 		spin_unlock_bh(&rb_queue->lock);
 
 		swap(rb->pg_vec_order, order);
@@ -3695,7 +3986,7 @@ static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 	}
 	spin_unlock(&po->bind_lock);
 	if (closing && (po->tp_version > TPACKET_V2)) {
-		/* Because we don't support block-based V3 on tx-ring */
+		/* The block-based V3 tx-ring has no retire timer */
 		if (!tx_ring)
 			prb_shutdown_retire_blk_timer(po, tx_ring, rb_queue);
 	}
@@ -3703,6 +3994,7 @@ static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 
 	if (pg_vec)
 		free_pg_vec(pg_vec, order, req->tp_block_nr);
+	kfree(blk_pending);
 out:
 	return err;
 }